@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sokt.h"
+
+// Administrative commands understood by servers
+struct command
+{
+    const char *name;
+    enum sokt_message_code code;
+};
+
+static const struct command commands[] = {
+    {"save", SOKT_CODE_SAVE},
+    {"checkpoint", SOKT_CODE_CHECKPOINT},
+    {"trace", SOKT_CODE_TRACE},
+    {"stats", SOKT_CODE_STATS},
+};
+
+#define COMMAND_NUM (sizeof(commands) / sizeof(commands[0]))
+
+int main(int argc, char *argv[])
+{
+    int rv = EXIT_FAILURE;
+    const struct command *command = NULL;
+
+    // Parse arguments
+    if (argc == 4)
+    {
+        for (int i = 0; i < COMMAND_NUM; i++)
+        {
+            if (strcmp(argv[3], commands[i].name) == 0)
+            {
+                command = &commands[i];
+            }
+        }
+    }
+
+    if (!command)
+    {
+        fprintf(stderr, "Usage: admin serv_addr serv_port command\ncommands:");
+        for (int i = 0; i < COMMAND_NUM; i++)
+        {
+            fprintf(stderr, " %s", commands[i].name);
+        }
+        fprintf(stderr, "\n");
+        goto out1;
+    }
+
+    int sockfd = sokt_active_open(argv[1], argv[2]);
+    if (sockfd == -1)
+    {
+        fprintf(stderr, "sokt_active_open failed\n");
+        goto out1;
+    }
+
+    struct sokt_message msg = {.code = command->code};
+
+    if (sokt_send(sockfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out2;
+    }
+
+    if (sokt_recv(sockfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_recv failed\n");
+        goto out2;
+    }
+
+    // Statistics come as text after the reply
+    if (command->code == SOKT_CODE_STATS && msg.code == SOKT_CODE_SUCCESS)
+    {
+        char *text = malloc(msg.value);
+        if (!text)
+        {
+            perror("malloc for text");
+            goto out2;
+        }
+
+        if (sokt_recv(sockfd, text, msg.value) != 0)
+        {
+            fprintf(stderr, "sokt_recv failed\n");
+            free(text);
+            goto out2;
+        }
+
+        fwrite(text, 1, msg.value, stdout);
+        free(text);
+    }
+    else
+    {
+        skot_message_show(&msg);
+    }
+
+    if (msg.code == SOKT_CODE_SUCCESS)
+    {
+        rv = EXIT_SUCCESS;
+    }
+
+out2:
+    sokt_active_close(sockfd);
+
+out1:
+    return rv;
+}
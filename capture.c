@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "capture.h"
+
+#define CAPTURE_MAGIC "RKVCAPT"
+#define CAPTURE_VERSION 3 // 2 since request codes got back their original values, 3 since CAS and TTLs are kept
+
+struct header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+// Gaps longer than UINT32_MAX ns (about 4 s) are shortened to it, idle time being of no use to replays
+struct record
+{
+    uint32_t gap; // In ns since the previous request
+    uint8_t code;
+    uint8_t value_size;
+    int32_t key;
+    int32_t value;
+    int32_t expected;
+    int32_t ttl;
+} __attribute__((packed));
+
+// Requests are timed and appended under the mutex, so that gaps are never negative; a thread writes out what is left
+// pending once idle, as servers are usually killed rather than closing their capture
+struct capture
+{
+    int fd;
+    pthread_t tid;
+    atomic_int is_over;
+    pthread_mutex_t mutex;
+    struct record records[CAPTURE_BATCH];
+    int n;
+    uint64_t last;    // Arrival of the previous request, in ns of the monotonic clock
+    uint64_t written; // When records were last written out
+    char is_failed;
+};
+
+static uint64_t now_ns(void);
+static int write_out(struct capture *capture);
+static void *flush_routine(void *info);
+
+struct capture *capture_open(const char *path)
+{
+    assert(path);
+
+    struct capture *capture = calloc(1, sizeof(struct capture));
+    if (!capture)
+    {
+        perror("calloc for capture");
+        goto out1;
+    }
+
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (capture->fd == -1)
+    {
+        perror("open");
+        goto out2;
+    }
+
+    struct header header = {CAPTURE_MAGIC, CAPTURE_VERSION, sizeof(struct record)};
+    if (write(capture->fd, &header, sizeof(header)) != sizeof(header))
+    {
+        perror("write");
+        goto out3;
+    }
+
+    pthread_mutex_init(&capture->mutex, NULL);
+    capture->last = capture->written = now_ns();
+    atomic_init(&capture->is_over, 0);
+
+    if (pthread_create(&capture->tid, NULL, flush_routine, capture) != 0)
+    {
+        perror("pthread_create");
+        goto out4;
+    }
+
+    return capture;
+
+out4:
+    pthread_mutex_destroy(&capture->mutex);
+out3:
+    close(capture->fd);
+out2:
+    free(capture);
+out1:
+    return NULL;
+}
+
+void capture_close(struct capture *capture)
+{
+    if (!capture)
+    {
+        return;
+    }
+
+    atomic_store(&capture->is_over, 1);
+    pthread_join(capture->tid, NULL);
+
+    pthread_mutex_lock(&capture->mutex);
+    write_out(capture);
+    pthread_mutex_unlock(&capture->mutex);
+
+    close(capture->fd);
+    pthread_mutex_destroy(&capture->mutex);
+    free(capture);
+}
+
+int capture_append(struct capture *capture, int code, int key, int value, int value_size, int expected, int ttl)
+{
+    assert(capture);
+
+    int rv = 0;
+
+    pthread_mutex_lock(&capture->mutex);
+
+    uint64_t now = now_ns();
+    uint64_t gap = now - capture->last;
+    capture->last = now;
+
+    capture->records[capture->n++] =
+        (struct record){gap < UINT32_MAX ? gap : UINT32_MAX, code, value_size, key, value, expected, ttl};
+
+    if (capture->n == CAPTURE_BATCH || now - capture->written >= CAPTURE_FLUSH_MS * 1000000ull)
+    {
+        rv = write_out(capture);
+    }
+
+    pthread_mutex_unlock(&capture->mutex);
+
+    return rv;
+}
+
+long capture_read(const char *path, struct capture_request **requests)
+{
+    assert(path);
+    assert(requests);
+
+    long n = -1;
+    struct header header;
+    struct stat st;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        perror("fopen");
+        goto out1;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || fstat(fileno(fp), &st) == -1 ||
+        memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 || header.version != CAPTURE_VERSION ||
+        header.record_size != sizeof(struct record))
+    {
+        fprintf(stderr, "%s is not a capture\n", path);
+        goto out2;
+    }
+
+    // A record torn by a killed server is left out
+    long record_num = (st.st_size - sizeof(header)) / sizeof(struct record);
+    *requests = malloc((record_num > 0 ? record_num : 1) * sizeof(struct capture_request));
+    if (!*requests)
+    {
+        perror("malloc for requests");
+        goto out2;
+    }
+
+    struct record r;
+    uint64_t at = 0;
+    for (n = 0; n < record_num && fread(&r, sizeof(r), 1, fp) == 1; n++)
+    {
+        at += r.gap;
+        (*requests)[n] = (struct capture_request){at, r.code, r.key, r.value, r.value_size, r.expected, r.ttl};
+    }
+
+out2:
+    fclose(fp);
+out1:
+    return n;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Called with the mutex held, a capture failing once stops being written so that it is not left with a hole
+static int write_out(struct capture *capture)
+{
+    const char *buf = (const char *)capture->records;
+    size_t size = capture->n * sizeof(struct record);
+
+    capture->n = 0;
+    capture->written = capture->last;
+
+    while (size > 0 && !capture->is_failed)
+    {
+        ssize_t n = write(capture->fd, buf, size);
+        if (n == -1)
+        {
+            perror("write");
+            capture->is_failed = 1;
+            break;
+        }
+
+        buf += n;
+        size -= n;
+    }
+
+    return capture->is_failed ? -1 : 0;
+}
+
+// Requests pending for CAPTURE_FLUSH_MS are written out even when no other request comes to do it
+static void *flush_routine(void *info)
+{
+    struct capture *capture = info;
+    struct timespec interval = {CAPTURE_FLUSH_MS / 1000, CAPTURE_FLUSH_MS % 1000 * 1000000};
+
+    while (!atomic_load(&capture->is_over))
+    {
+        nanosleep(&interval, NULL);
+
+        pthread_mutex_lock(&capture->mutex);
+        if (capture->n > 0 && now_ns() - capture->written >= CAPTURE_FLUSH_MS * 1000000ull)
+        {
+            write_out(capture);
+        }
+        pthread_mutex_unlock(&capture->mutex);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,69 @@
+/*
+ * Capture of the requests servers get, to be replayed by clients
+ */
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Capture being written
+ *
+ */
+struct capture;
+
+/**
+ * @brief A request read back from a capture
+ *
+ */
+struct capture_request
+{
+    uint64_t at; // In ns since the capture was opened
+    int code;    // enum sokt_message_code
+    int key;
+    int value;
+    int value_size; // In bytes, 0 for requests without a value
+    int expected;   // For CAS
+    int ttl;        // In ms, 0 for never expiring
+};
+
+/**
+ * @brief Open a capture, replacing the file if there is one
+ *
+ * @param path
+ * @return struct capture* NULL for failure
+ */
+struct capture *capture_open(const char *path);
+
+/**
+ * @brief Write out what is pending and close a capture
+ *
+ * @param capture
+ */
+void capture_close(struct capture *capture);
+
+/**
+ * @brief Append a request arriving now, written out once CAPTURE_BATCH are pending or within about CAPTURE_FLUSH_MS
+ * even if no other request comes, so that a killed server loses at most the requests of the last interval
+ *
+ * @param capture
+ * @param code
+ * @param key
+ * @param value
+ * @param value_size in bytes, 0 for requests without a value
+ * @param expected for CAS
+ * @param ttl in ms, 0 for never expiring
+ * @return int -1 for failure
+ */
+int capture_append(struct capture *capture, int code, int key, int value, int value_size, int expected, int ttl);
+
+/**
+ * @brief Read all the requests of a capture
+ *
+ * @param path
+ * @param requests allocated, to be freed by the caller
+ * @return long number of requests, -1 for failure
+ */
+long capture_read(const char *path, struct capture_request **requests);
+
+#endif
@@ -1,5 +1,7 @@
 #include <assert.h>
+#include <math.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,8 +11,11 @@
 #include <unistd.h>
 
 #include "parameters.h"
+#include "capture.h"
+#include "hist.h"
 #include "ht.h"
 #include "sokt.h"
+#include "zipf.h"
 
 // Experiment record
 struct log
@@ -22,29 +27,255 @@ struct log
 // Length of the log
 #define LOG_LENGTH (TEST_NUM / STATISTICS_CYCLE - 1)
 
+#define KEY_NUM (HT_KEY_MAX - HT_KEY_MIN + 1)
+
+_Static_assert(TXN_CLIENT_KEY_NUM <= TXN_KEY_MAX, "servers take at most TXN_KEY_MAX keys in a transaction");
+
+enum op
+{
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_RMW, // Read then update
+    OP_DEL,
+    OP_INCR,
+    OP_TXN, // PUT consecutive keys atomically
+    OP_NUM
+};
+
+enum distribution
+{
+    DISTRIBUTION_UNIFORM,
+    DISTRIBUTION_ZIPFIAN,
+    DISTRIBUTION_LATEST, // Recently inserted keys are the most popular
+    DISTRIBUTION_HOTSPOT,
+    DISTRIBUTION_NUM
+};
+
+// Percentage of each operation
+struct workload
+{
+    const char *name;
+    int percents[OP_NUM];
+    enum distribution distribution;
+};
+
+// The core YCSB workloads, scans read consecutive keys one GET at a time as keys are hashed on servers
+const struct workload workloads[] = {
+    {"default",
+     {100 - PUT_PERCENT - DEL_PERCENT - INCR_PERCENT - TXN_PERCENT, PUT_PERCENT, 0, 0, 0, DEL_PERCENT, INCR_PERCENT,
+      TXN_PERCENT},
+     DISTRIBUTION_UNIFORM},
+    {"a", {50, 50}, DISTRIBUTION_ZIPFIAN},
+    {"b", {95, 5}, DISTRIBUTION_ZIPFIAN},
+    {"c", {100}, DISTRIBUTION_ZIPFIAN},
+    {"d", {95, 0, 5}, DISTRIBUTION_LATEST},
+    {"e", {0, 0, 5, 95}, DISTRIBUTION_ZIPFIAN},
+    {"f", {50, 0, 0, 0, 50}, DISTRIBUTION_ZIPFIAN},
+    {"txn", {50, 0, 0, 0, 0, 0, 0, 50}, DISTRIBUTION_ZIPFIAN}, // Not from YCSB, to weigh transactions against reads
+};
+
+const char *distribution_names[] = {"uniform", "zipfian", "latest", "hotspot"};
+
+// Requests whose latencies are recorded apart
+enum latency
+{
+    LATENCY_GET_PRIMARY,
+    LATENCY_GET_BACKUP,
+    LATENCY_PUT,
+    LATENCY_DEL,
+    LATENCY_INCR,
+    LATENCY_TXN,
+    LATENCY_SCAN, // Whole operations of several requests, timed as one in open loop runs
+    LATENCY_RMW,
+    LATENCY_NUM
+};
+
+const char *latency_names[] = {"get_primary", "get_backup", "put", "del", "incr", "txn", "scan", "rmw"};
+
+// Shared by all client threads
+struct keys
+{
+    enum distribution distribution;
+    struct zipf *zipf;
+    atomic_uint inserted; // Number of keys inserted so far, key i % KEY_NUM being the i-th
+};
+
 struct client_routine_info
 {
     struct sokt_name_info *name_client;
     struct sokt_name_info *name_servers;
     int servers_num;
     int index;
+    const struct workload *workload;
+    struct keys *keys;
+    struct hist **hists; // One per enum latency, in ns
+};
+
+struct open_loop_info
+{
+    const struct sokt_name_info *name_servers;
+    int servers_num;
+    int index;
+    int step; // Of the sweep, so that steps do not draw the same operations
+    const struct workload *workload;
+    struct keys *keys;
+    double gap_ns; // Mean time between two operations of the thread
+    char is_poisson;
+    struct timespec start;
+    struct hist **hists;
+    long done; // Operations completed
+    long late; // Operations sent after their intended time, the thread being busy with the previous one
+};
+
+struct replay_info
+{
+    const struct sokt_name_info *name_servers;
+    int servers_num;
+    int index;
+    const struct capture_request *requests; // Of all threads, each sending every OPEN_LOOP_THREAD-th one
+    long request_num;
+    double speed;
+    struct timespec start;
+    struct hist **hists;
+    long done;
 };
 
 void *client_routine(void *info);
+ht_key_t next_key(struct keys *keys, unsigned short state[3]);
+enum op draw(const struct workload *workload, struct keys *keys, unsigned short state[3], int servers_num,
+             struct sokt_message *msg, int *server);
+int perform(const struct sokt_name_info *name_servers, struct sokt_message *msg, int server, enum op op,
+            unsigned short state[3], struct hist **hists, struct sokt_message *buf);
+int open_loop(const struct sokt_name_info *name_servers, int servers_num, const struct workload *workload,
+              struct keys *keys, double rate, int steps, char is_poisson, const char *port);
+void *open_loop_routine(void *info);
+int replay(const struct sokt_name_info *name_servers, int servers_num, const char *path, double speed,
+           const char *port);
+void *replay_routine(void *info);
+double elapsed_ns(const struct timespec *start);
+int latency_of(enum sokt_message_code code, int server);
+int request(const struct sokt_name_info *name_server, struct sokt_message *msg, int server, struct hist **hists);
+int request_with(const struct sokt_name_info *name_server, struct sokt_message *msg, const struct sokt_message *puts,
+                 int put_num, int server, struct hist **hists);
+int write_hists(struct hist **hists, const char *port);
+int load(const struct sokt_name_info *name_server, struct keys *keys);
 
 int main(int argc, char *argv[])
 {
     int rv = EXIT_FAILURE;
+    const struct workload *workload = workloads;
+    int distribution = -1;
+    double theta = ZIPF_THETA;
+    double rate = 0; // Closed loop unless given
+    int steps = 1;
+    char is_poisson = 1;
+    const char *capture_path = NULL;
+    double speed = 1;
+
+    // Parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "a:d:p:r:s:t:w:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            if (strcmp(optarg, "poisson") == 0 || strcmp(optarg, "constant") == 0)
+            {
+                is_poisson = optarg[0] == 'p';
+            }
+            else
+            {
+                argc = 0;
+            }
+            break;
+        case 'd':
+            for (distribution = DISTRIBUTION_NUM - 1; distribution >= 0; distribution--)
+            {
+                if (strcmp(optarg, distribution_names[distribution]) == 0)
+                {
+                    break;
+                }
+            }
+            if (distribution == -1)
+            {
+                argc = 0; // Show the usage
+            }
+            break;
+        case 'p':
+            capture_path = optarg;
+            break;
+        case 'r':
+            rate = atof(optarg);
+            if (rate <= 0)
+            {
+                argc = 0;
+            }
+            break;
+        case 's':
+            steps = atoi(optarg);
+            if (steps <= 0)
+            {
+                argc = 0;
+            }
+            break;
+        case 't':
+            theta = atof(optarg);
+            break;
+        case 'x':
+            speed = atof(optarg);
+            if (speed <= 0)
+            {
+                argc = 0;
+            }
+            break;
+        case 'w':
+            workload = NULL;
+            for (int i = 0; i < sizeof(workloads) / sizeof(*workloads); i++)
+            {
+                if (strcmp(optarg, workloads[i].name) == 0)
+                {
+                    workload = workloads + i;
+                }
+            }
+            if (!workload)
+            {
+                argc = 0;
+            }
+            break;
+        default:
+            argc = 0;
+            break;
+        }
+    }
+
+    // Leave the positional arguments where they would be without options
+    argc -= optind - 1;
+    argv += optind - 1;
 
     // Parse arguments
     if (argc <= 5 || argc % 2 == 0)
     {
-        fprintf(stderr, "Usage: client self_addr self_port "
+        fprintf(stderr, "Usage: client [-w default|a|b|c|d|e|f|txn] [-d uniform|zipfian|latest|hotspot] [-t theta] "
+                        "[-r ops_per_s [-s sweep_steps] [-a poisson|constant]] [-p capture [-x speed]] "
+                        "self_addr self_port "
                         "parimary_serv_addr primary_serv_port "
                         "backup_serv_addr_1 backup_serv_port1 ...\n");
         goto out1;
     }
 
+    struct keys keys;
+    keys.distribution = distribution == -1 ? workload->distribution : distribution;
+    atomic_init(&keys.inserted, 0);
+
+    keys.zipf = zipf_create(KEY_NUM, theta);
+    if (!keys.zipf)
+    {
+        fprintf(stderr, "zipf_create failed\n");
+        goto out1;
+    }
+
     struct sokt_name_info name_client, *name_servers;
 
     name_client.addr = argv[1];
@@ -55,7 +286,7 @@ int main(int argc, char *argv[])
     if (!name_servers)
     {
         perror("calloc for name_servers");
-        goto out1;
+        goto out2;
     }
 
     for (int i = 0; i < servers_num; i++)
@@ -70,10 +301,72 @@ int main(int argc, char *argv[])
     {
         printf("backup%d\t\t%s:%s\n", i - 1, name_servers[i].addr, name_servers[i].port);
     }
-    printf("\n");
+
+    // Replays send the captured requests only
+    if (capture_path)
+    {
+        if (replay(name_servers, servers_num, capture_path, speed, name_client.port) == -1)
+        {
+            fprintf(stderr, "replay failed\n");
+            goto out3;
+        }
+
+        rv = EXIT_SUCCESS;
+        goto out3;
+    }
+
+    printf("workload\t%s, %s keys", workload->name, distribution_names[keys.distribution]);
+    if (keys.distribution == DISTRIBUTION_ZIPFIAN || keys.distribution == DISTRIBUTION_LATEST)
+    {
+        printf(" with theta %.2f", theta);
+    }
+    printf("\n\n");
+
+    // YCSB workloads run on a loaded table, the default one fills it up by itself
+    if (workload != workloads)
+    {
+        if (load(name_servers, &keys) == -1)
+        {
+            fprintf(stderr, "load failed\n");
+            goto out3;
+        }
+
+        printf("%d keys loaded\n", YCSB_RECORD_NUM);
+    }
+    else
+    {
+        atomic_store(&keys.inserted, KEY_NUM);
+    }
+
+    // Open loop runs take the place of the closed loop ones
+    if (rate > 0)
+    {
+        if (open_loop(name_servers, servers_num, workload, &keys, rate, steps, is_poisson, name_client.port) == -1)
+        {
+            fprintf(stderr, "open_loop failed\n");
+            goto out3;
+        }
+
+        rv = EXIT_SUCCESS;
+        goto out3;
+    }
 
     pthread_t tids[CLIENT_THREAD];
     struct client_routine_info info[CLIENT_THREAD];
+    struct hist *hists[CLIENT_THREAD + 1][LATENCY_NUM] = {0}; // The last ones for all threads
+
+    for (int i = 0; i < CLIENT_THREAD + 1; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hists[i][j] = hist_create();
+            if (!hists[i][j])
+            {
+                fprintf(stderr, "hist_create failed\n");
+                goto out4;
+            }
+        }
+    }
 
     // Statistics
     struct timeval start, end;
@@ -85,11 +378,14 @@ int main(int argc, char *argv[])
         info[i].name_servers = name_servers;
         info[i].servers_num = servers_num;
         info[i].index = i;
+        info[i].workload = workload;
+        info[i].keys = &keys;
+        info[i].hists = hists[i];
 
         if (pthread_create(&tids[i], NULL, client_routine, &info[i]) != 0)
         {
             perror("pthread_create");
-            goto out2;
+            goto out4;
         }
     }
 
@@ -98,7 +394,7 @@ int main(int argc, char *argv[])
         if (pthread_join(tids[i], NULL) != 0)
         {
             perror("pthread_join");
-            goto out2;
+            goto out4;
         }
     }
 
@@ -106,12 +402,39 @@ int main(int argc, char *argv[])
     double us = (end.tv_sec * 1000000 + end.tv_usec) - (start.tv_sec * 1000000 + start.tv_usec);
     printf("throughput is %.3f ops/ms\n", TEST_NUM * CLIENT_THREAD / (us / 1000));
 
+    // Latencies of all threads
+    for (int i = 0; i < CLIENT_THREAD; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hist_merge(hists[CLIENT_THREAD][j], hists[i][j]);
+        }
+    }
+
+    if (write_hists(hists[CLIENT_THREAD], name_client.port) == -1)
+    {
+        fprintf(stderr, "write_hists failed\n");
+        goto out4;
+    }
+
     // Release resources
     rv = EXIT_SUCCESS;
 
-out2:
+out4:
+    for (int i = 0; i < CLIENT_THREAD + 1; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hist_destroy(hists[i][j]);
+        }
+    }
+
+out3:
     free(name_servers);
 
+out2:
+    zipf_destroy(keys.zipf);
+
 out1:
     return rv;
 }
@@ -122,23 +445,26 @@ void *client_routine(void *info)
     struct sokt_name_info *name_servers = ((struct client_routine_info *)info)->name_servers;
     int servers_num = ((struct client_routine_info *)info)->servers_num;
     int index = ((struct client_routine_info *)info)->index;
+    const struct workload *workload = ((struct client_routine_info *)info)->workload;
+    struct keys *keys = ((struct client_routine_info *)info)->keys;
+    struct hist **hists = ((struct client_routine_info *)info)->hists;
 
     // Initiate hash table
-    struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, NULL, NULL);
+    struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, HT_HASH, NULL, NULL);
     if (!ht)
     {
         fprintf(stderr, "ht_create failed\n");
         goto out1;
     }
 
-    ht_preload(ht);
-
     printf("hashtable initiated for thread %d\n", index);
 
     // Run the key-value store
     printf("running experiments for thread %d\n", index);
 
-    srand48(getpid() * time(NULL));
+    // Each thread draws from its own generator
+    unsigned seed = getpid() * time(NULL);
+    unsigned short state[3] = {seed, seed >> 16, index};
 
     struct sokt_message msg, buf;
     enum ht_code code;
@@ -191,56 +517,16 @@ void *client_routine(void *info)
         */
 
         // Generate the code, key, value and server index for test
-        msg.key = rand() % (HT_KEY_MAX - HT_KEY_MIN) + HT_KEY_MIN;
-        msg.code = rand() % 100;
-        if (msg.code < PUT_PERCENT)
+        enum op op = draw(workload, keys, state, servers_num, &msg, &server);
+        if (perform(name_servers, &msg, server, op, state, hists, &buf) == -1)
         {
-            msg.code = SOKT_CODE_PUT;
-            msg.value = rand() % HT_VALUE_MAX;
-            server = 0;
-        }
-        else
-        {
-            msg.code = SOKT_CODE_GET;
-            msg.value = -1;
-            server = rand() % servers_num;
-        }
-
-        int sockfd = sokt_active_open(name_servers[server].addr, name_servers[server].port);
-        if (sockfd == -1)
-        {
-            fprintf(stderr, "sokt_active_open failed\n");
-            goto loop_clean;
-        }
-
-        // Send and recv
-        memcpy(&buf, &msg, sizeof(struct sokt_message));
-        if (sokt_send(sockfd, (char *)&buf, sizeof(struct sokt_message)) != 0)
-        {
-            fprintf(stderr, "sokt_send failed\n");
-            goto loop_clean;
-        }
-
-#ifdef LOG
-        printf("to   server %d:\t", server);
-        skot_message_show(&buf);
-#endif
-
-        if (sokt_recv(sockfd, (char *)&buf, sizeof(struct sokt_message)) != 0)
-        {
-            fprintf(stderr, "sokt_recv failed\n");
             goto loop_clean;
         }
 
-#ifdef LOG
-        printf("from server %d:\t", server);
-        skot_message_show(&buf);
-#endif
-
         // Validate the returned information
         if (msg.code == SOKT_CODE_PUT)
         {
-            code = ht_put(ht, msg.key, msg.value, NULL, NULL, NULL);
+            code = ht_put_expire(ht, msg.key, msg.value, msg.ttl ? ht_time_ms() + msg.ttl : 0, NULL, NULL, NULL);
             assert((buf.code == SOKT_CODE_SUCCESS && code == HT_CODE_SUCCESS) || (buf.code == SOKT_CODE_FULL && code == HT_CODE_FULL));
             assert(buf.key == msg.key);
             assert(buf.value == msg.value);
@@ -252,6 +538,33 @@ void *client_routine(void *info)
             }
 #endif
         }
+        else if (msg.code == SOKT_CODE_DEL)
+        {
+            code = ht_del(ht, msg.key, NULL, NULL);
+            assert((buf.code == SOKT_CODE_SUCCESS && code == HT_CODE_SUCCESS) || (buf.code == SOKT_CODE_NOT_FOUND && code == HT_CODE_NOT_FOUND));
+            assert(buf.key == msg.key);
+        }
+        else if (msg.code == SOKT_CODE_INCR)
+        {
+            // The counter may have been bumped by other clients too, only the new value is known
+            if (buf.code == SOKT_CODE_SUCCESS)
+            {
+                code = ht_put(ht, msg.key, buf.value, NULL, NULL, NULL);
+                assert(code == HT_CODE_SUCCESS);
+            }
+            assert(buf.code == SOKT_CODE_SUCCESS || buf.code == SOKT_CODE_FULL);
+            assert(buf.key == msg.key);
+        }
+        else if (msg.code == SOKT_CODE_TXN)
+        {
+            // Only which keys are in is followed, the values being drawn when the transaction is sent
+            for (int j = 0; buf.code == SOKT_CODE_SUCCESS && j < TXN_CLIENT_KEY_NUM; j++)
+            {
+                code = ht_put(ht, (msg.key - HT_KEY_MIN + j) % KEY_NUM + HT_KEY_MIN, 0, NULL, NULL, NULL);
+                assert(code == HT_CODE_SUCCESS);
+            }
+            assert(buf.code == SOKT_CODE_SUCCESS || buf.code == SOKT_CODE_FULL);
+        }
         else if (msg.code == SOKT_CODE_GET)
         {
             // These are not always true when there are multiple clients
@@ -270,8 +583,6 @@ void *client_routine(void *info)
         }
 
     loop_clean:
-        sokt_active_close(sockfd);
-
         n_req++;
     }
 
@@ -295,4 +606,706 @@ void *client_routine(void *info)
 
 out1:
     return NULL;
-}
\ No newline at end of file
+}
+
+// Draw a key among the inserted ones
+ht_key_t next_key(struct keys *keys, unsigned short state[3])
+{
+    unsigned inserted = atomic_load_explicit(&keys->inserted, memory_order_relaxed);
+    unsigned n = inserted < KEY_NUM ? inserted : KEY_NUM;
+    unsigned i;
+
+    if (n == 0)
+    {
+        return HT_KEY_MIN;
+    }
+
+    switch (keys->distribution)
+    {
+    case DISTRIBUTION_ZIPFIAN:
+        i = zipf_next(keys->zipf, state) % n;
+        break;
+    case DISTRIBUTION_LATEST:
+        i = (inserted - 1 - zipf_next(keys->zipf, state) % n) % KEY_NUM;
+        break;
+    case DISTRIBUTION_HOTSPOT:
+    {
+        unsigned hot = n * HOTSPOT_KEY_PERCENT / 100 > 0 ? n * HOTSPOT_KEY_PERCENT / 100 : 1;
+        if (hot == n || nrand48(state) % 100 < HOTSPOT_OP_PERCENT)
+        {
+            i = nrand48(state) % hot;
+        }
+        else
+        {
+            i = hot + nrand48(state) % (n - hot);
+        }
+        break;
+    }
+    default:
+        i = nrand48(state) % n;
+        break;
+    }
+
+    return i + HT_KEY_MIN;
+}
+
+// Send a message to a server and get the reply in its place, recording the latency if hists is not NULL
+int request(const struct sokt_name_info *name_server, struct sokt_message *msg, int server, struct hist **hists)
+{
+    return request_with(name_server, msg, NULL, 0, server, hists);
+}
+
+// Send a message followed by the PUTs of a transaction, if any, and get the reply in its place
+int request_with(const struct sokt_name_info *name_server, struct sokt_message *msg, const struct sokt_message *puts,
+                 int put_num, int server, struct hist **hists)
+{
+    int rv = -1;
+    enum sokt_message_code code = msg->code;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int sockfd = sokt_active_open(name_server->addr, name_server->port);
+    if (sockfd == -1)
+    {
+        fprintf(stderr, "sokt_active_open failed\n");
+        goto out1;
+    }
+
+    // Send and recv
+    if (sokt_send(sockfd, (char *)msg, sizeof(struct sokt_message)) != 0 ||
+        (put_num > 0 && sokt_send(sockfd, (char *)puts, put_num * sizeof(struct sokt_message)) != 0))
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out2;
+    }
+
+#ifdef LOG
+    printf("to   server %d:\t", server);
+    skot_message_show(msg);
+#endif
+
+    if (sokt_recv(sockfd, (char *)msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_recv failed\n");
+        goto out2;
+    }
+
+#ifdef LOG
+    printf("from server %d:\t", server);
+    skot_message_show(msg);
+#endif
+
+    rv = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (hists)
+    {
+        int latency = latency_of(code, server);
+        if (latency != -1)
+        {
+            hist_record(hists[latency], (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec);
+        }
+    }
+
+out2:
+    sokt_active_close(sockfd);
+
+out1:
+    return rv;
+}
+
+// Pick an operation of the workload and fill in its first request
+enum op draw(const struct workload *workload, struct keys *keys, unsigned short state[3], int servers_num,
+             struct sokt_message *msg, int *server)
+{
+    int p = nrand48(state) % 100;
+    enum op op = 0;
+    while (op < OP_NUM - 1 && p >= workload->percents[op])
+    {
+        p -= workload->percents[op];
+        op++;
+    }
+
+    memset(msg, 0, sizeof(struct sokt_message));
+    msg->key = op == OP_INSERT ? atomic_fetch_add(&keys->inserted, 1) % KEY_NUM + HT_KEY_MIN : next_key(keys, state);
+    switch (op)
+    {
+    case OP_UPDATE:
+    case OP_INSERT:
+        msg->code = SOKT_CODE_PUT;
+        msg->value = nrand48(state) % HT_VALUE_MAX;
+        msg->ttl = PUT_TTL_MS;
+        *server = 0;
+        break;
+    case OP_DEL:
+        msg->code = SOKT_CODE_DEL;
+        msg->value = -1;
+        *server = 0;
+        break;
+    case OP_INCR:
+        msg->code = SOKT_CODE_INCR;
+        msg->value = -1;
+        msg->ttl = PUT_TTL_MS;
+        *server = 0;
+        break;
+    case OP_TXN:
+        msg->code = SOKT_CODE_TXN;
+        msg->value = TXN_CLIENT_KEY_NUM;
+        *server = 0;
+        break;
+    case OP_RMW:
+        msg->code = SOKT_CODE_GET;
+        msg->value = -1;
+        *server = 0;
+        break;
+    default:
+        msg->code = SOKT_CODE_GET;
+        msg->value = -1;
+        *server = nrand48(state) % servers_num;
+        break;
+    }
+
+    return op;
+}
+
+// Send the requests of an operation, msg ends up as the last request and buf as its reply
+int perform(const struct sokt_name_info *name_servers, struct sokt_message *msg, int server, enum op op,
+            unsigned short state[3], struct hist **hists, struct sokt_message *buf)
+{
+    // A transaction puts the following keys, sent after its message
+    if (op == OP_TXN)
+    {
+        struct sokt_message puts[TXN_CLIENT_KEY_NUM] = {0};
+        for (int j = 0; j < TXN_CLIENT_KEY_NUM; j++)
+        {
+            puts[j].key = (msg->key - HT_KEY_MIN + j) % KEY_NUM + HT_KEY_MIN;
+            puts[j].value = nrand48(state) % HT_VALUE_MAX;
+            puts[j].ttl = PUT_TTL_MS;
+        }
+
+        memcpy(buf, msg, sizeof(struct sokt_message));
+        return request_with(name_servers + server, buf, puts, TXN_CLIENT_KEY_NUM, server, hists);
+    }
+
+    // A scan reads the following keys from the same server
+    int scan_num = op == OP_SCAN ? nrand48(state) % YCSB_SCAN_MAX + 1 : 1;
+    for (int j = 0; j < scan_num; j++)
+    {
+        memcpy(buf, msg, sizeof(struct sokt_message));
+        buf->key = (msg->key - HT_KEY_MIN + j) % KEY_NUM + HT_KEY_MIN;
+        if (request(name_servers + server, buf, server, hists) == -1)
+        {
+            return -1;
+        }
+    }
+
+    // The update of a read-modify-write follows its read
+    if (op == OP_RMW)
+    {
+        msg->code = SOKT_CODE_PUT;
+        msg->value = buf->code == SOKT_CODE_SUCCESS ? buf->value + 1 : 0;
+        msg->ttl = PUT_TTL_MS;
+
+        memcpy(buf, msg, sizeof(struct sokt_message));
+        if (request(name_servers + server, buf, server, hists) == -1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Offer load at a given rate whatever the replies, and step it up to the rate when sweeping to see where the
+// servers saturate
+int open_loop(const struct sokt_name_info *name_servers, int servers_num, const struct workload *workload,
+              struct keys *keys, double rate, int steps, char is_poisson, const char *port)
+{
+    int rv = -1;
+    pthread_t tids[OPEN_LOOP_THREAD];
+    struct open_loop_info info[OPEN_LOOP_THREAD];
+    struct hist *hists[OPEN_LOOP_THREAD + 1][LATENCY_NUM] = {0}; // The last ones for all threads
+    struct hist *all = hist_create();
+    FILE *fp = NULL;
+
+    if (!all)
+    {
+        fprintf(stderr, "hist_create failed\n");
+        goto out;
+    }
+
+    for (int i = 0; i < OPEN_LOOP_THREAD + 1; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hists[i][j] = hist_create();
+            if (!hists[i][j])
+            {
+                fprintf(stderr, "hist_create failed\n");
+                goto out;
+            }
+        }
+    }
+
+    if (steps > 1)
+    {
+        char file_name[64];
+        sprintf(file_name, "%s_%s_sweep.csv", "client", port);
+        fp = fopen(file_name, "w");
+        if (!fp)
+        {
+            perror("fopen");
+            goto out;
+        }
+
+        fprintf(fp, "offered (ops/s), achieved (ops/s), late (%%), p50 (us), p90 (us), p99 (us), p99.9 (us), max (us)\n");
+    }
+
+    printf("open loop\t%s arrivals from %d threads, %d ms per step\n\n", is_poisson ? "poisson" : "constant",
+           OPEN_LOOP_THREAD, OPEN_LOOP_MS);
+    printf("%12s %12s %8s %10s %10s %10s %10s %10s\n", "offered/s", "achieved/s", "late_%", "p50_us", "p90_us",
+           "p99_us", "p99.9_us", "max_us");
+
+    double knee = 0;     // Highest offered load fully served
+    char is_slipped = 0; // If a step sent requests late
+    for (int step = 1; step <= steps; step++)
+    {
+        double offered = rate * step / steps;
+
+        for (int i = 0; i < OPEN_LOOP_THREAD + 1; i++)
+        {
+            for (int j = 0; j < LATENCY_NUM; j++)
+            {
+                hist_reset(hists[i][j]);
+            }
+        }
+        hist_reset(all);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        int n = 0;
+        for (; n < OPEN_LOOP_THREAD; n++)
+        {
+            info[n].name_servers = name_servers;
+            info[n].servers_num = servers_num;
+            info[n].index = n;
+            info[n].step = step;
+            info[n].workload = workload;
+            info[n].keys = keys;
+            info[n].gap_ns = 1e9 * OPEN_LOOP_THREAD / offered;
+            info[n].is_poisson = is_poisson;
+            info[n].start = start;
+            info[n].hists = hists[n];
+
+            if (pthread_create(&tids[n], NULL, open_loop_routine, &info[n]) != 0)
+            {
+                perror("pthread_create");
+                break;
+            }
+        }
+
+        long done = 0, late = 0;
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(tids[i], NULL);
+            done += info[i].done;
+            late += info[i].late;
+        }
+
+        if (n < OPEN_LOOP_THREAD)
+        {
+            goto out;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double achieved = done / seconds;
+        double late_percent = done > 0 ? 100.0 * late / done : 0;
+        is_slipped |= late > 0;
+
+        for (int i = 0; i < OPEN_LOOP_THREAD; i++)
+        {
+            for (int j = 0; j < LATENCY_NUM; j++)
+            {
+                hist_merge(hists[OPEN_LOOP_THREAD][j], hists[i][j]);
+                hist_merge(all, hists[i][j]);
+            }
+        }
+
+        double p[] = {hist_percentile(all, 50) / 1000.0, hist_percentile(all, 90) / 1000.0,
+                      hist_percentile(all, 99) / 1000.0, hist_percentile(all, 99.9) / 1000.0, hist_max(all) / 1000.0};
+        printf("%12.0f %12.0f %8.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", offered, achieved, late_percent, p[0], p[1],
+               p[2], p[3], p[4]);
+        if (fp)
+        {
+            fprintf(fp, "%.0f, %.0f, %.1f, %.1f, %.1f, %.1f, %.1f, %.1f\n", offered, achieved, late_percent, p[0], p[1],
+                    p[2], p[3], p[4]);
+        }
+
+        if (achieved * 100 < offered * SATURATION_PERCENT)
+        {
+            break;
+        }
+        knee = offered;
+    }
+
+    if (steps > 1)
+    {
+        if (knee == rate)
+        {
+            printf("\nnot saturated up to %.0f ops/s\n", rate);
+        }
+        else
+        {
+            printf("\nsaturated above %.0f ops/s\n", knee);
+        }
+    }
+
+    // Each thread has one request in flight, so the schedule slips once replies take longer than the gap of a thread
+    if (is_slipped)
+    {
+        printf("\nrequests were sent late with %d in flight at most, latencies still count from their intended "
+               "times\n",
+               OPEN_LOOP_THREAD);
+    }
+
+    // Latencies of the last step
+    if (write_hists(hists[OPEN_LOOP_THREAD], port) == -1)
+    {
+        fprintf(stderr, "write_hists failed\n");
+        goto out;
+    }
+
+    rv = 0;
+
+out:
+    if (fp)
+    {
+        fclose(fp);
+    }
+    for (int i = 0; i < OPEN_LOOP_THREAD + 1; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hist_destroy(hists[i][j]);
+        }
+    }
+    hist_destroy(all);
+
+    return rv;
+}
+
+// Send operations on schedule until OPEN_LOOP_MS is over, a late operation is sent right away and its latency counts
+// from when it should have been sent, so that a slow reply does not hide the ones that would have queued behind it
+void *open_loop_routine(void *info)
+{
+    struct open_loop_info *loop = info;
+    unsigned seed = getpid() * time(NULL);
+    unsigned short state[3] = {seed, seed >> 16, loop->index + OPEN_LOOP_THREAD * loop->step};
+    struct sokt_message msg, buf;
+    int server;
+
+    // Constant arrivals of the threads are spread over the gap
+    double intended = loop->is_poisson ? 0 : loop->gap_ns * loop->index / OPEN_LOOP_THREAD;
+
+    loop->done = 0;
+    loop->late = 0;
+    while (1)
+    {
+        intended += loop->is_poisson ? -log(1 - erand48(state)) * loop->gap_ns : loop->gap_ns;
+        if (intended >= OPEN_LOOP_MS * 1e6)
+        {
+            break;
+        }
+
+        double now = elapsed_ns(&loop->start);
+        if (intended > now)
+        {
+            struct timespec ts = {(intended - now) / 1e9, (long)(intended - now) % 1000000000};
+            nanosleep(&ts, NULL);
+        }
+        else
+        {
+            loop->late++;
+        }
+
+        // Closed loops time each request of a scan or read-modify-write, here the operation is timed as a whole
+        enum op op = draw(loop->workload, loop->keys, state, loop->servers_num, &msg, &server);
+        int latency = op == OP_SCAN ? LATENCY_SCAN : op == OP_RMW ? LATENCY_RMW : latency_of(msg.code, server);
+        if (perform(loop->name_servers, &msg, server, op, state, NULL, &buf) == -1)
+        {
+            continue;
+        }
+
+        if (latency != -1)
+        {
+            hist_record(loop->hists[latency], elapsed_ns(&loop->start) - intended);
+        }
+        loop->done++;
+    }
+
+    return NULL;
+}
+
+// Send captured requests at the times they came, scaled by speed, from threads taking turns
+int replay(const struct sokt_name_info *name_servers, int servers_num, const char *path, double speed,
+           const char *port)
+{
+    int rv = -1;
+    pthread_t tids[OPEN_LOOP_THREAD];
+    struct replay_info info[OPEN_LOOP_THREAD];
+    struct hist *hists[OPEN_LOOP_THREAD + 1][LATENCY_NUM] = {0}; // The last ones for all threads
+    struct hist *all = hist_create();
+    struct capture_request *requests = NULL;
+
+    long n = capture_read(path, &requests);
+    if (n == -1 || !all)
+    {
+        fprintf(stderr, "capture_read or hist_create failed\n");
+        goto out;
+    }
+
+    for (int i = 0; i < OPEN_LOOP_THREAD + 1; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hists[i][j] = hist_create();
+            if (!hists[i][j])
+            {
+                fprintf(stderr, "hist_create failed\n");
+                goto out;
+            }
+        }
+    }
+
+    // Time before the first request is left out
+    uint64_t first = n > 0 ? requests[0].at : 0;
+    for (long i = 0; i < n; i++)
+    {
+        requests[i].at -= first;
+    }
+
+    double captured = n > 0 ? requests[n - 1].at / 1e9 : 0;
+    printf("replay\t\t%ld requests captured over %.3f s from %s, at %.2fx speed from %d threads\n\n", n, captured,
+           path, speed, OPEN_LOOP_THREAD);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int t = 0;
+    for (; t < OPEN_LOOP_THREAD; t++)
+    {
+        info[t].name_servers = name_servers;
+        info[t].servers_num = servers_num;
+        info[t].index = t;
+        info[t].requests = requests;
+        info[t].request_num = n;
+        info[t].speed = speed;
+        info[t].start = start;
+        info[t].hists = hists[t];
+
+        if (pthread_create(&tids[t], NULL, replay_routine, &info[t]) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+    }
+
+    long done = 0;
+    for (int i = 0; i < t; i++)
+    {
+        pthread_join(tids[i], NULL);
+        done += info[i].done;
+    }
+
+    if (t < OPEN_LOOP_THREAD)
+    {
+        goto out;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    for (int i = 0; i < OPEN_LOOP_THREAD; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hist_merge(hists[OPEN_LOOP_THREAD][j], hists[i][j]);
+            hist_merge(all, hists[i][j]);
+        }
+    }
+
+    printf("%12s %12s %10s %10s %10s %10s %10s\n", "offered/s", "achieved/s", "p50_us", "p90_us", "p99_us",
+           "p99.9_us", "max_us");
+    printf("%12.0f %12.0f %10.1f %10.1f %10.1f %10.1f %10.1f\n", captured > 0 ? n * speed / captured : 0,
+           done / seconds, hist_percentile(all, 50) / 1000.0, hist_percentile(all, 90) / 1000.0,
+           hist_percentile(all, 99) / 1000.0, hist_percentile(all, 99.9) / 1000.0, hist_max(all) / 1000.0);
+    printf("\n%ld of %ld requests replayed in %.3f s\n", done, n, seconds);
+
+    if (write_hists(hists[OPEN_LOOP_THREAD], port) == -1)
+    {
+        fprintf(stderr, "write_hists failed\n");
+        goto out;
+    }
+
+    rv = 0;
+
+out:
+    for (int i = 0; i < OPEN_LOOP_THREAD + 1; i++)
+    {
+        for (int j = 0; j < LATENCY_NUM; j++)
+        {
+            hist_destroy(hists[i][j]);
+        }
+    }
+    hist_destroy(all);
+    free(requests);
+
+    return rv;
+}
+
+// Send the requests of the thread on schedule, latencies counting from when they should have been sent as in open
+// loop runs; GETs go to the servers in turn, the others to the primary
+void *replay_routine(void *info)
+{
+    struct replay_info *replay = info;
+    struct sokt_message msg;
+
+    replay->done = 0;
+    for (long i = replay->index; i < replay->request_num; i += OPEN_LOOP_THREAD)
+    {
+        const struct capture_request *r = &replay->requests[i];
+        double intended = r->at / replay->speed;
+
+        double now = elapsed_ns(&replay->start);
+        if (intended > now)
+        {
+            struct timespec ts = {(intended - now) / 1e9, (long)(intended - now) % 1000000000};
+            nanosleep(&ts, NULL);
+        }
+
+        memset(&msg, 0, sizeof(struct sokt_message));
+        msg.code = r->code;
+        msg.key = r->key;
+        msg.value = r->value_size > 0 ? r->value : -1;
+        msg.expected = r->expected;
+        msg.ttl = r->ttl;
+
+        int server = msg.code == SOKT_CODE_GET ? i % replay->servers_num : 0;
+        int latency = latency_of(msg.code, server);
+        if (request(replay->name_servers + server, &msg, server, NULL) == -1)
+        {
+            continue;
+        }
+
+        if (latency != -1)
+        {
+            hist_record(replay->hists[latency], elapsed_ns(&replay->start) - intended);
+        }
+        replay->done++;
+    }
+
+    return NULL;
+}
+
+double elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+// Kind of latency of a request, -1 for none
+int latency_of(enum sokt_message_code code, int server)
+{
+    switch (code)
+    {
+    case SOKT_CODE_GET:
+        return server == 0 ? LATENCY_GET_PRIMARY : LATENCY_GET_BACKUP;
+    case SOKT_CODE_PUT:
+        return LATENCY_PUT;
+    case SOKT_CODE_DEL:
+        return LATENCY_DEL;
+    case SOKT_CODE_INCR:
+        return LATENCY_INCR;
+    case SOKT_CODE_TXN:
+        return LATENCY_TXN;
+    default:
+        return -1;
+    }
+}
+
+// YCSB load phase, PUT the first YCSB_RECORD_NUM keys into the primary
+int load(const struct sokt_name_info *name_server, struct keys *keys)
+{
+    for (int i = 0; i < YCSB_RECORD_NUM; i++)
+    {
+        struct sokt_message msg = {.key = i % KEY_NUM + HT_KEY_MIN, .value = i, .code = SOKT_CODE_PUT};
+        if (request(name_server, &msg, 0, NULL) == -1 || msg.code != SOKT_CODE_SUCCESS)
+        {
+            return -1;
+        }
+    }
+
+    atomic_store(&keys->inserted, YCSB_RECORD_NUM);
+
+    return 0;
+}
+
+// Print the tail latencies and write the full histograms next to the per-thread logs
+int write_hists(struct hist **hists, const char *port)
+{
+    printf("\n%-12s %10s %10s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "mean", "p50", "p90", "p99",
+           "p99.9", "max");
+    for (int i = 0; i < LATENCY_NUM; i++)
+    {
+        if (hist_count(hists[i]) == 0)
+        {
+            continue;
+        }
+
+        printf("%-12s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", latency_names[i], hist_count(hists[i]),
+               hist_mean(hists[i]) / 1000, hist_percentile(hists[i], 50) / 1000.0,
+               hist_percentile(hists[i], 90) / 1000.0, hist_percentile(hists[i], 99) / 1000.0,
+               hist_percentile(hists[i], 99.9) / 1000.0, hist_max(hists[i]) / 1000.0);
+    }
+
+    char file_name[64];
+    sprintf(file_name, "%s_%s_hist.csv", "client", port);
+    FILE *fp = fopen(file_name, "w");
+    if (!fp)
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    fprintf(fp, "op, latency (ns), count, percentile\n");
+    for (int i = 0; i < LATENCY_NUM; i++)
+    {
+        hist_write_csv(hists[i], latency_names[i], fp);
+    }
+
+    fclose(fp);
+
+    sprintf(file_name, "%s_%s_hist.json", "client", port);
+    fp = fopen(file_name, "w");
+    if (!fp)
+    {
+        perror("fopen");
+        return -1;
+    }
+
+    fprintf(fp, "{\"unit\": \"ns\"");
+    for (int i = 0; i < LATENCY_NUM; i++)
+    {
+        fprintf(fp, ",\n\"%s\": ", latency_names[i]);
+        hist_write_json(hists[i], fp);
+    }
+    fprintf(fp, "\n}\n");
+
+    fclose(fp);
+
+    return 0;
+}
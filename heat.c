@@ -0,0 +1,259 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heat.h"
+
+// Workers only take their own mutex, so counting does not serialize them
+struct worker
+{
+    pthread_mutex_t mutex;
+    unsigned long seen;
+    unsigned long *buckets;
+    struct heat_key *keys; // Space-saving summary, unordered
+    unsigned key_num;
+};
+
+struct heat
+{
+    unsigned worker_num;
+    unsigned bucket_num;
+    unsigned capacity;
+    unsigned sample;
+    struct worker *workers;
+};
+
+// A key of the summary of a worker, with the least count of that summary once it is full
+struct entry
+{
+    struct heat_key key;
+    unsigned long floor;
+};
+
+static int compare_key(const void *a, const void *b);
+static int compare_count(const void *a, const void *b);
+
+struct heat *heat_create(unsigned worker_num, unsigned bucket_num, unsigned capacity, unsigned sample)
+{
+    assert(worker_num > 0);
+    assert(bucket_num > 0);
+    assert(capacity > 0);
+    assert(sample > 0);
+
+    struct heat *heat = calloc(1, sizeof(struct heat));
+    if (!heat)
+    {
+        perror("calloc for heat");
+        goto out1;
+    }
+
+    heat->worker_num = worker_num;
+    heat->bucket_num = bucket_num;
+    heat->capacity = capacity;
+    heat->sample = sample;
+
+    heat->workers = calloc(worker_num, sizeof(struct worker));
+    if (!heat->workers)
+    {
+        perror("calloc for workers");
+        goto out2;
+    }
+
+    for (unsigned i = 0; i < worker_num; i++)
+    {
+        struct worker *w = &heat->workers[i];
+
+        pthread_mutex_init(&w->mutex, NULL);
+
+        w->buckets = calloc(bucket_num, sizeof(unsigned long));
+        w->keys = calloc(capacity, sizeof(struct heat_key));
+        if (!w->buckets || !w->keys)
+        {
+            perror("calloc for counts");
+            goto out3;
+        }
+    }
+
+    return heat;
+
+out3:
+    heat_destroy(heat);
+    return NULL;
+out2:
+    free(heat);
+out1:
+    return NULL;
+}
+
+void heat_destroy(struct heat *heat)
+{
+    if (!heat)
+    {
+        return;
+    }
+
+    for (unsigned i = 0; i < heat->worker_num; i++)
+    {
+        struct worker *w = &heat->workers[i];
+
+        free(w->buckets);
+        free(w->keys);
+        pthread_mutex_destroy(&w->mutex);
+    }
+
+    free(heat->workers);
+    free(heat);
+}
+
+void heat_record(struct heat *heat, unsigned worker, unsigned bucket, ht_key_t key)
+{
+    assert(heat);
+    assert(worker < heat->worker_num);
+    assert(bucket < heat->bucket_num);
+
+    struct worker *w = &heat->workers[worker];
+
+    // Only the worker itself touches seen
+    if (w->seen++ % heat->sample != 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&w->mutex);
+
+    w->buckets[bucket]++;
+
+    // A key not in a full summary takes the place of the least counted one, inheriting its count as error
+    struct heat_key *least = NULL;
+    unsigned i = 0;
+    for (; i < w->key_num && w->keys[i].key != key; i++)
+    {
+        if (!least || w->keys[i].count < least->count)
+        {
+            least = &w->keys[i];
+        }
+    }
+
+    if (i < w->key_num)
+    {
+        w->keys[i].count++;
+    }
+    else if (w->key_num < heat->capacity)
+    {
+        w->keys[w->key_num++] = (struct heat_key){key, 1, 0};
+    }
+    else
+    {
+        *least = (struct heat_key){key, least->count + 1, least->count};
+    }
+
+    pthread_mutex_unlock(&w->mutex);
+}
+
+void heat_buckets(struct heat *heat, unsigned long *counts)
+{
+    assert(heat);
+    assert(counts);
+
+    for (unsigned i = 0; i < heat->bucket_num; i++)
+    {
+        counts[i] = 0;
+    }
+
+    for (unsigned i = 0; i < heat->worker_num; i++)
+    {
+        struct worker *w = &heat->workers[i];
+
+        pthread_mutex_lock(&w->mutex);
+        for (unsigned j = 0; j < heat->bucket_num; j++)
+        {
+            counts[j] += w->buckets[j] * heat->sample;
+        }
+        pthread_mutex_unlock(&w->mutex);
+    }
+}
+
+int heat_top(struct heat *heat, struct heat_key *keys, int n)
+{
+    assert(heat);
+    assert(keys);
+
+    struct entry *entries = malloc(heat->worker_num * heat->capacity * sizeof(struct entry));
+    if (!entries)
+    {
+        perror("malloc for entries");
+        return 0;
+    }
+
+    // A key missing from a full summary may have been counted up to its least count there
+    unsigned long base = 0;
+    unsigned m = 0;
+    for (unsigned i = 0; i < heat->worker_num; i++)
+    {
+        struct worker *w = &heat->workers[i];
+
+        pthread_mutex_lock(&w->mutex);
+
+        unsigned long floor = 0;
+        if (w->key_num == heat->capacity)
+        {
+            floor = w->keys[0].count;
+            for (unsigned j = 1; j < w->key_num; j++)
+            {
+                floor = w->keys[j].count < floor ? w->keys[j].count : floor;
+            }
+        }
+
+        for (unsigned j = 0; j < w->key_num; j++)
+        {
+            entries[m++] = (struct entry){w->keys[j], floor};
+        }
+        base += floor;
+
+        pthread_mutex_unlock(&w->mutex);
+    }
+
+    // Merge the summaries key by key
+    qsort(entries, m, sizeof(struct entry), compare_key);
+
+    unsigned merged = 0;
+    for (unsigned i = 0; i < m;)
+    {
+        struct heat_key key = {entries[i].key.key, base, base};
+        // Errors below the floor wrap around, but their sum does not
+        for (; i < m && entries[i].key.key == key.key; i++)
+        {
+            key.count += entries[i].key.count - entries[i].floor;
+            key.error += entries[i].key.error - entries[i].floor;
+        }
+        entries[merged++].key = key;
+    }
+
+    qsort(entries, merged, sizeof(struct entry), compare_count);
+
+    int got = 0;
+    for (; got < n && got < merged; got++)
+    {
+        keys[got].key = entries[got].key.key;
+        keys[got].count = entries[got].key.count * heat->sample;
+        keys[got].error = entries[got].key.error * heat->sample;
+    }
+
+    free(entries);
+
+    return got;
+}
+
+static int compare_key(const void *a, const void *b)
+{
+    ht_key_t x = ((const struct entry *)a)->key.key, y = ((const struct entry *)b)->key.key;
+    return (x > y) - (x < y);
+}
+
+// The most counted first
+static int compare_count(const void *a, const void *b)
+{
+    unsigned long x = ((const struct entry *)a)->key.count, y = ((const struct entry *)b)->key.count;
+    return (x < y) - (x > y);
+}
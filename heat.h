@@ -0,0 +1,72 @@
+/*
+ * Sampled access counts of hashtable buckets and the hottest keys on servers
+ */
+#ifndef HEAT_H_
+#define HEAT_H_
+
+#include "ht.h"
+
+/**
+ * @brief Accesses of all workers, each keeping its own counts and space-saving summary of keys
+ *
+ */
+struct heat;
+
+/**
+ * @brief A key of the summary, accessed between count - error and count times
+ *
+ */
+struct heat_key
+{
+    ht_key_t key;
+    unsigned long count;
+    unsigned long error;
+};
+
+/**
+ * @brief Create access counts
+ *
+ * @param worker_num
+ * @param bucket_num
+ * @param capacity number of keys a worker keeps in its summary
+ * @param sample one access in sample is counted
+ * @return struct heat* NULL for failure
+ */
+struct heat *heat_create(unsigned worker_num, unsigned bucket_num, unsigned capacity, unsigned sample);
+
+/**
+ * @brief Destroy access counts
+ *
+ * @param heat
+ */
+void heat_destroy(struct heat *heat);
+
+/**
+ * @brief Account for an access of a worker to a key
+ *
+ * @param heat
+ * @param worker
+ * @param bucket of the key
+ * @param key
+ */
+void heat_record(struct heat *heat, unsigned worker, unsigned bucket, ht_key_t key);
+
+/**
+ * @brief Get the estimated number of accesses to each bucket
+ *
+ * @param heat
+ * @param counts of size bucket_num
+ */
+void heat_buckets(struct heat *heat, unsigned long *counts);
+
+/**
+ * @brief Get the hottest keys with their estimated numbers of accesses, the hottest first
+ *
+ * @param heat
+ * @param keys
+ * @param n size of keys
+ * @return int number of keys got
+ */
+int heat_top(struct heat *heat, struct heat_key *keys, int n);
+
+#endif
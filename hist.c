@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hist.h"
+
+// Values below 2^SUB_BITS get a bucket each, every power of two above is split into 2^SUB_BITS buckets
+#define SUB_BITS 7
+#define SUB_NUM (1u << SUB_BITS)
+#define BUCKET_NUM ((64 - SUB_BITS + 1) * SUB_NUM)
+
+struct hist
+{
+    uint64_t counts[BUCKET_NUM];
+    uint64_t count;
+    uint64_t max;
+    double sum;
+};
+
+static unsigned bucket_of(uint64_t value);
+static uint64_t bucket_high(unsigned bucket);
+
+struct hist *hist_create(void)
+{
+    struct hist *hist = calloc(1, sizeof(struct hist));
+    if (!hist)
+    {
+        perror("calloc for hist");
+        return NULL;
+    }
+
+    return hist;
+}
+
+void hist_destroy(struct hist *hist)
+{
+    free(hist);
+}
+
+void hist_record(struct hist *hist, uint64_t value)
+{
+    assert(hist);
+
+    hist->counts[bucket_of(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max)
+    {
+        hist->max = value;
+    }
+}
+
+void hist_reset(struct hist *hist)
+{
+    assert(hist);
+
+    memset(hist, 0, sizeof(struct hist));
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    assert(dst);
+    assert(src);
+
+    for (unsigned i = 0; i < BUCKET_NUM; i++)
+    {
+        dst->counts[i] += src->counts[i];
+    }
+
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+    {
+        dst->max = src->max;
+    }
+}
+
+uint64_t hist_count(const struct hist *hist)
+{
+    assert(hist);
+
+    return hist->count;
+}
+
+uint64_t hist_max(const struct hist *hist)
+{
+    assert(hist);
+
+    return hist->max;
+}
+
+double hist_mean(const struct hist *hist)
+{
+    assert(hist);
+
+    return hist->count ? hist->sum / hist->count : 0;
+}
+
+uint64_t hist_percentile(const struct hist *hist, double percent)
+{
+    assert(hist);
+    assert(0 <= percent && percent <= 100);
+
+    if (hist->count == 0)
+    {
+        return 0;
+    }
+
+    // The rank of the value, counting from 1
+    uint64_t rank = (uint64_t)(percent / 100 * hist->count + 0.5);
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKET_NUM; i++)
+    {
+        seen += hist->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t high = bucket_high(i);
+            return high < hist->max ? high : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+void hist_write_csv(const struct hist *hist, const char *name, FILE *fp)
+{
+    assert(hist);
+    assert(name);
+    assert(fp);
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKET_NUM; i++)
+    {
+        if (hist->counts[i] == 0)
+        {
+            continue;
+        }
+
+        seen += hist->counts[i];
+        fprintf(fp, "%s, %lu, %lu, %.6f\n", name, bucket_high(i), hist->counts[i], 100.0 * seen / hist->count);
+    }
+}
+
+void hist_write_json(const struct hist *hist, FILE *fp)
+{
+    assert(hist);
+    assert(fp);
+
+    fprintf(fp, "{\"count\": %lu, \"mean\": %.3f, \"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p99.9\": %lu, \"max\": %lu, "
+                "\"buckets\": [",
+            hist->count, hist_mean(hist), hist_percentile(hist, 50), hist_percentile(hist, 90),
+            hist_percentile(hist, 99), hist_percentile(hist, 99.9), hist->max);
+
+    const char *sep = "";
+    for (unsigned i = 0; i < BUCKET_NUM; i++)
+    {
+        if (hist->counts[i] != 0)
+        {
+            fprintf(fp, "%s[%lu, %lu]", sep, bucket_high(i), hist->counts[i]);
+            sep = ", ";
+        }
+    }
+
+    fprintf(fp, "]}");
+}
+
+static unsigned bucket_of(uint64_t value)
+{
+    if (value < SUB_NUM)
+    {
+        return value;
+    }
+
+    // The top SUB_BITS + 1 bits of the value pick the bucket
+    unsigned e = 63 - __builtin_clzll(value);
+    unsigned shift = e - SUB_BITS;
+
+    return (shift + 1) * SUB_NUM + (unsigned)(value >> shift) - SUB_NUM;
+}
+
+static uint64_t bucket_high(unsigned bucket)
+{
+    if (bucket < SUB_NUM)
+    {
+        return bucket;
+    }
+
+    unsigned shift = bucket / SUB_NUM - 1;
+    uint64_t m = bucket % SUB_NUM + SUB_NUM;
+
+    return ((m + 1) << shift) - 1;
+}
@@ -0,0 +1,104 @@
+/*
+ * Latency histogram with log-linear buckets, in the spirit of HdrHistogram
+ */
+#ifndef HIST_H_
+#define HIST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Histogram of non-negative values, each bucket being within 1% of the values it holds
+ *
+ */
+struct hist;
+
+/**
+ * @brief Create an empty histogram
+ *
+ * @return struct hist* NULL for failure
+ */
+struct hist *hist_create(void);
+
+/**
+ * @brief Destroy a histogram
+ *
+ * @param hist
+ */
+void hist_destroy(struct hist *hist);
+
+/**
+ * @brief Record a value, not thread safe (each thread should have its own histograms to be merged later)
+ *
+ * @param hist
+ * @param value
+ */
+void hist_record(struct hist *hist, uint64_t value);
+
+/**
+ * @brief Forget all the values recorded
+ *
+ * @param hist
+ */
+void hist_reset(struct hist *hist);
+
+/**
+ * @brief Add the values of a histogram to another one
+ *
+ * @param dst
+ * @param src
+ */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/**
+ * @brief Get the number of values recorded
+ *
+ * @param hist
+ * @return uint64_t
+ */
+uint64_t hist_count(const struct hist *hist);
+
+/**
+ * @brief Get the largest value recorded, exactly
+ *
+ * @param hist
+ * @return uint64_t 0 if empty
+ */
+uint64_t hist_max(const struct hist *hist);
+
+/**
+ * @brief Get the mean of the values recorded, exactly
+ *
+ * @param hist
+ * @return double 0 if empty
+ */
+double hist_mean(const struct hist *hist);
+
+/**
+ * @brief Get the value below or at which a percentage of the recorded values are
+ *
+ * @param hist
+ * @param percent in [0, 100]
+ * @return uint64_t the highest value of the bucket holding it, 0 if empty
+ */
+uint64_t hist_percentile(const struct hist *hist, double percent);
+
+/**
+ * @brief Write the non-empty buckets as CSV rows "name, upper bound, count, cumulative percent"
+ *
+ * @param hist
+ * @param name of the histogram, in the first column
+ * @param fp
+ */
+void hist_write_csv(const struct hist *hist, const char *name, FILE *fp);
+
+/**
+ * @brief Write a JSON object with the count, mean, common percentiles and the non-empty buckets as
+ * [upper bound, count] pairs
+ *
+ * @param hist
+ * @param fp
+ */
+void hist_write_json(const struct hist *hist, FILE *fp);
+
+#endif
@@ -1,6 +1,17 @@
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "parameters.h"
 #include "ht.h"
@@ -8,8 +19,20 @@
 struct element
 {
     char unused[CHUNK]; // To test how the size affect the RDMA throughput and latency
-    ht_key_t key;
-    ht_value_t value;
+    union
+    {
+        struct
+        {
+            ht_key_t key;
+            ht_value_t value;
+            int64_t expire; // In ms since the epoch, 0 for never, so that every replica expires the element by itself
+        };
+        struct // For bucket dummy heads, versions telling backups a transaction on the bucket is being replicated
+        {
+            uint32_t begin;
+            uint32_t end;
+        };
+    };
     struct element *next;
     int next_offset; // For backups, in element not byte for pointer arithmetic
 };
@@ -19,14 +42,105 @@ struct ht
     unsigned bucket_num;
     unsigned element_num;
     unsigned element_num_internal; // element_num + hashtable list dummy heads + free list dummy head
+    enum ht_hash hash;
+    unsigned bucket_mask;          // bucket_num - 1 if it is a power of two, 0 otherwise
     struct element *addr;          // start address for the elements
     struct element *free;          // dummy head for free list, which is placed immediately after bucket dummy heads
+    void *map;                     // Start of the snapshot mapping if addr lives in one, NULL if allocated
+    size_t map_len;
+    pthread_mutex_t free_mutex; // Elements of different buckets come from and go to the same free list
+    unsigned char *clock;       // CLOCK bits per element, kept out of the region so that reads are not replicated
+    atomic_uint hand;
+};
+
+#define CLOCK_USED 1       // The element holds a key
+#define CLOCK_REFERENCED 2 // The element was accessed since the hand last passed
+
+#define SNAPSHOT_MAGIC "RKVSNAP"
+#define SNAPSHOT_VERSION 2
+
+// The region follows the header at an offset keeping it at the same place within a page as when saved,
+// so the file can be mapped back at the saved address
+struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bucket_num;
+    uint32_t element_num;
+    uint32_t element_size;
+    uint64_t base;          // Address of the region when saved
+    uint64_t region_offset; // In byte from the start of the file
+    uint64_t region_size;
+    uint32_t has_free_list; // Backups do not maintain the free list
+    uint32_t hash;          // Chains hold the keys hashed to them
+};
+
+#define MULTIPLY_SHIFT_A 0x9e3779b97f4a7c15ull // 2^64 divided by the golden ratio, odd
+#define MIX_SECRET_0 0xa0761d6478bd642full     // wyhash secrets
+#define MIX_SECRET_1 0xe7037ed1a0b428dbull
+
+#define PRELOAD_MAGIC "RKVLOAD"
+#define PRELOAD_FREE_BATCH 64 // Free elements a loader thread takes at a time
+
+// Binary preload file, a header followed by the records, otherwise text with "key,value" lines
+struct preload_header
+{
+    char magic[8];
+    uint64_t record_num;
+};
+
+struct preload_record
+{
+    int32_t key;
+    int32_t value;
+};
+
+// Records found by one thread for the buckets of another
+struct preload_bin
+{
+    struct preload_record *records;
+    long n;
+    long cap;
+};
+
+struct preload_info
+{
+    struct ht *ht;
+    int id;
+    int thread_num;
+    struct preload_info *infos; // Of all threads, in file order
+    pthread_mutex_t *free_mutex;
+    const char *data; // Text between begin and end to be parsed
+    size_t begin;
+    size_t end;
+    const struct preload_record *records; // Binary records to be sorted out
+    long record_num;
+    struct preload_bin *bins; // One per thread
+    int next_bin;             // Where inserting stopped when the free list ran out
+    long next_record;
+    char is_short;
+    int rv;
 };
 
 unsigned hash(const struct ht *ht, ht_key_t key);
+void link_range(const struct ht *ht, const struct element *pre, long *offset, size_t *size);
+enum ht_code lookup(const struct ht *ht, ht_key_t key, ht_value_t *value, int64_t *expire, char is_primary);
+int relocate(struct ht *ht);
+unsigned chain_length(const struct ht *ht, const struct element *head);
+struct element *pop_free(const struct ht *ht);
+void mark_used(struct ht *ht);
+void push_free(const struct ht *ht, struct element *e);
+size_t align_line(const char *data, size_t size, size_t pos);
+void *preload_parse(void *info);
+void *preload_insert(void *info);
+int preload_add(struct preload_info *pi, long key, long value, long at);
+int parse_long(const char **p, const char *end, long *v);
+int write_all(int fd, const void *buf, size_t size, off_t offset);
+void header_of(const struct ht *ht, char is_primary, struct snapshot_header *header);
+int write_snapshot(const struct ht *ht, const struct snapshot_header *header, const char *path, const char *tmp);
 // void *bucket_addr(const struct ht *ht, ht_key_t key);
 
-struct ht *ht_create(int bucket_num, int element_num, void **addr, size_t *size)
+struct ht *ht_create(int bucket_num, int element_num, enum ht_hash hash, void **addr, size_t *size)
 {
     assert(0 < bucket_num && bucket_num <= (int)(HT_KEY_MAX - HT_KEY_MIN));
     assert(0 < element_num);
@@ -41,6 +155,8 @@ struct ht *ht_create(int bucket_num, int element_num, void **addr, size_t *size)
     ht->bucket_num = bucket_num;
     ht->element_num = element_num;
     ht->element_num_internal = ht->element_num + ht->bucket_num + 1;
+    ht->hash = hash;
+    ht->bucket_mask = (bucket_num & (bucket_num - 1)) == 0 ? bucket_num - 1 : 0;
 
     ht->addr = calloc(ht->element_num_internal, sizeof(struct element));
     if (!ht->addr)
@@ -50,11 +166,23 @@ struct ht *ht_create(int bucket_num, int element_num, void **addr, size_t *size)
         return NULL;
     }
 
+    ht->clock = calloc(ht->element_num_internal, sizeof(unsigned char));
+    if (!ht->clock)
+    {
+        perror("calloc for ht->clock");
+        free(ht->addr);
+        free(ht);
+        return NULL;
+    }
+
+    pthread_mutex_init(&ht->free_mutex, NULL);
+
     ht->free = ht->addr + ht->bucket_num;
     struct element *pre = ht->free;
     for (int i = ht->bucket_num + 1; i < ht->element_num_internal; i++)
     {
         pre->next = ht->addr + i;
+        pre->next_offset = i;
         pre = pre->next;
     }
 
@@ -77,12 +205,189 @@ void ht_destroy(struct ht *ht)
         return;
     }
 
-    if (ht->addr)
+    if (ht->map)
+    {
+        munmap(ht->map, ht->map_len);
+    }
+    else if (ht->addr)
     {
         free(ht->addr);
     }
 
+    pthread_mutex_destroy(&ht->free_mutex);
+    free(ht->clock);
+    free(ht);
+}
+
+int ht_save(const struct ht *ht, const char *path, char is_primary)
+{
+    assert(ht);
+    assert(path);
+
+    int rv = -1;
+    struct snapshot_header header;
+    header_of(ht, is_primary, &header);
+
+    // Write aside and rename, so that a crash never leaves a torn snapshot behind
+    char *tmp = malloc(strlen(path) + sizeof(".tmp"));
+    if (!tmp)
+    {
+        perror("malloc for tmp");
+        goto out1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    if (write_snapshot(ht, &header, path, tmp) == -1)
+    {
+        perror("write_snapshot");
+        goto out2;
+    }
+
+    rv = 0;
+
+out2:
+    free(tmp);
+out1:
+    return rv;
+}
+
+pid_t ht_fork_save(const struct ht *ht, const char *path, char is_primary)
+{
+    assert(ht);
+    assert(path);
+
+    // Other threads may hold the malloc or stdio locks at the fork, so the child gets everything ready made
+    struct snapshot_header header;
+    header_of(ht, is_primary, &header);
+
+    char tmp[strlen(path) + sizeof(".tmp")];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    // The child sees the table as it is now, the parent pays for copying the pages it writes meanwhile
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        _exit(write_snapshot(ht, &header, path, tmp) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+struct ht *ht_load(const char *path, int bucket_num, int element_num, enum ht_hash hash, void **addr,
+                   size_t *size)
+{
+    assert(path);
+
+    struct snapshot_header header;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open");
+        goto out1;
+    }
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "cannot read snapshot header of %s\n", path);
+        goto out2;
+    }
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.version != SNAPSHOT_VERSION)
+    {
+        fprintf(stderr, "%s is not a snapshot\n", path);
+        goto out2;
+    }
+
+    // Backups mirror the primary, so the layout must be exactly the configured one
+    if (header.bucket_num != bucket_num || header.element_num != element_num || header.hash != hash ||
+        header.element_size != sizeof(struct element) ||
+        header.region_size != (bucket_num + element_num + 1) * sizeof(struct element) ||
+        header.region_offset + header.region_size > st.st_size)
+    {
+        fprintf(stderr, "snapshot %s does not match the hashtable configuration\n", path);
+        goto out2;
+    }
+
+    struct ht *ht = calloc(1, sizeof(struct ht));
+    if (!ht)
+    {
+        perror("calloc for ht");
+        goto out2;
+    }
+
+    ht->bucket_num = header.bucket_num;
+    ht->element_num = header.element_num;
+    ht->element_num_internal = ht->element_num + ht->bucket_num + 1;
+    ht->hash = header.hash;
+    ht->bucket_mask = (ht->bucket_num & (ht->bucket_num - 1)) == 0 ? ht->bucket_num - 1 : 0;
+
+    // The file is never modified. Registering the region for remote writes copies every page of a private mapping
+    // anyway, so they are all read and copied here, where the load is timed, rather than lazily
+    ht->map_len = header.region_offset + header.region_size;
+    ht->map = mmap((void *)(uintptr_t)(header.base - header.region_offset), ht->map_len,
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (ht->map == MAP_FAILED)
+    {
+        perror("mmap");
+        goto out3;
+    }
+
+    ht->addr = (struct element *)((char *)ht->map + header.region_offset);
+    ht->free = ht->addr + ht->bucket_num;
+
+    ht->clock = calloc(ht->element_num_internal, sizeof(unsigned char));
+    if (!ht->clock)
+    {
+        perror("calloc for ht->clock");
+        goto out4;
+    }
+
+    pthread_mutex_init(&ht->free_mutex, NULL);
+
+    // Pointers are only valid as is if the mapping landed at the saved address
+    if ((uintptr_t)ht->addr != header.base || !header.has_free_list)
+    {
+        if (relocate(ht) == -1)
+        {
+            fprintf(stderr, "snapshot %s is corrupted\n", path);
+            goto out5;
+        }
+    }
+
+    mark_used(ht);
+
+    close(fd);
+
+    if (addr)
+    {
+        *addr = ht->addr;
+    }
+    if (size)
+    {
+        *size = header.region_size;
+    }
+
+    return ht;
+
+out5:
+    pthread_mutex_destroy(&ht->free_mutex);
+    free(ht->clock);
+out4:
+    munmap(ht->map, ht->map_len);
+out3:
     free(ht);
+out2:
+    close(fd);
+out1:
+    return NULL;
 }
 
 void ht_show(struct ht *ht)
@@ -134,23 +439,165 @@ void ht_show(struct ht *ht)
     }
 }
 
-// Not implemented
-void ht_preload(struct ht *ht)
+long ht_preload(struct ht *ht, const char *path, int thread_num)
 {
     assert(ht);
-    /*
-        for (int i = 0; i < ht->capacity; i++)
+    assert(path);
+    assert(thread_num > 0);
+
+    long n = -1;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open");
+        goto out1;
+    }
+
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat");
+        goto out2;
+    }
+
+    if (st.st_size == 0)
+    {
+        n = 0;
+        goto out2;
+    }
+
+    const char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        goto out2;
+    }
+
+    // Each thread owns the buckets equal to its id modulo the number of threads, so no locking is needed
+    if (thread_num > ht->bucket_num)
+    {
+        thread_num = ht->bucket_num;
+    }
+
+    struct preload_info *infos = calloc(thread_num, sizeof(struct preload_info));
+    struct preload_bin *bins = calloc(thread_num * thread_num, sizeof(struct preload_bin));
+    pthread_t *tids = calloc(thread_num, sizeof(pthread_t));
+    if (!infos || !bins || !tids)
+    {
+        perror("calloc for preload");
+        goto out3;
+    }
+
+    char is_binary = st.st_size >= sizeof(struct preload_header) &&
+                     memcmp(data, PRELOAD_MAGIC, sizeof(((struct preload_header *)0)->magic)) == 0;
+
+    if (is_binary)
+    {
+        const struct preload_header *header = (const struct preload_header *)data;
+        if (header->record_num > (st.st_size - sizeof(struct preload_header)) / sizeof(struct preload_record))
+        {
+            fprintf(stderr, "%s is truncated\n", path);
+            goto out3;
+        }
+    }
+
+    for (int i = 0; i < thread_num; i++)
+    {
+        infos[i].ht = ht;
+        infos[i].id = i;
+        infos[i].thread_num = thread_num;
+        infos[i].infos = infos;
+        infos[i].free_mutex = &ht->free_mutex;
+        infos[i].bins = bins + thread_num * i;
+        infos[i].data = data;
+
+        if (is_binary)
+        {
+            long record_num = ((const struct preload_header *)data)->record_num;
+            const struct preload_record *records = (const struct preload_record *)(data + sizeof(struct preload_header));
+
+            infos[i].records = records + record_num * i / thread_num;
+            infos[i].record_num = record_num * (i + 1) / thread_num - record_num * i / thread_num;
+        }
+        else
+        {
+            // Text is split at line boundaries
+            infos[i].begin = align_line(data, st.st_size, st.st_size * i / thread_num);
+            infos[i].end = align_line(data, st.st_size, st.st_size * (i + 1) / thread_num);
+        }
+    }
+
+    // Sort records out by the thread owning their bucket, then insert them in file order so that the last
+    // record for a key wins
+    for (int phase = 0; phase < 2; phase++)
+    {
+        int created = 0;
+        for (; created < thread_num; created++)
+        {
+            if (pthread_create(&tids[created], NULL, phase == 0 ? preload_parse : preload_insert, &infos[created]) != 0)
+            {
+                perror("pthread_create");
+                break;
+            }
+        }
+
+        char is_failed = created < thread_num;
+        for (int i = 0; i < created; i++)
+        {
+            pthread_join(tids[i], NULL);
+            is_failed |= infos[i].rv == -1;
+        }
+
+        // Every cache is back in the free list now, so running short again means the hashtable is full
+        for (int i = 0; phase == 1 && !is_failed && i < thread_num; i++)
         {
-            ht_key_t key = i + HT_KEY_MIN;
-            struct element *addr = bucket_addr(ht, key);
+            if (infos[i].is_short)
+            {
+                preload_insert(&infos[i]);
+                if (infos[i].is_short)
+                {
+                    fprintf(stderr, "hashtable full\n");
+                    is_failed = 1;
+                }
+            }
+        }
 
-            addr->occupied = 1;
-            addr->key = key;
-            addr->value = key;
-        }*/
+        if (is_failed)
+        {
+            goto out4;
+        }
+    }
+
+    n = 0;
+    for (int i = 0; i < thread_num * thread_num; i++)
+    {
+        n += bins[i].n;
+    }
+
+out4:
+    for (int i = 0; i < thread_num * thread_num; i++)
+    {
+        free(bins[i].records);
+    }
+out3:
+    free(tids);
+    free(bins);
+    free(infos);
+    munmap((void *)data, st.st_size);
+out2:
+    close(fd);
+out1:
+    return n;
 }
 
 enum ht_code ht_put(const struct ht *ht, ht_key_t key, ht_value_t value, char *is_update, long *offsets, size_t *sizes)
+{
+    return ht_put_expire(ht, key, value, 0, is_update, offsets, sizes);
+}
+
+enum ht_code ht_put_expire(const struct ht *ht, ht_key_t key, ht_value_t value, int64_t expire, char *is_update,
+                           long *offsets, size_t *sizes)
 {
     assert(ht);
     assert(HT_KEY_MIN <= key && key <= HT_KEY_MAX);
@@ -164,6 +611,8 @@ enum ht_code ht_put(const struct ht *ht, ht_key_t key, ht_value_t value, char *i
         if (e->key == key) // Update
         {
             e->value = value;
+            e->expire = expire;
+            ht->clock[e - ht->addr] |= CLOCK_REFERENCED;
 
             // update offset and size
             if (is_update)
@@ -187,18 +636,19 @@ enum ht_code ht_put(const struct ht *ht, ht_key_t key, ht_value_t value, char *i
     }
 
     // Put
-    e = ht->free->next;
+    e = pop_free(ht);
     if (!e)
     {
         return HT_CODE_FULL;
     }
 
-    ht->free->next = e->next;
     pre->next = e;
     pre->next_offset = e - ht->addr;
     e->next = NULL;
     e->key = key;
     e->value = value;
+    e->expire = expire;
+    ht->clock[e - ht->addr] = CLOCK_USED | CLOCK_REFERENCED;
 
     // update offsets and sizes
     if (is_update)
@@ -208,33 +658,128 @@ enum ht_code ht_put(const struct ht *ht, ht_key_t key, ht_value_t value, char *i
     if (offsets)
     {
         offsets[0] = (e - ht->addr) * sizeof(struct element);
-        offsets[1] = (pre - ht->addr) * sizeof(struct element);
     }
     if (sizes)
     {
         sizes[0] = sizeof(struct element);
-        sizes[1] = sizeof(struct element);
     }
+    link_range(ht, pre, offsets ? offsets + 1 : NULL, sizes ? sizes + 1 : NULL);
 
     return HT_CODE_SUCCESS;
 }
 
-// Not implemented
-enum ht_code ht_del(const struct ht *ht, ht_key_t key, ht_value_t value, long *offset, size_t *size)
+enum ht_code ht_del(const struct ht *ht, ht_key_t key, long *offset, size_t *size)
 {
     assert(ht);
     assert(HT_KEY_MIN <= key && key <= HT_KEY_MAX);
-    assert(0);
 
-    return HT_CODE_ERROR;
+    struct element *pre = ht->addr + hash(ht, key);
+    struct element *e = pre->next;
+
+    while (e)
+    {
+        if (e->key == key)
+        {
+            // Only the predecessor changes for backups, which never reach the element again
+            pre->next = e->next;
+            pre->next_offset = e->next_offset;
+            ht->clock[e - ht->addr] = 0;
+
+            push_free(ht, e);
+
+            link_range(ht, pre, offset, size);
+
+            return HT_CODE_SUCCESS;
+        }
+
+        pre = e;
+        e = e->next;
+    }
+
+    return HT_CODE_NOT_FOUND;
 }
 
 enum ht_code ht_get(const struct ht *ht, ht_key_t key, ht_value_t *value, char is_primary)
+{
+    return ht_get_expire(ht, key, value, NULL, is_primary);
+}
+
+enum ht_code ht_get_expire(const struct ht *ht, ht_key_t key, ht_value_t *value, int64_t *expire, char is_primary)
+{
+    assert(ht);
+    assert(HT_KEY_MIN <= key && key <= HT_KEY_MAX);
+    assert(value);
+
+    if (is_primary)
+    {
+        return lookup(ht, key, value, expire, is_primary);
+    }
+
+    // Backups get the begin version of a transaction first and its end version last, like a seqlock, and give up
+    // on a bucket whose transaction never completes, as when the primary fails in the middle of one
+    volatile struct element *head = ht->addr + hash(ht, key);
+    for (int retry = 0; retry < TXN_READ_RETRY_MAX; retry++)
+    {
+        uint32_t end = head->end;
+        atomic_thread_fence(memory_order_acquire);
+
+        if (head->begin == end)
+        {
+            enum ht_code code = lookup(ht, key, value, expire, is_primary);
+
+            atomic_thread_fence(memory_order_acquire);
+            if (head->begin == end)
+            {
+                return code;
+            }
+        }
+
+        sched_yield();
+    }
+
+    return HT_CODE_ERROR;
+}
+
+enum ht_code ht_find(const struct ht *ht, ht_key_t key, ht_value_t *value, int64_t *expire)
 {
     assert(ht);
     assert(HT_KEY_MIN <= key && key <= HT_KEY_MAX);
     assert(value);
+    assert(expire);
+
+    for (struct element *e = ht->addr[hash(ht, key)].next; e; e = e->next)
+    {
+        if (e->key == key)
+        {
+            *value = e->value;
+            *expire = e->expire;
+            return HT_CODE_SUCCESS;
+        }
+    }
 
+    return HT_CODE_NOT_FOUND;
+}
+
+void ht_version(const struct ht *ht, unsigned bucket, long *offsets, size_t *sizes)
+{
+    assert(ht);
+    assert(bucket < ht->bucket_num);
+    assert(offsets);
+    assert(sizes);
+
+    // Both are bumped at once here, the order comes from the order of the writes to backups
+    struct element *head = ht->addr + bucket;
+    head->begin++;
+    head->end = head->begin;
+
+    offsets[0] = (char *)&head->begin - (char *)ht->addr;
+    offsets[1] = (char *)&head->end - (char *)ht->addr;
+    sizes[0] = sizeof(head->begin);
+    sizes[1] = sizeof(head->end);
+}
+
+enum ht_code lookup(const struct ht *ht, ht_key_t key, ht_value_t *value, int64_t *expire, char is_primary)
+{
     struct element *e = ht->addr + hash(ht, key);
     if (!is_primary && e->next)
     {
@@ -246,7 +791,24 @@ enum ht_code ht_get(const struct ht *ht, ht_key_t key, ht_value_t *value, char i
     {
         if (e->key == key)
         {
+            // Expired elements stay until deleted, but are not found anymore
+            if (e->expire && e->expire <= ht_time_ms())
+            {
+                return HT_CODE_NOT_FOUND;
+            }
+
             *value = e->value;
+            if (expire)
+            {
+                *expire = e->expire;
+            }
+
+            // Avoid dirtying the cache line when the bit is already set
+            if (!(ht->clock[e - ht->addr] & CLOCK_REFERENCED))
+            {
+                ht->clock[e - ht->addr] |= CLOCK_REFERENCED;
+            }
+
             return HT_CODE_SUCCESS;
         }
 
@@ -260,10 +822,570 @@ enum ht_code ht_get(const struct ht *ht, ht_key_t key, ht_value_t *value, char i
     return HT_CODE_NOT_FOUND;
 }
 
+// Dummy heads only have their link replicated, so that their versions are left to ht_version()
+void link_range(const struct ht *ht, const struct element *pre, long *offset, size_t *size)
+{
+    size_t skip = pre < ht->addr + ht->bucket_num ? offsetof(struct element, next) : 0;
+
+    if (offset)
+    {
+        *offset = (pre - ht->addr) * sizeof(struct element) + skip;
+    }
+    if (size)
+    {
+        *size = sizeof(struct element) - skip;
+    }
+}
+
+unsigned ht_bucket(const struct ht *ht, ht_key_t key)
+{
+    return hash(ht, key);
+}
+
+unsigned ht_bucket_num(const struct ht *ht)
+{
+    return ht->bucket_num;
+}
+
+void ht_stats(const struct ht *ht, unsigned *used, unsigned *free_num, unsigned *max_chain)
+{
+    assert(ht);
+
+    unsigned n = 0, longest = 0;
+
+    for (int i = 0; i < ht->bucket_num; i++)
+    {
+        unsigned chain = chain_length(ht, ht->addr + i);
+
+        n += chain;
+        if (chain > longest)
+        {
+            longest = chain;
+        }
+    }
+
+    if (used)
+    {
+        *used = n;
+    }
+    if (max_chain)
+    {
+        *max_chain = longest;
+    }
+    if (free_num)
+    {
+        pthread_mutex_lock((pthread_mutex_t *)&ht->free_mutex);
+        n = chain_length(ht, ht->free);
+        pthread_mutex_unlock((pthread_mutex_t *)&ht->free_mutex);
+
+        *free_num = n;
+    }
+}
+
+void ht_chain_lengths(const struct ht *ht, unsigned *counts, unsigned n)
+{
+    assert(ht);
+    assert(counts);
+    assert(n > 0);
+
+    memset(counts, 0, n * sizeof(unsigned));
+
+    for (int i = 0; i < ht->bucket_num; i++)
+    {
+        unsigned chain = chain_length(ht, ht->addr + i);
+
+        counts[chain < n ? chain : n - 1]++;
+    }
+}
+
+void ht_bucket_lengths(const struct ht *ht, unsigned *lengths)
+{
+    assert(ht);
+    assert(lengths);
+
+    for (int i = 0; i < ht->bucket_num; i++)
+    {
+        lengths[i] = chain_length(ht, ht->addr + i);
+    }
+}
+
+int ht_expired(const struct ht *ht, unsigned bucket, int64_t now, ht_key_t *key)
+{
+    assert(ht);
+    assert(bucket < ht->bucket_num);
+    assert(key);
+
+    for (struct element *e = ht->addr[bucket].next; e; e = e->next)
+    {
+        if (e->expire && e->expire <= now)
+        {
+            *key = e->key;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int64_t ht_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int ht_evict_candidate(const struct ht *ht, ht_key_t *key)
+{
+    assert(ht);
+    assert(key);
+
+    unsigned first = ht->bucket_num + 1, n = ht->element_num;
+
+    // Two rounds are enough to come back to an element whose bit was cleared in the first one
+    for (unsigned i = 0; i < 2 * n; i++)
+    {
+        unsigned index = first + atomic_fetch_add_explicit((atomic_uint *)&ht->hand, 1, memory_order_relaxed) % n;
+        unsigned char bits = ht->clock[index];
+
+        if (!(bits & CLOCK_USED))
+        {
+            continue;
+        }
+
+        if (bits & CLOCK_REFERENCED)
+        {
+            ht->clock[index] = bits & ~CLOCK_REFERENCED;
+            continue;
+        }
+
+        *key = ht->addr[index].key;
+        return 0;
+    }
+
+    return -1;
+}
+
 unsigned hash(const struct ht *ht, ht_key_t key)
 {
     assert(ht);
     assert(HT_KEY_MIN <= key && key <= HT_KEY_MAX);
 
-    return key % ht->bucket_num;
-}
\ No newline at end of file
+    uint64_t h;
+    __uint128_t product;
+
+    // Scaling a 32-bit hash by the bucket number with a multiply keeps its high bits, which are the good ones of
+    // multiply-shift
+    switch (ht->hash)
+    {
+    case HT_HASH_MULTIPLY_SHIFT:
+        h = (key * MULTIPLY_SHIFT_A) >> 32;
+        return h * ht->bucket_num >> 32;
+    case HT_HASH_MIX:
+        product = (__uint128_t)(key ^ MIX_SECRET_0) * MIX_SECRET_1;
+        h = (uint64_t)product ^ (uint64_t)(product >> 64);
+        return ht->bucket_mask ? h & ht->bucket_mask : (h & UINT32_MAX) * ht->bucket_num >> 32;
+    default:
+        return key % ht->bucket_num;
+    }
+}
+
+// Elements are followed by offset, as next holds addresses of the primary on backups, and a walk racing with writers
+// is cut after element_num_internal steps so that it ends without taking locks
+unsigned chain_length(const struct ht *ht, const struct element *head)
+{
+    unsigned n = 0;
+
+    for (const volatile struct element *e = head; e->next && n < ht->element_num_internal;
+         e = ht->addr + e->next_offset)
+    {
+        n++;
+    }
+
+    return n;
+}
+
+struct element *pop_free(const struct ht *ht)
+{
+    pthread_mutex_lock((pthread_mutex_t *)&ht->free_mutex);
+
+    struct element *e = ht->free->next;
+    if (e)
+    {
+        ht->free->next = e->next;
+        ht->free->next_offset = e->next_offset;
+    }
+
+    pthread_mutex_unlock((pthread_mutex_t *)&ht->free_mutex);
+
+    return e;
+}
+
+void push_free(const struct ht *ht, struct element *e)
+{
+    pthread_mutex_lock((pthread_mutex_t *)&ht->free_mutex);
+
+    e->next = ht->free->next;
+    e->next_offset = ht->free->next_offset;
+    ht->free->next = e;
+    ht->free->next_offset = e - ht->addr;
+
+    pthread_mutex_unlock((pthread_mutex_t *)&ht->free_mutex);
+}
+
+// Set the CLOCK bits of the elements reachable from the buckets
+void mark_used(struct ht *ht)
+{
+    for (int i = 0; i < ht->bucket_num; i++)
+    {
+        for (struct element *e = ht->addr[i].next; e; e = e->next)
+        {
+            ht->clock[e - ht->addr] = CLOCK_USED;
+        }
+    }
+}
+
+// Rebuild the next pointers from the offsets, and the free list from the elements no bucket reaches
+int relocate(struct ht *ht)
+{
+    assert(ht);
+
+    char *is_used = calloc(ht->element_num_internal, sizeof(char));
+    if (!is_used)
+    {
+        perror("calloc for is_used");
+        return -1;
+    }
+
+    for (int i = 0; i <= ht->bucket_num; i++)
+    {
+        is_used[i] = 1;
+    }
+
+    for (int i = 0; i < ht->bucket_num; i++)
+    {
+        struct element *e = ht->addr + i;
+        while (e->next)
+        {
+            int offset = e->next_offset;
+            if (offset <= ht->bucket_num || offset >= ht->element_num_internal || is_used[offset])
+            {
+                free(is_used);
+                return -1;
+            }
+
+            is_used[offset] = 1;
+            e->next = ht->addr + offset;
+            e = e->next;
+        }
+    }
+
+    struct element *pre = ht->free;
+    for (int i = ht->bucket_num + 1; i < ht->element_num_internal; i++)
+    {
+        if (!is_used[i])
+        {
+            pre->next = ht->addr + i;
+            pre->next_offset = i;
+            pre = pre->next;
+        }
+    }
+    pre->next = NULL;
+
+    free(is_used);
+
+    return 0;
+}
+
+void header_of(const struct ht *ht, char is_primary, struct snapshot_header *header)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t base = (uintptr_t)ht->addr;
+
+    *header = (struct snapshot_header){
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .bucket_num = ht->bucket_num,
+        .element_num = ht->element_num,
+        .element_size = sizeof(struct element),
+        .base = base,
+        .region_offset = page + base % page,
+        .region_size = ht->element_num_internal * sizeof(struct element),
+        .has_free_list = is_primary ? 1 : 0,
+        .hash = ht->hash,
+    };
+}
+
+// Only async-signal-safe calls and nothing printed, as a forked child runs it too, errno tells what failed
+int write_snapshot(const struct ht *ht, const struct snapshot_header *header, const char *path, const char *tmp)
+{
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (write_all(fd, header, sizeof(*header), 0) == -1 ||
+        write_all(fd, ht->addr, header->region_size, header->region_offset) == -1 || fsync(fd) == -1 ||
+        rename(tmp, path) == -1)
+    {
+        int saved = errno;
+        close(fd);
+        unlink(tmp);
+        errno = saved;
+        return -1;
+    }
+
+    close(fd);
+
+    return 0;
+}
+
+// Nothing printed, errno tells what failed
+int write_all(int fd, const void *buf, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n == -1)
+        {
+            return -1;
+        }
+
+        buf = (const char *)buf + n;
+        size -= n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+// Move a position to the start of the line it is in, or to the end of data
+size_t align_line(const char *data, size_t size, size_t pos)
+{
+    while (pos > 0 && pos < size && data[pos - 1] != '\n')
+    {
+        pos++;
+    }
+
+    return pos;
+}
+
+void *preload_parse(void *info)
+{
+    struct preload_info *pi = info;
+
+    if (pi->records)
+    {
+        for (long i = 0; i < pi->record_num; i++)
+        {
+            long at = (const char *)&pi->records[i] - pi->data;
+            if (preload_add(pi, pi->records[i].key, pi->records[i].value, at) == -1)
+            {
+                pi->rv = -1;
+                return NULL;
+            }
+        }
+
+        return NULL;
+    }
+
+    const char *p = pi->data + pi->begin, *end = pi->data + pi->end;
+
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        {
+            p++;
+        }
+
+        // Blank lines and comments
+        if (p == end || *p == '\n' || *p == '#')
+        {
+            const char *eol = memchr(p, '\n', end - p);
+            p = eol ? eol + 1 : end;
+            continue;
+        }
+
+        long key, value;
+        const char *start = p;
+        if (parse_long(&p, end, &key) == -1 || p == end || *p++ != ',' || parse_long(&p, end, &value) == -1)
+        {
+            goto malformed;
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        {
+            p++;
+        }
+        if (p < end && *p++ != '\n')
+        {
+            goto malformed;
+        }
+
+        if (preload_add(pi, key, value, start - pi->data) == -1)
+        {
+            pi->rv = -1;
+            return NULL;
+        }
+        continue;
+
+    malformed:
+        fprintf(stderr, "malformed record at byte %ld\n", (long)(start - pi->data));
+        pi->rv = -1;
+        return NULL;
+    }
+
+    return NULL;
+}
+
+int preload_add(struct preload_info *pi, long key, long value, long at)
+{
+    if (key < HT_KEY_MIN || key > HT_KEY_MAX || value < HT_VALUE_MIN || value > HT_VALUE_MAX)
+    {
+        fprintf(stderr, "record out of range at byte %ld\n", at);
+        return -1;
+    }
+
+    struct preload_bin *bin = &pi->bins[hash(pi->ht, key) % pi->thread_num];
+    if (bin->n == bin->cap)
+    {
+        long cap = bin->cap ? bin->cap * 2 : 1024;
+        struct preload_record *records = realloc(bin->records, cap * sizeof(struct preload_record));
+        if (!records)
+        {
+            perror("realloc for records");
+            return -1;
+        }
+
+        bin->records = records;
+        bin->cap = cap;
+    }
+
+    bin->records[bin->n].key = key;
+    bin->records[bin->n].value = value;
+    bin->n++;
+
+    return 0;
+}
+
+void *preload_insert(void *info)
+{
+    struct preload_info *pi = info;
+    struct ht *ht = pi->ht;
+    struct element *cache = NULL; // Free elements taken by this thread
+
+    pi->is_short = 0;
+    for (; pi->next_bin < pi->thread_num; pi->next_bin++, pi->next_record = 0)
+    {
+        const struct preload_bin *bin = &pi->infos[pi->next_bin].bins[pi->id];
+
+        for (; pi->next_record < bin->n; pi->next_record++)
+        {
+            ht_key_t key = bin->records[pi->next_record].key;
+            ht_value_t value = bin->records[pi->next_record].value;
+
+            struct element *pre = ht->addr + hash(ht, key);
+            struct element *e = pre->next;
+            while (e && e->key != key)
+            {
+                pre = e;
+                e = e->next;
+            }
+
+            if (e)
+            {
+                e->value = value;
+                continue;
+            }
+
+            if (!cache)
+            {
+                pthread_mutex_lock(pi->free_mutex);
+                cache = ht->free->next;
+                e = cache;
+                for (int k = 1; e && k < PRELOAD_FREE_BATCH; k++)
+                {
+                    e = e->next;
+                }
+                if (e)
+                {
+                    ht->free->next = e->next;
+                    ht->free->next_offset = e->next_offset;
+                    e->next = NULL;
+                }
+                else
+                {
+                    ht->free->next = NULL;
+                }
+                pthread_mutex_unlock(pi->free_mutex);
+
+                // Other threads may still hold free elements, the caller goes on from here once they gave them back
+                if (!cache)
+                {
+                    pi->is_short = 1;
+                    goto out;
+                }
+            }
+
+            e = cache;
+            cache = cache->next;
+
+            pre->next = e;
+            pre->next_offset = e - ht->addr;
+            e->next = NULL;
+            e->key = key;
+            e->value = value;
+            e->expire = 0;
+            ht->clock[e - ht->addr] = CLOCK_USED;
+        }
+    }
+
+out:
+    // Give back what is left
+    if (cache)
+    {
+        struct element *last = cache;
+        while (last->next)
+        {
+            last = last->next;
+        }
+
+        pthread_mutex_lock(pi->free_mutex);
+        last->next = ht->free->next;
+        last->next_offset = ht->free->next_offset;
+        ht->free->next = cache;
+        ht->free->next_offset = cache - ht->addr;
+        pthread_mutex_unlock(pi->free_mutex);
+    }
+
+    return NULL;
+}
+
+int parse_long(const char **p, const char *end, long *v)
+{
+    const char *q = *p;
+    char is_negative = 0;
+    long x = 0;
+
+    if (q < end && (*q == '-' || *q == '+'))
+    {
+        is_negative = *q++ == '-';
+    }
+
+    const char *digits = q;
+    while (q < end && '0' <= *q && *q <= '9' && x <= (long)HT_VALUE_MAX + 1)
+    {
+        x = x * 10 + (*q++ - '0');
+    }
+
+    if (q == digits)
+    {
+        return -1;
+    }
+
+    *v = is_negative ? -x : x;
+    *p = q;
+
+    return 0;
+}
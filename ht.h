@@ -6,6 +6,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 /**
  * @brief Hashtable
@@ -49,16 +50,29 @@ typedef int32_t ht_value_t;
  */
 #define HT_VALUE_MAX INT32_MAX
 
+/**
+ * @brief Hashes of keys to buckets
+ *
+ */
+enum ht_hash
+{
+    HT_HASH_MODULO,         // key % bucket_num, a division per lookup, clustering keys strided by the bucket number
+    HT_HASH_MULTIPLY_SHIFT, // High bits of key times an odd constant, scaled to the buckets with a multiply
+    HT_HASH_MIX             // Both halves of a 128-bit product folded as wyhash does, masked to the buckets when
+                            // their number is a power of two
+};
+
 /**
  * @brief Create a hashtable
  *
  * @param bucket_num the number of buckets
  * @param element_num the number of elements the hashtable can hold
+ * @param hash of keys to buckets, must be the same on all servers
  * @param addr the starting address of the hashtable in memory, can be NULL
  * @param size the memory space taken by the hashtable, can be NULL
  * @return struct ht*
  */
-struct ht *ht_create(int bucket_num, int element_num, void **addr, size_t *size);
+struct ht *ht_create(int bucket_num, int element_num, enum ht_hash hash, void **addr, size_t *size);
 
 /**
  * @brief Destroy a hashtable
@@ -67,6 +81,43 @@ struct ht *ht_create(int bucket_num, int element_num, void **addr, size_t *size)
  */
 void ht_destroy(struct ht *ht);
 
+/**
+ * @brief Save the hashtable region to a snapshot file, the caller should keep it from changing meanwhile
+ *
+ * @param ht
+ * @param path replaced atomically
+ * @param is_primary if the free list is maintained, otherwise it is rebuilt when loading
+ * @return int -1 for failure
+ */
+int ht_save(const struct ht *ht, const char *path, char is_primary);
+
+/**
+ * @brief Save the hashtable region to a snapshot file from a forked child, so that the caller only needs
+ * to keep it from changing during the fork
+ *
+ * @param ht
+ * @param path replaced atomically
+ * @param is_primary if the free list is maintained, otherwise it is rebuilt when loading
+ * @return pid_t the child to wait for, which exits with EXIT_SUCCESS once the snapshot is saved, -1 for failure
+ */
+pid_t ht_fork_save(const struct ht *ht, const char *path, char is_primary);
+
+/**
+ * @brief Create a hashtable by mapping a snapshot file, at the saved address when possible so that no
+ * pointer needs fixing up; every page of the region is copied in and every chain walked, so it takes time
+ * linear in the region size, not in the number of keys
+ *
+ * @param path
+ * @param bucket_num must match the snapshot
+ * @param element_num must match the snapshot
+ * @param hash must match the snapshot
+ * @param addr the starting address of the hashtable in memory, can be NULL
+ * @param size the memory space taken by the hashtable, can be NULL
+ * @return struct ht* NULL for failure
+ */
+struct ht *ht_load(const char *path, int bucket_num, int element_num, enum ht_hash hash, void **addr,
+                   size_t *size);
+
 /**
  * @brief Print out the whole hashtable
  *
@@ -75,11 +126,16 @@ void ht_destroy(struct ht *ht);
 void ht_show(struct ht *ht);
 
 /**
- * @brief Preload some data into the hashtable
+ * @brief Bulk load key-value pairs into the hashtable with several threads, each owning some buckets
+ * (the hashtable must not be in use meanwhile)
  *
  * @param ht
+ * @param path binary file starting with "RKVLOAD\0" and a uint64_t record count, followed by int32_t key and
+ * value pairs, or text file with one "key,value" per line
+ * @param thread_num
+ * @return long number of records loaded, -1 for failure
  */
-void ht_preload(struct ht *ht);
+long ht_preload(struct ht *ht, const char *path, int thread_num);
 
 /**
  * @brief Return code for ht_put(), ht_get() and ht_del()
@@ -107,7 +163,23 @@ enum ht_code
 enum ht_code ht_put(const struct ht *ht, ht_key_t key, ht_value_t value, char *is_update, long *offsets, size_t *sizes);
 
 /**
- * @brief Delete a value for a given key (note that backups do not need to update free list pointers; the size of offset and size are both 1)
+ * @brief Put a value for a given key that expires at some point (see ht_put())
+ *
+ * @param ht
+ * @param key
+ * @param value
+ * @param expire in ms since the epoch as given by ht_time_ms(), 0 for never; replicas compare it with their own clock
+ * @param is_update if the operation is a update or a real put, can be NULL
+ * @param offsets offsets of the starting address in memory, in byte, should be an array of size 2, can be NULL
+ * @param sizes memory affected, should be an array of size 2, can be NULL
+ * @return enum ht_code
+ */
+enum ht_code ht_put_expire(const struct ht *ht, ht_key_t key, ht_value_t value, int64_t expire, char *is_update,
+                           long *offsets, size_t *sizes);
+
+/**
+ * @brief Delete a value for a given key and give its element back to the free list (note that backups do not need to
+ * update free list pointers; the size of offset and size are both 1, for the predecessor unlinking the element)
  *
  * @param ht
  * @param key
@@ -115,7 +187,7 @@ enum ht_code ht_put(const struct ht *ht, ht_key_t key, ht_value_t value, char *i
  * @param size memory affected, can be NULL
  * @return enum ht_code
  */
-enum ht_code ht_del(const struct ht *ht, ht_key_t key, ht_value_t value, long *offset, size_t *size);
+enum ht_code ht_del(const struct ht *ht, ht_key_t key, long *offset, size_t *size);
 
 /**
  * @brief Find the value for a given key
@@ -128,4 +200,112 @@ enum ht_code ht_del(const struct ht *ht, ht_key_t key, ht_value_t value, long *o
  */
 enum ht_code ht_get(const struct ht *ht, ht_key_t key, ht_value_t *value, char is_primary);
 
+/**
+ * @brief Find the value for a given key and when it expires (see ht_get())
+ *
+ * @param ht
+ * @param key
+ * @param value
+ * @param expire as given to ht_put_expire(), can be NULL
+ * @param is_primary
+ * @return enum ht_code HT_CODE_ERROR on backups when the bucket stays in the middle of a transaction
+ */
+enum ht_code ht_get_expire(const struct ht *ht, ht_key_t key, ht_value_t *value, int64_t *expire, char is_primary);
+
+/**
+ * @brief Find the value for a given key and when it expires on primaries, even once expired, so that changes can be
+ * undone exactly (the element is not marked as recently used)
+ *
+ * @param ht
+ * @param key
+ * @param value
+ * @param expire
+ * @return enum ht_code
+ */
+enum ht_code ht_find(const struct ht *ht, ht_key_t key, ht_value_t *value, int64_t *expire);
+
+/**
+ * @brief Start a new version of a bucket for a transaction, offsets[0] must be replicated before the changes of the
+ * transaction and offsets[1] after them, so that GETs on backups wait for the whole transaction
+ *
+ * @param ht
+ * @param bucket locked by the caller until the changes are replicated
+ * @param offsets should be an array of size 2
+ * @param sizes should be an array of size 2
+ */
+void ht_version(const struct ht *ht, unsigned bucket, long *offsets, size_t *sizes);
+
+/**
+ * @brief Get the bucket of a key, operations on keys of the same bucket must be serialized by the caller
+ *
+ * @param ht
+ * @param key
+ * @return unsigned
+ */
+unsigned ht_bucket(const struct ht *ht, ht_key_t key);
+
+/**
+ * @brief Get the number of buckets
+ *
+ * @param ht
+ * @return unsigned
+ */
+unsigned ht_bucket_num(const struct ht *ht);
+
+/**
+ * @brief Find an expired key in a bucket, to be deleted by the caller holding the bucket
+ *
+ * @param ht
+ * @param bucket
+ * @param now as given by ht_time_ms()
+ * @param key
+ * @return int -1 if none
+ */
+int ht_expired(const struct ht *ht, unsigned bucket, int64_t now, ht_key_t *key);
+
+/**
+ * @brief Get the wall clock time used for expiration
+ *
+ * @return int64_t ms since the epoch
+ */
+int64_t ht_time_ms(void);
+
+/**
+ * @brief Pick a key to evict with the CLOCK policy, reads and writes mark elements as recently used
+ * (no lock is needed, but the key may be gone by the time its bucket is locked)
+ *
+ * @param ht
+ * @param key
+ * @return int -1 if no element is in use
+ */
+int ht_evict_candidate(const struct ht *ht, ht_key_t *key);
+
+/**
+ * @brief Count the elements in use and in the free list, and find the longest chain (approximate while writers run,
+ * and the free list is only kept on primaries)
+ *
+ * @param ht
+ * @param used can be NULL
+ * @param free_num can be NULL
+ * @param max_chain can be NULL
+ */
+void ht_stats(const struct ht *ht, unsigned *used, unsigned *free_num, unsigned *max_chain);
+
+/**
+ * @brief Count the buckets of each chain length, on primaries and backups (approximate while writers run)
+ *
+ * @param ht
+ * @param counts counts[i] buckets have i elements, the last one counting longer chains too
+ * @param n size of counts
+ */
+void ht_chain_lengths(const struct ht *ht, unsigned *counts, unsigned n);
+
+/**
+ * @brief Get the chain length of each bucket, on primaries and backups (approximate while writers run)
+ *
+ * @param ht
+ * @param lengths of size bucket_num
+ */
+void ht_bucket_lengths(const struct ht *ht, unsigned *lengths);
+
 #endif
\ No newline at end of file
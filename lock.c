@@ -0,0 +1,295 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lock.h"
+
+#define CACHE_LINE 64
+#define SPIN_LIMIT 1024 // Yield the CPU after spinning this many times, for oversubscribed cores
+
+// Each stripe takes a whole cache line so that neighbouring stripes do not false share
+struct stripe
+{
+    union
+    {
+        pthread_rwlock_t rwlock;
+        struct
+        {
+            atomic_uint next;
+            atomic_uint serving;
+        } ticket;
+    };
+} __attribute__((aligned(CACHE_LINE)));
+
+struct lock_table
+{
+    unsigned stripe_num;
+    unsigned shift; // 64 - log2(stripe_num), for multiplicative hashing
+    enum lock_kind kind;
+    struct stripe *stripes;
+};
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+struct lock_table *lock_create(unsigned stripe_num, enum lock_kind kind)
+{
+    assert(stripe_num > 0 && (stripe_num & (stripe_num - 1)) == 0);
+    assert(kind == LOCK_KIND_RWLOCK || kind == LOCK_KIND_TICKET);
+
+    struct lock_table *table = calloc(1, sizeof(struct lock_table));
+    if (!table)
+    {
+        perror("calloc for table");
+        return NULL;
+    }
+
+    table->stripe_num = stripe_num;
+    table->shift = 64;
+    for (unsigned n = stripe_num; n > 1; n >>= 1)
+    {
+        table->shift--;
+    }
+    table->kind = kind;
+
+    table->stripes = aligned_alloc(CACHE_LINE, stripe_num * sizeof(struct stripe));
+    if (!table->stripes)
+    {
+        perror("aligned_alloc for table->stripes");
+        free(table);
+        return NULL;
+    }
+
+    for (unsigned i = 0; i < stripe_num; i++)
+    {
+        if (kind == LOCK_KIND_RWLOCK)
+        {
+            int rv = pthread_rwlock_init(&table->stripes[i].rwlock, NULL);
+            if (rv != 0)
+            {
+                errno = rv;
+                perror("pthread_rwlock_init");
+                table->stripe_num = i; // Only destroy the initiated ones
+                lock_destroy(table);
+                return NULL;
+            }
+        }
+        else
+        {
+            atomic_init(&table->stripes[i].ticket.next, 0);
+            atomic_init(&table->stripes[i].ticket.serving, 0);
+        }
+    }
+
+    return table;
+}
+
+void lock_destroy(struct lock_table *table)
+{
+    if (!table)
+    {
+        return;
+    }
+
+    if (table->stripes)
+    {
+        if (table->kind == LOCK_KIND_RWLOCK)
+        {
+            for (unsigned i = 0; i < table->stripe_num; i++)
+            {
+                pthread_rwlock_destroy(&table->stripes[i].rwlock);
+            }
+        }
+
+        free(table->stripes);
+    }
+
+    free(table);
+}
+
+unsigned lock_stripe(const struct lock_table *table, uint64_t id)
+{
+    assert(table);
+
+    if (table->shift == 64)
+    {
+        return 0;
+    }
+
+    // Fibonacci hashing, so that consecutive ids land on different stripes
+    return (id * 0x9e3779b97f4a7c15ULL) >> table->shift;
+}
+
+static void ticket_lock(struct stripe *s)
+{
+    unsigned ticket = atomic_fetch_add_explicit(&s->ticket.next, 1, memory_order_relaxed);
+
+    for (int spin = 0; atomic_load_explicit(&s->ticket.serving, memory_order_acquire) != ticket; spin++)
+    {
+        if (spin < SPIN_LIMIT)
+        {
+            cpu_relax();
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+static int ticket_trylock(struct stripe *s)
+{
+    // Only take a ticket when it would be served right away
+    unsigned serving = atomic_load_explicit(&s->ticket.serving, memory_order_acquire);
+    return atomic_compare_exchange_strong_explicit(&s->ticket.next, &serving, serving + 1, memory_order_acquire,
+                                                   memory_order_relaxed)
+               ? 0
+               : -1;
+}
+
+static void ticket_unlock(struct stripe *s)
+{
+    unsigned serving = atomic_load_explicit(&s->ticket.serving, memory_order_relaxed);
+    atomic_store_explicit(&s->ticket.serving, serving + 1, memory_order_release);
+}
+
+static int stripe_wrlock(const struct lock_table *table, struct stripe *s)
+{
+    if (table->kind == LOCK_KIND_TICKET)
+    {
+        ticket_lock(s);
+        return 0;
+    }
+
+    int rv = pthread_rwlock_wrlock(&s->rwlock);
+    if (rv != 0)
+    {
+        errno = rv;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int stripe_unlock(const struct lock_table *table, struct stripe *s)
+{
+    if (table->kind == LOCK_KIND_TICKET)
+    {
+        ticket_unlock(s);
+        return 0;
+    }
+
+    int rv = pthread_rwlock_unlock(&s->rwlock);
+    if (rv != 0)
+    {
+        errno = rv;
+        return -1;
+    }
+
+    return 0;
+}
+
+int lock_rdlock(struct lock_table *table, uint64_t id)
+{
+    struct stripe *s = table->stripes + lock_stripe(table, id);
+
+    if (table->kind == LOCK_KIND_TICKET)
+    {
+        ticket_lock(s);
+        return 0;
+    }
+
+    int rv = pthread_rwlock_rdlock(&s->rwlock);
+    if (rv != 0)
+    {
+        errno = rv;
+        return -1;
+    }
+
+    return 0;
+}
+
+int lock_wrlock(struct lock_table *table, uint64_t id)
+{
+    return stripe_wrlock(table, table->stripes + lock_stripe(table, id));
+}
+
+int lock_trywrlock(struct lock_table *table, uint64_t id)
+{
+    assert(table);
+
+    struct stripe *s = table->stripes + lock_stripe(table, id);
+
+    if (table->kind == LOCK_KIND_TICKET)
+    {
+        if (ticket_trylock(s) == -1)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+
+        return 0;
+    }
+
+    int rv = pthread_rwlock_trywrlock(&s->rwlock);
+    if (rv != 0)
+    {
+        errno = rv;
+        return -1;
+    }
+
+    return 0;
+}
+
+int lock_unlock(struct lock_table *table, uint64_t id)
+{
+    return stripe_unlock(table, table->stripes + lock_stripe(table, id));
+}
+
+int lock_wrlock_all(struct lock_table *table)
+{
+    assert(table);
+
+    for (unsigned i = 0; i < table->stripe_num; i++)
+    {
+        if (stripe_wrlock(table, table->stripes + i) == -1)
+        {
+            int err = errno;
+
+            while (i-- > 0)
+            {
+                stripe_unlock(table, table->stripes + i);
+            }
+
+            errno = err;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int lock_unlock_all(struct lock_table *table)
+{
+    assert(table);
+
+    int rv = 0;
+
+    for (unsigned i = 0; i < table->stripe_num; i++)
+    {
+        if (stripe_unlock(table, table->stripes + i) == -1)
+        {
+            rv = -1;
+        }
+    }
+
+    return rv;
+}
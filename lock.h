@@ -0,0 +1,102 @@
+/*
+ * Striped lock table, sized independently of the key space
+ */
+#ifndef LOCK_H_
+#define LOCK_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Lock table
+ *
+ */
+struct lock_table;
+
+/**
+ * @brief Lock used for every stripe of a lock table
+ *
+ */
+enum lock_kind
+{
+    LOCK_KIND_RWLOCK, // pthread read-write lock, readers can share a stripe
+    LOCK_KIND_TICKET  // FIFO spinning ticket lock, readers are exclusive as well
+};
+
+/**
+ * @brief Create a lock table
+ *
+ * @param stripe_num the number of stripes, must be a power of two
+ * @param kind
+ * @return struct lock_table* NULL for failure
+ */
+struct lock_table *lock_create(unsigned stripe_num, enum lock_kind kind);
+
+/**
+ * @brief Destroy a lock table
+ *
+ * @param table
+ */
+void lock_destroy(struct lock_table *table);
+
+/**
+ * @brief Get the stripe protecting an id
+ *
+ * @param table
+ * @param id any integer (e.g. a key), ids are spread over the stripes by hashing
+ * @return unsigned
+ */
+unsigned lock_stripe(const struct lock_table *table, uint64_t id);
+
+/**
+ * @brief Lock the stripe of an id for reading
+ *
+ * @param table
+ * @param id
+ * @return int -1 for failure
+ */
+int lock_rdlock(struct lock_table *table, uint64_t id);
+
+/**
+ * @brief Lock the stripe of an id for writing
+ *
+ * @param table
+ * @param id
+ * @return int -1 for failure
+ */
+int lock_wrlock(struct lock_table *table, uint64_t id);
+
+/**
+ * @brief Lock the stripe of an id for writing if nobody holds or waits for it
+ *
+ * @param table
+ * @param id
+ * @return int -1 for failure, with errno EBUSY if the stripe is taken
+ */
+int lock_trywrlock(struct lock_table *table, uint64_t id);
+
+/**
+ * @brief Unlock the stripe of an id
+ *
+ * @param table
+ * @param id
+ * @return int -1 for failure
+ */
+int lock_unlock(struct lock_table *table, uint64_t id);
+
+/**
+ * @brief Lock every stripe for writing, in stripe order
+ *
+ * @param table
+ * @return int -1 for failure
+ */
+int lock_wrlock_all(struct lock_table *table);
+
+/**
+ * @brief Unlock every stripe
+ *
+ * @param table
+ * @return int -1 for failure
+ */
+int lock_unlock_all(struct lock_table *table);
+
+#endif
@@ -0,0 +1,197 @@
+// Checkpoint duration and PUT latency while checkpointing, forked child versus PUTs paused
+// Usage: checkpoint_bench [snapshot_path] [element_num]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "ht.h"
+#include "lock.h"
+
+#define THREAD_NUM 4
+#define SAMPLE_MAX (1 << 22) // Per thread
+#define IDLE_MS 1000         // Length of the run without checkpoint
+
+struct bench_info
+{
+    struct ht *ht;
+    struct lock_table *locks;
+    atomic_int *stop;
+    unsigned short state[3];
+    double *samples; // PUT latencies in us
+    long n;
+};
+
+double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+void *bench_routine(void *args)
+{
+    struct bench_info *info = args;
+
+    info->n = 0;
+    while (!atomic_load_explicit(info->stop, memory_order_relaxed))
+    {
+        ht_key_t key = nrand48(info->state) % (HT_KEY_MAX - HT_KEY_MIN + 1) + HT_KEY_MIN;
+        double start = now_us();
+
+        lock_wrlock(info->locks, key);
+        ht_put(info->ht, key, nrand48(info->state), NULL, NULL, NULL);
+        lock_unlock(info->locks, key);
+
+        if (info->n < SAMPLE_MAX)
+        {
+            info->samples[info->n++] = now_us() - start;
+        }
+    }
+
+    return NULL;
+}
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// mode 0 for no checkpoint, 1 for a forked child, 2 for saving with PUTs paused
+void run(int mode, struct ht *ht, struct lock_table *locks, const char *path, struct bench_info *info)
+{
+    const char *mode_names[] = {"none", "fork", "pause"};
+    pthread_t tids[THREAD_NUM];
+    atomic_int stop = 0;
+
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        info[i].ht = ht;
+        info[i].locks = locks;
+        info[i].stop = &stop;
+        pthread_create(&tids[i], NULL, bench_routine, &info[i]);
+    }
+
+    usleep(10000); // Let the writers get going
+
+    double start = now_us(), paused = 0;
+    int rv = 0;
+
+    if (mode == 0)
+    {
+        usleep(IDLE_MS * 1000);
+    }
+    else
+    {
+        lock_wrlock_all(locks);
+        if (mode == 1)
+        {
+            pid_t pid = ht_fork_save(ht, path, 1);
+            paused = now_us() - start;
+            lock_unlock_all(locks);
+
+            int status;
+            rv = pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        else
+        {
+            rv = ht_save(ht, path, 1);
+            paused = now_us() - start;
+            lock_unlock_all(locks);
+        }
+    }
+
+    double duration = now_us() - start;
+
+    atomic_store(&stop, 1);
+
+    long n = 0;
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        pthread_join(tids[i], NULL);
+        n += info[i].n;
+    }
+
+    if (rv != 0)
+    {
+        fprintf(stderr, "checkpoint failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double *all = malloc(n * sizeof(double));
+    if (!all)
+    {
+        perror("malloc for all");
+        exit(EXIT_FAILURE);
+    }
+
+    n = 0;
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        for (long j = 0; j < info[i].n; j++)
+        {
+            all[n++] = info[i].samples[j];
+        }
+    }
+    qsort(all, n, sizeof(double), compare);
+
+    printf("%-6s %12.3f %10.3f %10.0f %8.2f %8.2f %10.1f\n", mode_names[mode], duration / 1000, paused / 1000,
+           n / (duration / 1000000), all[n / 2], all[n * 99 / 100], all[n - 1]);
+
+    free(all);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "checkpoint_bench.snap";
+    int element_num = argc > 2 ? atoi(argv[2]) : 1 << 22;
+
+    size_t size;
+    struct ht *ht = ht_create(BUCKET_NUM, element_num, HT_HASH, NULL, &size);
+    struct lock_table *locks = lock_create(LOCK_STRIPE_NUM, LOCK_KIND);
+    if (!ht || !locks)
+    {
+        fprintf(stderr, "setup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    struct bench_info info[THREAD_NUM];
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        info[i].state[0] = i;
+        info[i].state[1] = i * 7 + 1;
+        info[i].state[2] = i * 13 + 2;
+        info[i].samples = malloc(SAMPLE_MAX * sizeof(double));
+        if (!info[i].samples)
+        {
+            perror("malloc for samples");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("region %zu bytes, %d writers\n", size, THREAD_NUM);
+    printf("%-6s %12s %10s %10s %8s %8s %10s\n", "mode", "duration_ms", "pause_ms", "puts/s", "p50_us", "p99_us",
+           "max_us");
+
+    for (int mode = 0; mode <= 2; mode++)
+    {
+        run(mode, ht, locks, path, info);
+    }
+
+    unlink(path);
+
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        free(info[i].samples);
+    }
+    lock_destroy(locks);
+    ht_destroy(ht);
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Insert/delete steady state: capacity and chain lengths should not drift as elements get reused
+// Usage: churn_bench [rounds] [ops_per_round]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "parameters.h"
+#include "ht.h"
+
+#define KEY_NUM (HT_KEY_MAX - HT_KEY_MIN + 1)
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 10;
+    long ops = argc > 2 ? atol(argv[2]) : 1000000;
+
+    struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, HT_HASH, NULL, NULL);
+    if (!ht)
+    {
+        fprintf(stderr, "ht_create failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Every operation flips a random key, so about half of the keys are present at any time
+    char is_present[KEY_NUM] = {0};
+    unsigned short state[3] = {1, 2, 3};
+    long full = 0;
+
+    printf("buckets %d elements %d keys %d\n", BUCKET_NUM, ELEMENT_NUM, KEY_NUM);
+    printf("%6s %12s %8s %8s %10s %10s %12s\n", "round", "ops", "used", "free", "max_chain", "full", "Mops/s");
+
+    for (int r = 1; r <= rounds; r++)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (long i = 0; i < ops; i++)
+        {
+            int k = nrand48(state) % KEY_NUM;
+            if (is_present[k])
+            {
+                if (ht_del(ht, k + HT_KEY_MIN, NULL, NULL) != HT_CODE_SUCCESS)
+                {
+                    fprintf(stderr, "ht_del failed for key %d\n", k + HT_KEY_MIN);
+                    return EXIT_FAILURE;
+                }
+                is_present[k] = 0;
+            }
+            else
+            {
+                enum ht_code code = ht_put(ht, k + HT_KEY_MIN, k, NULL, NULL, NULL);
+                if (code == HT_CODE_FULL)
+                {
+                    full++;
+                    continue;
+                }
+                if (code != HT_CODE_SUCCESS)
+                {
+                    fprintf(stderr, "ht_put failed for key %d\n", k + HT_KEY_MIN);
+                    return EXIT_FAILURE;
+                }
+                is_present[k] = 1;
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        unsigned used, free_num, max_chain;
+        ht_stats(ht, &used, &free_num, &max_chain);
+
+        if (used + free_num != ELEMENT_NUM)
+        {
+            fprintf(stderr, "%u elements lost\n", ELEMENT_NUM - used - free_num);
+            return EXIT_FAILURE;
+        }
+
+        double us = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+        printf("%6d %12ld %8u %8u %10u %10ld %12.3f\n", r, ops * r, used, free_num, max_chain, full, ops / us);
+    }
+
+    ht_destroy(ht);
+
+    return 0;
+}
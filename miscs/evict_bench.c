@@ -0,0 +1,116 @@
+// Hit ratio and throughput of a cache-aside workload with CLOCK eviction, at several memory budgets
+// Usage: evict_bench [theta] [ops]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "parameters.h"
+#include "ht.h"
+#include "zipf.h"
+
+#define KEY_NUM (HT_KEY_MAX - HT_KEY_MIN + 1)
+
+// policy 0 for CLOCK, 1 for a random victim as a baseline
+void run(int policy, int budget, const struct zipf *zipf, long ops)
+{
+    const char *policy_names[] = {"clock", "random"};
+
+    struct ht *ht = ht_create(BUCKET_NUM, budget, HT_HASH, NULL, NULL);
+    if (!ht)
+    {
+        fprintf(stderr, "ht_create failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Keys in the table, only needed to pick random victims
+    ht_key_t present[KEY_NUM];
+    int where[KEY_NUM], present_num = 0;
+
+    unsigned short state[3] = {1, 2, 3};
+    long hits = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (long i = 0; i < ops; i++)
+    {
+        ht_key_t key = zipf_next(zipf, state) + HT_KEY_MIN;
+        ht_value_t value;
+
+        if (ht_get(ht, key, &value, 1) == HT_CODE_SUCCESS)
+        {
+            hits++;
+            continue;
+        }
+
+        // Miss, fill the cache
+        while (ht_put(ht, key, key, NULL, NULL, NULL) == HT_CODE_FULL)
+        {
+            ht_key_t victim;
+            if (policy == 0)
+            {
+                if (ht_evict_candidate(ht, &victim) == -1)
+                {
+                    fprintf(stderr, "ht_evict_candidate failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            else
+            {
+                victim = present[nrand48(state) % present_num];
+            }
+
+            if (ht_del(ht, victim, NULL, NULL) != HT_CODE_SUCCESS)
+            {
+                fprintf(stderr, "ht_del failed\n");
+                exit(EXIT_FAILURE);
+            }
+
+            int k = victim - HT_KEY_MIN;
+            present[where[k]] = present[--present_num];
+            where[present[where[k]] - HT_KEY_MIN] = where[k];
+        }
+
+        where[key - HT_KEY_MIN] = present_num;
+        present[present_num++] = key;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double us = (end.tv_sec - start.tv_sec) * 1000000.0 + (end.tv_nsec - start.tv_nsec) / 1000.0;
+    printf("%-8s %8d %10.2f%% %10.3f\n", policy_names[policy], budget, 100.0 * hits / ops, ops / us);
+
+    ht_destroy(ht);
+}
+
+int main(int argc, char *argv[])
+{
+    double theta = argc > 1 ? atof(argv[1]) : 0.99;
+    long ops = argc > 2 ? atol(argv[2]) : 2000000;
+
+    struct zipf *zipf = zipf_create(KEY_NUM, theta);
+    if (!zipf)
+    {
+        fprintf(stderr, "zipf_create failed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Budgets are in elements, out of one per key
+    int budgets[] = {8, 16, 32, 64, 128};
+
+    printf("keys %d theta %.2f ops %ld\n", KEY_NUM, theta, ops);
+    printf("%-8s %8s %11s %10s\n", "policy", "budget", "hit", "Mops/s");
+
+    for (int policy = 0; policy <= 1; policy++)
+    {
+        for (int i = 0; i < sizeof(budgets) / sizeof(*budgets); i++)
+        {
+            run(policy, budgets[i], zipf, ops);
+        }
+    }
+
+    zipf_destroy(zipf);
+
+    return 0;
+}
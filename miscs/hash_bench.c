@@ -0,0 +1,237 @@
+// How each hash spreads structured keys over the buckets: longest chain and cost of hashing and looking up keys,
+// printed as JSON to diff between builds
+// Usage: hash_bench [ops_per_rep] [reps] > result.json
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "parameters.h"
+#include "ht.h"
+
+#define KEY_NUM (HT_KEY_MAX - HT_KEY_MIN + 1)
+#define SET_SIZE 64
+#define STRIDE 8
+#define WARMUP_REP 1
+
+enum key_set
+{
+    KEY_SET_SEQUENTIAL,
+    KEY_SET_STRIDED, // Every STRIDE-th key, as fields of records laid out in keys would be
+    KEY_SET_RANDOM,
+    KEY_SET_NUM
+};
+
+const char *key_set_names[] = {"sequential", "strided", "random"};
+
+const enum ht_hash hashes[] = {HT_HASH_MODULO, HT_HASH_MULTIPLY_SHIFT, HT_HASH_MIX};
+const char *hash_names[] = {"modulo", "multiply_shift", "mix"};
+
+const int bucket_nums[] = {8, BUCKET_NUM, 100, 128};
+
+static inline uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Ticks per ns, measured against the monotonic clock
+double calibrate(void)
+{
+    struct timespec a, b, interval = {0, 100000000};
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t start = ticks();
+    nanosleep(&interval, NULL);
+    uint64_t end = ticks();
+    clock_gettime(CLOCK_MONOTONIC, &b);
+
+    return (end - start) / ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec));
+}
+
+void shuffle(ht_key_t *keys, int n, unsigned short state[3])
+{
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = nrand48(state) % (i + 1);
+        ht_key_t tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+int make_keys(enum key_set set, ht_key_t *keys)
+{
+    unsigned short state[3] = {set, SET_SIZE, STRIDE};
+    int n = 0;
+
+    switch (set)
+    {
+    case KEY_SET_SEQUENTIAL:
+        for (; n < SET_SIZE; n++)
+        {
+            keys[n] = HT_KEY_MIN + n;
+        }
+        break;
+    case KEY_SET_STRIDED:
+        for (; n < SET_SIZE && n * STRIDE < KEY_NUM; n++)
+        {
+            keys[n] = HT_KEY_MIN + n * STRIDE;
+        }
+        break;
+    default:
+        for (int i = 0; i < KEY_NUM; i++)
+        {
+            keys[i] = HT_KEY_MIN + i;
+        }
+        shuffle(keys, KEY_NUM, state);
+        n = SET_SIZE;
+        break;
+    }
+
+    return n;
+}
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Ticks per hash and per lookup, medians over the repetitions
+int run(enum ht_hash hash, int bucket_num, const ht_key_t *keys, int n, long ops, int reps, unsigned *max_chain,
+        unsigned *used_buckets, double *hash_ticks, double *lookup_ticks)
+{
+    double hash_results[reps], lookup_results[reps];
+    ht_key_t order[KEY_NUM];
+    ht_value_t value;
+    unsigned lengths[bucket_num];
+    volatile unsigned sink = 0;
+
+    struct ht *ht = ht_create(bucket_num, KEY_NUM, hash, NULL, NULL);
+    if (!ht)
+    {
+        fprintf(stderr, "ht_create failed\n");
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (ht_put(ht, keys[i], i, NULL, NULL, NULL) != HT_CODE_SUCCESS)
+        {
+            fprintf(stderr, "ht_put failed\n");
+            ht_destroy(ht);
+            return -1;
+        }
+        order[i] = keys[i];
+    }
+
+    ht_stats(ht, NULL, NULL, max_chain);
+    ht_bucket_lengths(ht, lengths);
+    *used_buckets = 0;
+    for (int i = 0; i < bucket_num; i++)
+    {
+        *used_buckets += lengths[i] > 0;
+    }
+
+    // Keys are looked up in a random order, so that chains are not walked in the order they were built
+    unsigned short state[3] = {hash, bucket_num, n};
+    shuffle(order, n, state);
+
+    for (int r = 0; r < WARMUP_REP + reps; r++)
+    {
+        uint64_t start = ticks();
+        for (long i = 0; i < ops; i++)
+        {
+            sink += ht_bucket(ht, order[i % n]);
+        }
+        uint64_t middle = ticks();
+        for (long i = 0; i < ops; i++)
+        {
+            ht_get(ht, order[i % n], &value, 1);
+        }
+        uint64_t end = ticks();
+
+        if (r >= WARMUP_REP)
+        {
+            hash_results[r - WARMUP_REP] = (double)(middle - start) / ops;
+            lookup_results[r - WARMUP_REP] = (double)(end - middle) / ops;
+        }
+    }
+
+    qsort(hash_results, reps, sizeof(double), compare);
+    qsort(lookup_results, reps, sizeof(double), compare);
+    *hash_ticks = hash_results[reps / 2];
+    *lookup_ticks = lookup_results[reps / 2];
+
+    ht_destroy(ht);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long ops = argc > 1 ? atol(argv[1]) : 1000000;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+    if (ops <= 0 || reps <= 0)
+    {
+        fprintf(stderr, "Usage: hash_bench [ops_per_rep] [reps]\n");
+        return EXIT_FAILURE;
+    }
+
+    double ticks_per_ns = calibrate();
+
+    printf("{\"set_size\": %d, \"stride\": %d, \"ops_per_rep\": %ld, \"reps\": %d, \"warmup_reps\": %d, "
+           "\"ticks_per_ns\": %.3f,\n\"results\": [",
+           SET_SIZE, STRIDE, ops, reps, WARMUP_REP, ticks_per_ns);
+
+    int count = 0;
+    for (enum key_set set = 0; set < KEY_SET_NUM; set++)
+    {
+        ht_key_t keys[KEY_NUM];
+        int n = make_keys(set, keys);
+
+        for (int b = 0; b < sizeof(bucket_nums) / sizeof(*bucket_nums); b++)
+        {
+            for (int h = 0; h < sizeof(hashes) / sizeof(*hashes); h++)
+            {
+                unsigned max_chain, used_buckets;
+                double hash_ticks, lookup_ticks;
+                if (run(hashes[h], bucket_nums[b], keys, n, ops, reps, &max_chain, &used_buckets, &hash_ticks,
+                        &lookup_ticks) == -1)
+                {
+                    fprintf(stderr, "run failed\n");
+                    return EXIT_FAILURE;
+                }
+
+                // The best spread puts ceil(n / bucket_num) keys in the longest chain
+                int ideal = (n + bucket_nums[b] - 1) / bucket_nums[b];
+
+                printf("%s\n{\"keys\": \"%s\", \"key_num\": %d, \"buckets\": %d, \"hash\": \"%s\", "
+                       "\"max_chain\": %u, \"ideal_max_chain\": %d, \"used_buckets\": %u, \"hash_ns\": %.2f, "
+                       "\"lookup_ns\": %.2f}",
+                       count++ > 0 ? "," : "", key_set_names[set], n, bucket_nums[b], hash_names[h], max_chain, ideal,
+                       used_buckets, hash_ticks / ticks_per_ns, lookup_ticks / ticks_per_ns);
+
+                fprintf(stderr, "%-10s buckets %3d %-14s: max chain %3u (ideal %2d), %3u buckets used, %6.2f ns/hash, "
+                                "%6.2f ns/lookup\n",
+                        key_set_names[set], bucket_nums[b], hash_names[h], max_chain, ideal, used_buckets,
+                        hash_ticks / ticks_per_ns, lookup_ticks / ticks_per_ns);
+            }
+        }
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}
@@ -0,0 +1,324 @@
+// Cost of hashtable operations in ns and cycles per operation, printed as JSON to diff between builds
+// Usage: ht_bench [ops_per_rep] [reps] > result.json
+// CHUNK is compiled into the hashtable, so other sizes need a rebuild: make -B ht_bench CHUNK=64
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "parameters.h"
+#include "ht.h"
+
+#define KEY_NUM (HT_KEY_MAX - HT_KEY_MIN + 1)
+#define MAX_THREAD 4
+#define WARMUP_REP 1
+
+enum op
+{
+    OP_PUT_INSERT,
+    OP_PUT_UPDATE,
+    OP_GET_HIT_PRIMARY,
+    OP_GET_HIT_BACKUP,
+    OP_GET_MISS_PRIMARY,
+    OP_GET_MISS_BACKUP,
+    OP_NUM
+};
+
+const char *op_names[] = {"put_insert", "put_update", "get_hit_primary", "get_hit_backup", "get_miss_primary",
+                          "get_miss_backup"};
+
+const int bucket_nums[] = {1, 8, 32, 128};
+const int fill_percents[] = {25, 50, 100};
+const int thread_nums[] = {1, 2, MAX_THREAD};
+
+// Each thread works on the keys of its own buckets, so that writers need no lock
+struct bench_info
+{
+    struct ht *ht;
+    enum op op;
+    long ops;
+    pthread_barrier_t *barrier;
+    ht_key_t present[KEY_NUM]; // Shuffled
+    int present_num;
+    ht_key_t absent[KEY_NUM];
+    int absent_num;
+    uint64_t start; // Ticks
+    uint64_t end;
+    long done;
+};
+
+static inline uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// Ticks per ns, measured against the monotonic clock
+double calibrate(void)
+{
+    struct timespec a, b, interval = {0, 100000000};
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t start = ticks();
+    nanosleep(&interval, NULL);
+    uint64_t end = ticks();
+    clock_gettime(CLOCK_MONOTONIC, &b);
+
+    return (end - start) / ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec));
+}
+
+void shuffle(ht_key_t *keys, int n, unsigned short state[3])
+{
+    for (int i = n - 1; i > 0; i--)
+    {
+        int j = nrand48(state) % (i + 1);
+        ht_key_t tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+void *bench_routine(void *args)
+{
+    struct bench_info *info = args;
+    ht_value_t value;
+    long done = 0;
+
+    pthread_barrier_wait(info->barrier);
+    info->start = ticks();
+
+    switch (info->op)
+    {
+    case OP_PUT_INSERT:
+        // Inserts only last until the keys are in, so the keys are deleted and inserted again, the deletes being
+        // left out of the time
+        info->end = info->start;
+        while (done < info->ops && info->present_num > 0)
+        {
+            uint64_t start = ticks();
+            for (int i = 0; i < info->present_num; i++)
+            {
+                ht_put(info->ht, info->present[i], i, NULL, NULL, NULL);
+            }
+            info->end += ticks() - start;
+            done += info->present_num;
+
+            for (int i = 0; i < info->present_num; i++)
+            {
+                ht_del(info->ht, info->present[i], NULL, NULL);
+            }
+        }
+        info->done = done;
+        return NULL;
+    case OP_PUT_UPDATE:
+        for (; done < info->ops && info->present_num > 0; done++)
+        {
+            ht_put(info->ht, info->present[done % info->present_num], done, NULL, NULL, NULL);
+        }
+        break;
+    case OP_GET_HIT_PRIMARY:
+    case OP_GET_HIT_BACKUP:
+        for (; done < info->ops && info->present_num > 0; done++)
+        {
+            ht_get(info->ht, info->present[done % info->present_num], &value, info->op == OP_GET_HIT_PRIMARY);
+        }
+        break;
+    default:
+        for (; done < info->ops && info->absent_num > 0; done++)
+        {
+            ht_get(info->ht, info->absent[done % info->absent_num], &value, info->op == OP_GET_MISS_PRIMARY);
+        }
+        break;
+    }
+
+    info->end = ticks();
+    info->done = done;
+
+    return NULL;
+}
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Ticks per operation of each thread, median and minimum over the repetitions
+int run(int bucket_num, int fill_percent, int thread_num, enum op op, long ops, int reps, double *median,
+        double *min)
+{
+    int rv = -1;
+    struct bench_info info[MAX_THREAD];
+    pthread_t tids[MAX_THREAD];
+    pthread_barrier_t barrier;
+    double results[reps];
+
+    struct ht *ht = ht_create(bucket_num, KEY_NUM, HT_HASH, NULL, NULL);
+    if (!ht)
+    {
+        fprintf(stderr, "ht_create failed\n");
+        goto out1;
+    }
+
+    if (pthread_barrier_init(&barrier, NULL, thread_num) != 0)
+    {
+        perror("pthread_barrier_init");
+        goto out2;
+    }
+
+    // The first fill_percent of the keys of every bucket are present
+    unsigned short state[3] = {bucket_num, fill_percent, op};
+    ht_key_t keys[KEY_NUM];
+    for (int i = 0; i < KEY_NUM; i++)
+    {
+        keys[i] = i + HT_KEY_MIN;
+    }
+    shuffle(keys, KEY_NUM, state);
+
+    for (int t = 0; t < thread_num; t++)
+    {
+        info[t].ht = ht;
+        info[t].op = op;
+        info[t].ops = ops / thread_num;
+        info[t].barrier = &barrier;
+        info[t].present_num = 0;
+        info[t].absent_num = 0;
+    }
+
+    for (int i = 0; i < KEY_NUM; i++)
+    {
+        struct bench_info *owner = &info[ht_bucket(ht, keys[i]) % thread_num];
+        if (i < KEY_NUM * fill_percent / 100)
+        {
+            owner->present[owner->present_num++] = keys[i];
+            if (op != OP_PUT_INSERT && ht_put(ht, keys[i], i, NULL, NULL, NULL) != HT_CODE_SUCCESS)
+            {
+                fprintf(stderr, "ht_put failed\n");
+                goto out3;
+            }
+        }
+        else
+        {
+            owner->absent[owner->absent_num++] = keys[i];
+        }
+    }
+
+    for (int r = 0; r < WARMUP_REP + reps; r++)
+    {
+        int n = 0;
+        for (; n < thread_num; n++)
+        {
+            if (pthread_create(&tids[n], NULL, bench_routine, &info[n]) != 0)
+            {
+                perror("pthread_create");
+                break;
+            }
+        }
+
+        for (int t = 0; t < n; t++)
+        {
+            pthread_join(tids[t], NULL);
+        }
+
+        if (n < thread_num)
+        {
+            goto out3;
+        }
+
+        // Threads without keys to work on are left out
+        double sum = 0;
+        int busy = 0;
+        for (int t = 0; t < thread_num; t++)
+        {
+            if (info[t].done > 0)
+            {
+                sum += (double)(info[t].end - info[t].start) / info[t].done;
+                busy++;
+            }
+        }
+
+        if (r >= WARMUP_REP)
+        {
+            results[r - WARMUP_REP] = busy > 0 ? sum / busy : 0;
+        }
+    }
+
+    qsort(results, reps, sizeof(double), compare);
+    *median = results[reps / 2];
+    *min = results[0];
+    rv = 0;
+
+out3:
+    pthread_barrier_destroy(&barrier);
+out2:
+    ht_destroy(ht);
+out1:
+    return rv;
+}
+
+int main(int argc, char *argv[])
+{
+    long ops = argc > 1 ? atol(argv[1]) : 200000;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+
+    if (ops <= 0 || reps <= 0)
+    {
+        fprintf(stderr, "Usage: ht_bench [ops_per_rep] [reps]\n");
+        return EXIT_FAILURE;
+    }
+
+    double ticks_per_ns = calibrate();
+
+    printf("{\"chunk\": %d, \"keys\": %d, \"ops_per_rep\": %ld, \"reps\": %d, \"warmup_reps\": %d, "
+           "\"ticks_per_ns\": %.3f,\n\"results\": [",
+           CHUNK, KEY_NUM, ops, reps, WARMUP_REP, ticks_per_ns);
+
+    int n = 0;
+    for (int b = 0; b < sizeof(bucket_nums) / sizeof(*bucket_nums); b++)
+    {
+        for (int f = 0; f < sizeof(fill_percents) / sizeof(*fill_percents); f++)
+        {
+            for (int t = 0; t < sizeof(thread_nums) / sizeof(*thread_nums); t++)
+            {
+                for (enum op op = 0; op < OP_NUM; op++)
+                {
+                    // Every thread needs a bucket, and a full table has no key to miss
+                    if (thread_nums[t] > bucket_nums[b] ||
+                        (fill_percents[f] == 100 && (op == OP_GET_MISS_PRIMARY || op == OP_GET_MISS_BACKUP)))
+                    {
+                        continue;
+                    }
+
+                    double median, min;
+                    if (run(bucket_nums[b], fill_percents[f], thread_nums[t], op, ops, reps, &median, &min) == -1)
+                    {
+                        fprintf(stderr, "run failed\n");
+                        return EXIT_FAILURE;
+                    }
+
+                    printf("%s\n{\"op\": \"%s\", \"buckets\": %d, \"fill_percent\": %d, \"threads\": %d, "
+                           "\"ns_per_op\": %.2f, \"ns_per_op_min\": %.2f, \"ticks_per_op\": %.1f}",
+                           n++ > 0 ? "," : "", op_names[op], bucket_nums[b], fill_percents[f], thread_nums[t],
+                           median / ticks_per_ns, min / ticks_per_ns, median);
+
+                    fprintf(stderr, "%-16s buckets %3d fill %3d%% threads %d: %8.2f ns/op\n", op_names[op],
+                            bucket_nums[b], fill_percents[f], thread_nums[t], median / ticks_per_ns);
+                }
+            }
+        }
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}
@@ -6,7 +6,7 @@ int main()
 {
     void *addr;
     size_t size;
-    struct ht *ht = ht_create(10, 20, &addr, &size);
+    struct ht *ht = ht_create(10, 20, HT_HASH_MODULO, &addr, &size);
 
     printf("hashtable start addr %p, size %lu\n\n", addr, size);
     ht_show(ht);
@@ -0,0 +1,130 @@
+// Contention benchmark for the striped lock table under zipfian keys
+// Usage: lock_bench [theta]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lock.h"
+#include "zipf.h"
+
+#define KEY_NUM (1 << 20) // Wide keys, far more than the stripes
+#define WRITE_PERCENT 10
+#define DURATION_MS 200
+#define MAX_THREAD 8
+
+struct bench_info
+{
+    struct lock_table *table;
+    const struct zipf *zipf;
+    atomic_int *stop;
+    unsigned short state[3];
+    long ops;
+};
+
+static long data[KEY_NUM]; // Touched inside the critical section
+
+void *bench_routine(void *args)
+{
+    struct bench_info *info = args;
+    long ops = 0;
+
+    while (!atomic_load_explicit(info->stop, memory_order_relaxed))
+    {
+        uint64_t key = zipf_next(info->zipf, info->state);
+
+        if (nrand48(info->state) % 100 < WRITE_PERCENT)
+        {
+            lock_wrlock(info->table, key);
+            data[key]++;
+        }
+        else
+        {
+            lock_rdlock(info->table, key);
+            (void)*(volatile long *)&data[key];
+        }
+        lock_unlock(info->table, key);
+
+        ops++;
+    }
+
+    info->ops = ops;
+    return NULL;
+}
+
+double run(enum lock_kind kind, unsigned stripe_num, int thread_num, const struct zipf *zipf)
+{
+    struct lock_table *table = lock_create(stripe_num, kind);
+    if (!table)
+    {
+        fprintf(stderr, "lock_create failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_t tids[MAX_THREAD];
+    struct bench_info info[MAX_THREAD];
+    atomic_int stop = 0;
+
+    for (int i = 0; i < thread_num; i++)
+    {
+        info[i].table = table;
+        info[i].zipf = zipf;
+        info[i].stop = &stop;
+        info[i].state[0] = i;
+        info[i].state[1] = i * 7 + 1;
+        info[i].state[2] = i * 13 + 2;
+        pthread_create(&tids[i], NULL, bench_routine, &info[i]);
+    }
+
+    usleep(DURATION_MS * 1000);
+    atomic_store(&stop, 1);
+
+    long ops = 0;
+    for (int i = 0; i < thread_num; i++)
+    {
+        pthread_join(tids[i], NULL);
+        ops += info[i].ops;
+    }
+
+    lock_destroy(table);
+
+    return ops / (DURATION_MS * 1000.0); // ops/us = Mops/s
+}
+
+int main(int argc, char *argv[])
+{
+    double theta = argc > 1 ? atof(argv[1]) : 0.99;
+
+    struct zipf *zipf = zipf_create(KEY_NUM, theta);
+    if (!zipf)
+    {
+        fprintf(stderr, "zipf_create failed\n");
+        return EXIT_FAILURE;
+    }
+
+    unsigned stripe_nums[] = {1, 16, 256, 4096};
+    int thread_nums[] = {1, 2, 4, 8};
+    const char *kind_names[] = {"rwlock", "ticket"};
+
+    printf("keys %d theta %.2f write %d%%\n", KEY_NUM, theta, WRITE_PERCENT);
+    printf("%-8s %8s %8s %10s\n", "kind", "stripes", "threads", "Mops/s");
+
+    for (int kind = LOCK_KIND_RWLOCK; kind <= LOCK_KIND_TICKET; kind++)
+    {
+        for (int i = 0; i < sizeof(stripe_nums) / sizeof(*stripe_nums); i++)
+        {
+            for (int j = 0; j < sizeof(thread_nums) / sizeof(*thread_nums); j++)
+            {
+                double mops = run(kind, stripe_nums[i], thread_nums[j], zipf);
+                printf("%-8s %8u %8d %10.3f\n", kind_names[kind], stripe_nums[i], thread_nums[j], mops);
+            }
+        }
+    }
+
+    zipf_destroy(zipf);
+
+    return 0;
+}
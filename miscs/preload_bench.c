@@ -0,0 +1,100 @@
+// Bulk load time of ht_preload for binary and text files, by number of threads
+// Usage: preload_bench [record_num] [dir]
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "ht.h"
+
+#define KEY_NUM (HT_KEY_MAX - HT_KEY_MIN + 1)
+
+int main(int argc, char *argv[])
+{
+    long record_num = argc > 1 ? atol(argv[1]) : 1 << 22;
+    const char *dir = argc > 2 ? argv[2] : ".";
+
+    char paths[2][4096];
+    snprintf(paths[0], sizeof(paths[0]), "%s/preload_bench.bin", dir);
+    snprintf(paths[1], sizeof(paths[1]), "%s/preload_bench.csv", dir);
+
+    // Same records in both formats, remembering the last value of every key
+    ht_value_t expected[KEY_NUM];
+    FILE *bin = fopen(paths[0], "w"), *csv = fopen(paths[1], "w");
+    if (!bin || !csv)
+    {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+
+    char magic[8] = "RKVLOAD";
+    uint64_t n = record_num;
+    fwrite(magic, sizeof(magic), 1, bin);
+    fwrite(&n, sizeof(n), 1, bin);
+
+    unsigned short state[3] = {1, 2, 3};
+    for (long i = 0; i < record_num; i++)
+    {
+        int32_t record[2] = {nrand48(state) % KEY_NUM + HT_KEY_MIN, nrand48(state)};
+        fwrite(record, sizeof(record), 1, bin);
+        fprintf(csv, "%d,%d\n", record[0], record[1]);
+        expected[record[0] - HT_KEY_MIN] = record[1];
+    }
+
+    fclose(bin);
+    fclose(csv);
+
+    const char *format_names[] = {"binary", "text"};
+    int thread_nums[] = {1, 2, 4, 8};
+
+    printf("records %ld\n", record_num);
+    printf("%-8s %8s %10s %14s\n", "format", "threads", "ms", "records/s");
+
+    for (int f = 0; f < 2; f++)
+    {
+        for (int i = 0; i < sizeof(thread_nums) / sizeof(*thread_nums); i++)
+        {
+            struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, HT_HASH, NULL, NULL);
+            if (!ht)
+            {
+                fprintf(stderr, "ht_create failed\n");
+                return EXIT_FAILURE;
+            }
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            long loaded = ht_preload(ht, paths[f], thread_nums[i]);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            if (loaded != record_num)
+            {
+                fprintf(stderr, "ht_preload loaded %ld records\n", loaded);
+                return EXIT_FAILURE;
+            }
+
+            for (int k = 0; k < KEY_NUM; k++)
+            {
+                ht_value_t value;
+                if (ht_get(ht, k + HT_KEY_MIN, &value, 1) != HT_CODE_SUCCESS || value != expected[k])
+                {
+                    fprintf(stderr, "wrong value for key %d\n", k + HT_KEY_MIN);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+            printf("%-8s %8d %10.3f %14.0f\n", format_names[f], thread_nums[i], ms, record_num / ms * 1000);
+
+            ht_destroy(ht);
+        }
+    }
+
+    unlink(paths[0]);
+    unlink(paths[1]);
+
+    return 0;
+}
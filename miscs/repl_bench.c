@@ -0,0 +1,227 @@
+// Replication path between a primary and its backups as threads of one process, over the verbs stand-in of
+// verbs_emu.c: writes/s, bytes/s, completion latency and CPU per write size, batch size and number of backups
+// Usage: EMU_DELAY_US=20 repl_bench [duration_ms] [port]
+// CQ_POLL_BUDGET is compiled into rdma.c, so busy polling is compared by rebuilding: make -B repl_bench CQ_POLL_BUDGET=-1
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "hist.h"
+#include "rdma.h"
+#include "sokt.h"
+
+#define REGION_SIZE (1 << 20)
+#define MAX_BACKUP 3
+
+const int backup_nums[] = {1, 2, MAX_BACKUP};
+const size_t write_sizes[] = {8, 64, 512, 4096};
+const int batch_sizes[] = {1, 8, 32};
+
+struct backup_info
+{
+    char port[8];
+    struct sokt_name_info *primary;
+    void *region;
+    int sockfd;
+    struct rdma_context *ctx;
+};
+
+void *backup_routine(void *args)
+{
+    struct backup_info *info = args;
+
+    info->ctx = NULL;
+    info->sockfd = sokt_passive_open(NULL, info->port);
+    if (info->sockfd == -1)
+    {
+        fprintf(stderr, "sokt_passive_open failed\n");
+        return NULL;
+    }
+
+    info->ctx = rdma_open_connection(0, info->sockfd, &info->primary, 1, 1, NULL, 0, info->region, REGION_SIZE);
+    if (!info->ctx)
+    {
+        fprintf(stderr, "rdma_open_connection failed\n");
+    }
+
+    return NULL;
+}
+
+double elapsed_s(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+double cpu_s(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Write batches of random ranges to every backup and wait for each batch, as PUTs do
+int run(struct rdma_context *ctx, char *region, int backup_num, size_t size, int batch, int duration_ms,
+        struct hist *hist)
+{
+    long offsets[RDMA_BATCH_MAX];
+    size_t sizes[RDMA_BATCH_MAX];
+    unsigned short state[3] = {backup_num, size, batch};
+    long batches = 0;
+
+    hist_reset(hist);
+
+    struct timespec start, begin, end;
+    double cpu = cpu_s();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (elapsed_s(&start) * 1000 < duration_ms)
+    {
+        for (int i = 0; i < batch; i++)
+        {
+            offsets[i] = nrand48(state) % (REGION_SIZE / size) * size;
+            sizes[i] = size;
+            memset(region + offsets[i], batches + i, size);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        if (rdma_write_batch_all(ctx, offsets, sizes, batch, backup_num) == -1 ||
+            rdma_wait_completion_all(ctx, backup_num) == -1)
+        {
+            fprintf(stderr, "replication failed\n");
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        hist_record(hist, (end.tv_sec - begin.tv_sec) * 1000000000ULL + end.tv_nsec - begin.tv_nsec);
+        batches++;
+    }
+
+    double seconds = elapsed_s(&start);
+    cpu = cpu_s() - cpu;
+
+    // Writes and bytes count once per backup
+    double writes = (double)batches * batch * backup_num / seconds;
+    printf("%7d %6zu %5d %12.0f %10.1f %10.2f %10.2f %10.2f %6.0f%%\n", backup_num, size, batch, writes,
+           writes * size / (1 << 20), hist_percentile(hist, 50) / 1000.0, hist_percentile(hist, 99) / 1000.0,
+           hist_max(hist) / 1000.0, cpu / seconds * 100);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int rv = EXIT_FAILURE;
+    int duration_ms = argc > 1 ? atoi(argv[1]) : 200;
+    int port = argc > 2 ? atoi(argv[2]) : 20000 + getpid() % 20000;
+
+    char *primary_region = calloc(1, REGION_SIZE);
+    char *backup_regions = calloc(MAX_BACKUP, REGION_SIZE);
+    struct hist *hist = hist_create();
+    if (!primary_region || !backup_regions || !hist)
+    {
+        fprintf(stderr, "setup failed\n");
+        goto out;
+    }
+
+    char *delay = getenv("EMU_DELAY_US");
+    printf("cq poll budget %d, completion delay %s us, %d ms per run\n", CQ_POLL_BUDGET, delay ? delay : "0",
+           duration_ms);
+    printf("%7s %6s %5s %12s %10s %10s %10s %10s %7s\n", "backups", "size", "batch", "writes/s", "MB/s", "p50_us",
+           "p99_us", "max_us", "cpu");
+
+    for (int b = 0; b < sizeof(backup_nums) / sizeof(*backup_nums); b++)
+    {
+        int backup_num = backup_nums[b];
+        char primary_port[8];
+        sprintf(primary_port, "%d", port);
+        struct sokt_name_info primary = {"127.0.0.1", primary_port};
+        struct backup_info infos[MAX_BACKUP];
+        pthread_t tids[MAX_BACKUP];
+
+        int sockfd = sokt_passive_open(NULL, primary_port);
+        if (sockfd == -1)
+        {
+            fprintf(stderr, "sokt_passive_open failed\n");
+            goto out;
+        }
+
+        int n = 0;
+        for (; n < backup_num; n++)
+        {
+            sprintf(infos[n].port, "%d", port + 1 + n);
+            infos[n].primary = &primary;
+            infos[n].region = backup_regions + (size_t)n * REGION_SIZE;
+            if (pthread_create(&tids[n], NULL, backup_routine, &infos[n]) != 0)
+            {
+                perror("pthread_create");
+                break;
+            }
+        }
+
+        struct rdma_context *ctx = NULL;
+        if (n == backup_num)
+        {
+            ctx = rdma_open_connection(1, sockfd, NULL, backup_num, backup_num, NULL, 0, primary_region, REGION_SIZE);
+        }
+
+        char is_ready = ctx != NULL;
+        for (int i = 0; i < n; i++)
+        {
+            pthread_join(tids[i], NULL);
+            is_ready = is_ready && infos[i].ctx;
+        }
+
+        for (int s = 0; is_ready && s < sizeof(write_sizes) / sizeof(*write_sizes); s++)
+        {
+            for (int k = 0; is_ready && k < sizeof(batch_sizes) / sizeof(*batch_sizes); k++)
+            {
+                is_ready = run(ctx, primary_region, backup_num, write_sizes[s], batch_sizes[k], duration_ms, hist) == 0;
+            }
+        }
+
+        // Every write must have landed on every backup
+        for (int i = 0; is_ready && i < backup_num; i++)
+        {
+            if (memcmp(primary_region, infos[i].region, REGION_SIZE) != 0)
+            {
+                fprintf(stderr, "backup %d differs from the primary\n", i);
+                is_ready = 0;
+            }
+        }
+
+        rdma_close_connection(ctx, backup_num);
+        sokt_passive_close(sockfd);
+        for (int i = 0; i < n; i++)
+        {
+            if (infos[i].sockfd != -1)
+            {
+                rdma_close_connection(infos[i].ctx, 1);
+                sokt_passive_close(infos[i].sockfd);
+            }
+        }
+
+        if (!is_ready)
+        {
+            goto out;
+        }
+
+        port += MAX_BACKUP + 1;
+    }
+
+    rv = EXIT_SUCCESS;
+
+out:
+    hist_destroy(hist);
+    free(backup_regions);
+    free(primary_region);
+
+    return rv;
+}
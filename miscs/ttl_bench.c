@@ -0,0 +1,253 @@
+// Cost of sweeping expired keys and PUT latency meanwhile, incremental sweeps versus whole-table sweeps
+// Usage: ttl_bench [ttl_ms] [puts_per_s] [duration_ms]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "ht.h"
+#include "lock.h"
+
+#define THREAD_NUM 2
+#define SAMPLE_MAX (1 << 22) // Per thread
+
+struct bench_info
+{
+    struct ht *ht;
+    struct lock_table *locks;
+    atomic_int *stop;
+    int ttl_ms;
+    double gap_us; // Between two PUTs of a writer, so that the sweeper is not starved of CPU
+    unsigned short state[3];
+    double *samples; // PUT latencies in us
+    long n;
+};
+
+struct sweep_info
+{
+    struct ht *ht;
+    struct lock_table *locks;
+    atomic_int *stop;
+    int mode;
+    double busy;    // Time spent sweeping in us
+    long reclaimed; // Keys deleted
+};
+
+double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+void *bench_routine(void *args)
+{
+    struct bench_info *info = args;
+
+    info->n = 0;
+    double next = now_us();
+    while (!atomic_load_explicit(info->stop, memory_order_relaxed))
+    {
+        next += info->gap_us;
+        double wait = next - now_us();
+        if (wait > 0)
+        {
+            usleep(wait);
+        }
+
+        ht_key_t key = nrand48(info->state) % (HT_KEY_MAX - HT_KEY_MIN + 1) + HT_KEY_MIN;
+        unsigned bucket = ht_bucket(info->ht, key);
+        double start = now_us();
+
+        lock_wrlock(info->locks, bucket);
+        ht_put_expire(info->ht, key, nrand48(info->state), ht_time_ms() + info->ttl_ms, NULL, NULL, NULL);
+        lock_unlock(info->locks, bucket);
+
+        if (info->n < SAMPLE_MAX)
+        {
+            info->samples[info->n++] = now_us() - start;
+        }
+    }
+
+    return NULL;
+}
+
+long sweep_bucket(struct ht *ht, unsigned bucket, int64_t now)
+{
+    long n = 0;
+    ht_key_t key;
+
+    while (ht_expired(ht, bucket, now, &key) == 0 && ht_del(ht, key, NULL, NULL) == HT_CODE_SUCCESS)
+    {
+        n++;
+    }
+
+    return n;
+}
+
+// mode 1 sweeps SWEEP_BUCKET_NUM buckets per interval like the server, mode 2 sweeps every bucket at once with
+// every lock held, as often as needed to cover the table at the same rate
+void *sweep_routine(void *args)
+{
+    struct sweep_info *info = args;
+
+    int interval_ms = info->mode == 1 ? SWEEP_INTERVAL_MS : SWEEP_INTERVAL_MS * BUCKET_NUM / SWEEP_BUCKET_NUM;
+    struct timespec interval = {interval_ms / 1000, interval_ms % 1000 * 1000000};
+    unsigned bucket = 0;
+
+    info->busy = 0;
+    info->reclaimed = 0;
+    while (!atomic_load_explicit(info->stop, memory_order_relaxed))
+    {
+        nanosleep(&interval, NULL);
+
+        double start = now_us();
+        int64_t now = ht_time_ms();
+
+        if (info->mode == 1)
+        {
+            for (int i = 0; i < SWEEP_BUCKET_NUM; i++, bucket = (bucket + 1) % BUCKET_NUM)
+            {
+                lock_wrlock(info->locks, bucket);
+                info->reclaimed += sweep_bucket(info->ht, bucket, now);
+                lock_unlock(info->locks, bucket);
+            }
+        }
+        else
+        {
+            lock_wrlock_all(info->locks);
+            for (unsigned b = 0; b < BUCKET_NUM; b++)
+            {
+                info->reclaimed += sweep_bucket(info->ht, b, now);
+            }
+            lock_unlock_all(info->locks);
+        }
+
+        info->busy += now_us() - start;
+    }
+
+    return NULL;
+}
+
+int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// mode 0 for no sweeper, expired keys are only reused when put again
+void run(int mode, int ttl_ms, int rate, int duration_ms, struct bench_info *info)
+{
+    const char *mode_names[] = {"none", "incr", "full"};
+    pthread_t tids[THREAD_NUM], sweeper;
+    atomic_int stop = 0;
+
+    struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, HT_HASH, NULL, NULL);
+    struct lock_table *locks = lock_create(LOCK_STRIPE_NUM, LOCK_KIND);
+    if (!ht || !locks)
+    {
+        fprintf(stderr, "setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        info[i].ht = ht;
+        info[i].locks = locks;
+        info[i].stop = &stop;
+        info[i].ttl_ms = ttl_ms;
+        info[i].gap_us = 1000000.0 * THREAD_NUM / rate;
+        pthread_create(&tids[i], NULL, bench_routine, &info[i]);
+    }
+
+    struct sweep_info sweep_info = {ht, locks, &stop, mode, 0, 0};
+    if (mode != 0)
+    {
+        pthread_create(&sweeper, NULL, sweep_routine, &sweep_info);
+    }
+
+    double start = now_us();
+    usleep(duration_ms * 1000);
+    double duration = now_us() - start;
+
+    atomic_store(&stop, 1);
+
+    long n = 0;
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        pthread_join(tids[i], NULL);
+        n += info[i].n;
+    }
+
+    if (mode != 0)
+    {
+        pthread_join(sweeper, NULL);
+    }
+
+    double *all = malloc(n * sizeof(double));
+    if (!all)
+    {
+        perror("malloc for all");
+        exit(EXIT_FAILURE);
+    }
+
+    n = 0;
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        for (long j = 0; j < info[i].n; j++)
+        {
+            all[n++] = info[i].samples[j];
+        }
+    }
+    qsort(all, n, sizeof(double), compare);
+
+    double seconds = duration / 1000000;
+    printf("%-6s %14.3f %12.0f %10.0f %8.2f %8.2f %10.1f\n", mode_names[mode], sweep_info.busy / 1000 / seconds,
+           sweep_info.reclaimed / seconds, n / seconds, all[n / 2], all[n * 99 / 100], all[n - 1]);
+
+    free(all);
+    lock_destroy(locks);
+    ht_destroy(ht);
+}
+
+int main(int argc, char *argv[])
+{
+    int ttl_ms = argc > 1 ? atoi(argv[1]) : 5;
+    int rate = argc > 2 ? atoi(argv[2]) : 20000;
+    int duration_ms = argc > 3 ? atoi(argv[3]) : 2000;
+
+    struct bench_info info[THREAD_NUM];
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        info[i].state[0] = i;
+        info[i].state[1] = i * 7 + 1;
+        info[i].state[2] = i * 13 + 2;
+        info[i].samples = malloc(SAMPLE_MAX * sizeof(double));
+        if (!info[i].samples)
+        {
+            perror("malloc for samples");
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("ttl %d ms, %d puts/s from %d writers, %d buckets, %d swept per %d ms\n", ttl_ms, rate, THREAD_NUM,
+           BUCKET_NUM, SWEEP_BUCKET_NUM, SWEEP_INTERVAL_MS);
+    printf("%-6s %14s %12s %10s %8s %8s %10s\n", "mode", "sweep_ms_per_s", "reclaimed/s", "puts/s", "p50_us",
+           "p99_us", "max_us");
+
+    for (int mode = 0; mode <= 2; mode++)
+    {
+        run(mode, ttl_ms, rate, duration_ms, info);
+    }
+
+    for (int i = 0; i < THREAD_NUM; i++)
+    {
+        free(info[i].samples);
+    }
+
+    return 0;
+}
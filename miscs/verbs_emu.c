@@ -0,0 +1,487 @@
+// In-process stand-in for the verbs calls used by rdma.c, linked instead of -libverbs so that a primary and its
+// backups can run as threads of one process without RDMA hardware
+// RDMA WRITEs and READs are copies between the registered regions, which all live in the same address space, and
+// their completions arrive right away, or EMU_DELAY_US later (environment variable) to mimic the wire
+
+#include <errno.h>
+#include <infiniband/verbs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// verbs.h maps these to other symbols
+#undef ibv_query_port
+#undef ibv_reg_mr
+
+struct emu_cq
+{
+    struct ibv_cq cq;
+    pthread_mutex_t mutex;
+    struct ibv_wc *wcs; // Ring of cqe completions
+    int size;
+    int head;
+    int count;
+    char is_armed;
+};
+
+// The fd of the channel is the read end of a pipe that armed CQs write themselves to
+struct emu_channel
+{
+    struct ibv_comp_channel channel;
+    int write_fd;
+};
+
+// Completion on its way when a delay is set
+struct pending
+{
+    struct emu_cq *cq;
+    struct ibv_wc wc;
+    struct timespec due;
+    struct pending *next;
+};
+
+static struct ibv_device device = {.name = "emu0", .dev_name = "emu0"};
+static uint32_t qp_num_next = 1;
+static uint32_t key_next = 100;
+
+static struct pending *pending_head, *pending_tail;
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+static long delay_us;
+static pthread_once_t wire_once = PTHREAD_ONCE_INIT;
+
+static void push_wc(struct emu_cq *cq, const struct ibv_wc *wc);
+static void complete(struct emu_cq *cq, const struct ibv_wc *wc);
+static void wire_init(void);
+static void *wire_routine(void *args);
+static int emu_poll_cq(struct ibv_cq *ibcq, int n, struct ibv_wc *wc);
+static int emu_req_notify_cq(struct ibv_cq *ibcq, int solicited_only);
+static int emu_post_send(struct ibv_qp *qp, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr);
+
+struct ibv_device **ibv_get_device_list(int *num)
+{
+    struct ibv_device **list = calloc(2, sizeof(struct ibv_device *));
+    if (!list)
+    {
+        return NULL;
+    }
+
+    list[0] = &device;
+    if (num)
+    {
+        *num = 1;
+    }
+
+    return list;
+}
+
+void ibv_free_device_list(struct ibv_device **list)
+{
+    free(list);
+}
+
+const char *ibv_get_device_name(struct ibv_device *device)
+{
+    return device->name;
+}
+
+struct ibv_context *ibv_open_device(struct ibv_device *device)
+{
+    struct ibv_context *ctx = calloc(1, sizeof(struct ibv_context));
+    if (!ctx)
+    {
+        return NULL;
+    }
+
+    ctx->device = device;
+    ctx->ops.poll_cq = emu_poll_cq;
+    ctx->ops.req_notify_cq = emu_req_notify_cq;
+    ctx->ops.post_send = emu_post_send;
+    ctx->num_comp_vectors = 1;
+
+    return ctx;
+}
+
+int ibv_close_device(struct ibv_context *ctx)
+{
+    free(ctx);
+    return 0;
+}
+
+int ibv_query_port(struct ibv_context *ctx, uint8_t port, struct _compat_ibv_port_attr *attr)
+{
+    struct ibv_port_attr *port_attr = (struct ibv_port_attr *)attr;
+
+    port_attr->state = IBV_PORT_ACTIVE;
+    port_attr->lid = 1;
+    port_attr->link_layer = IBV_LINK_LAYER_INFINIBAND;
+    port_attr->active_mtu = IBV_MTU_4096;
+
+    return 0;
+}
+
+struct ibv_pd *ibv_alloc_pd(struct ibv_context *ctx)
+{
+    struct ibv_pd *pd = calloc(1, sizeof(struct ibv_pd));
+    if (!pd)
+    {
+        return NULL;
+    }
+
+    pd->context = ctx;
+
+    return pd;
+}
+
+int ibv_dealloc_pd(struct ibv_pd *pd)
+{
+    free(pd);
+    return 0;
+}
+
+struct ibv_mr *ibv_reg_mr(struct ibv_pd *pd, void *addr, size_t length, int access)
+{
+    struct ibv_mr *mr = calloc(1, sizeof(struct ibv_mr));
+    if (!mr)
+    {
+        return NULL;
+    }
+
+    mr->context = pd->context;
+    mr->pd = pd;
+    mr->addr = addr;
+    mr->length = length;
+    mr->lkey = mr->rkey = __atomic_fetch_add(&key_next, 1, __ATOMIC_RELAXED);
+
+    return mr;
+}
+
+struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length, uint64_t iova, unsigned int access)
+{
+    return ibv_reg_mr(pd, addr, length, access);
+}
+
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+    free(mr);
+    return 0;
+}
+
+struct ibv_comp_channel *ibv_create_comp_channel(struct ibv_context *ctx)
+{
+    struct emu_channel *channel = calloc(1, sizeof(struct emu_channel));
+    if (!channel)
+    {
+        return NULL;
+    }
+
+    int fds[2];
+    if (pipe(fds) == -1)
+    {
+        free(channel);
+        return NULL;
+    }
+
+    channel->channel.context = ctx;
+    channel->channel.fd = fds[0];
+    channel->write_fd = fds[1];
+
+    return &channel->channel;
+}
+
+int ibv_destroy_comp_channel(struct ibv_comp_channel *channel)
+{
+    close(channel->fd);
+    close(((struct emu_channel *)channel)->write_fd);
+    free(channel);
+
+    return 0;
+}
+
+struct ibv_cq *ibv_create_cq(struct ibv_context *ctx, int cqe, void *cq_context, struct ibv_comp_channel *channel,
+                             int comp_vector)
+{
+    struct emu_cq *cq = calloc(1, sizeof(struct emu_cq));
+    if (!cq)
+    {
+        return NULL;
+    }
+
+    cq->wcs = calloc(cqe, sizeof(struct ibv_wc));
+    if (!cq->wcs)
+    {
+        free(cq);
+        return NULL;
+    }
+
+    cq->cq.context = ctx;
+    cq->cq.channel = channel;
+    cq->cq.cq_context = cq_context;
+    cq->cq.cqe = cqe;
+    cq->size = cqe;
+    pthread_mutex_init(&cq->mutex, NULL);
+
+    return &cq->cq;
+}
+
+int ibv_destroy_cq(struct ibv_cq *ibcq)
+{
+    struct emu_cq *cq = (struct emu_cq *)ibcq;
+
+    pthread_mutex_destroy(&cq->mutex);
+    free(cq->wcs);
+    free(cq);
+
+    return 0;
+}
+
+int ibv_get_cq_event(struct ibv_comp_channel *channel, struct ibv_cq **cq, void **cq_context)
+{
+    struct ibv_cq *ibcq;
+    if (read(channel->fd, &ibcq, sizeof(ibcq)) != sizeof(ibcq))
+    {
+        return -1;
+    }
+
+    *cq = ibcq;
+    *cq_context = ibcq->cq_context;
+
+    return 0;
+}
+
+void ibv_ack_cq_events(struct ibv_cq *cq, unsigned int nevents)
+{
+}
+
+struct ibv_qp *ibv_create_qp(struct ibv_pd *pd, struct ibv_qp_init_attr *attr)
+{
+    struct ibv_qp *qp = calloc(1, sizeof(struct ibv_qp));
+    if (!qp)
+    {
+        return NULL;
+    }
+
+    qp->context = pd->context;
+    qp->pd = pd;
+    qp->send_cq = attr->send_cq;
+    qp->recv_cq = attr->recv_cq;
+    qp->qp_type = attr->qp_type;
+    qp->qp_num = __atomic_fetch_add(&qp_num_next, 1, __ATOMIC_RELAXED);
+    qp->state = IBV_QPS_RESET;
+
+    return qp;
+}
+
+int ibv_modify_qp(struct ibv_qp *qp, struct ibv_qp_attr *attr, int attr_mask)
+{
+    if (attr_mask & IBV_QP_STATE)
+    {
+        qp->state = attr->qp_state;
+    }
+
+    return 0;
+}
+
+int ibv_destroy_qp(struct ibv_qp *qp)
+{
+    free(qp);
+    return 0;
+}
+
+const char *ibv_wc_status_str(enum ibv_wc_status status)
+{
+    return status == IBV_WC_SUCCESS ? "success" : "error";
+}
+
+int ibv_fork_init(void)
+{
+    return 0;
+}
+
+enum ibv_fork_status ibv_is_fork_initialized(void)
+{
+    return IBV_FORK_UNNEEDED;
+}
+
+static int emu_post_send(struct ibv_qp *qp, struct ibv_send_wr *wr, struct ibv_send_wr **bad_wr)
+{
+    for (; wr; wr = wr->next)
+    {
+        char *remote = (char *)wr->wr.rdma.remote_addr;
+        size_t len = 0;
+
+        for (int i = 0; i < wr->num_sge; i++)
+        {
+            if (wr->opcode == IBV_WR_RDMA_WRITE)
+            {
+                memcpy(remote + len, (void *)wr->sg_list[i].addr, wr->sg_list[i].length);
+            }
+            else if (wr->opcode == IBV_WR_RDMA_READ)
+            {
+                memcpy((void *)wr->sg_list[i].addr, remote + len, wr->sg_list[i].length);
+            }
+            len += wr->sg_list[i].length;
+        }
+
+        if (wr->send_flags & IBV_SEND_SIGNALED)
+        {
+            struct ibv_wc wc = {
+                .wr_id = wr->wr_id,
+                .status = IBV_WC_SUCCESS,
+                .opcode = wr->opcode == IBV_WR_RDMA_READ ? IBV_WC_RDMA_READ : IBV_WC_RDMA_WRITE,
+                .byte_len = len,
+                .qp_num = qp->qp_num};
+            complete((struct emu_cq *)qp->send_cq, &wc);
+        }
+    }
+
+    return 0;
+}
+
+static int emu_poll_cq(struct ibv_cq *ibcq, int n, struct ibv_wc *wc)
+{
+    struct emu_cq *cq = (struct emu_cq *)ibcq;
+    int i = 0;
+
+    pthread_mutex_lock(&cq->mutex);
+    for (; i < n && cq->count > 0; i++)
+    {
+        wc[i] = cq->wcs[cq->head];
+        cq->head = (cq->head + 1) % cq->size;
+        cq->count--;
+    }
+    pthread_mutex_unlock(&cq->mutex);
+
+    return i;
+}
+
+static int emu_req_notify_cq(struct ibv_cq *ibcq, int solicited_only)
+{
+    struct emu_cq *cq = (struct emu_cq *)ibcq;
+
+    pthread_mutex_lock(&cq->mutex);
+    cq->is_armed = 1;
+    pthread_mutex_unlock(&cq->mutex);
+
+    return 0;
+}
+
+// An armed CQ gets one event for its next completion
+static void push_wc(struct emu_cq *cq, const struct ibv_wc *wc)
+{
+    pthread_mutex_lock(&cq->mutex);
+    if (cq->count < cq->size)
+    {
+        cq->wcs[(cq->head + cq->count) % cq->size] = *wc;
+        cq->count++;
+    }
+    char is_armed = cq->is_armed;
+    cq->is_armed = 0;
+    pthread_mutex_unlock(&cq->mutex);
+
+    if (is_armed && cq->cq.channel)
+    {
+        struct ibv_cq *ibcq = &cq->cq;
+        if (write(((struct emu_channel *)cq->cq.channel)->write_fd, &ibcq, sizeof(ibcq)) != sizeof(ibcq))
+        {
+            perror("write");
+        }
+    }
+}
+
+static void complete(struct emu_cq *cq, const struct ibv_wc *wc)
+{
+    pthread_once(&wire_once, wire_init);
+
+    if (delay_us <= 0)
+    {
+        push_wc(cq, wc);
+        return;
+    }
+
+    struct pending *p = calloc(1, sizeof(struct pending));
+    if (!p)
+    {
+        perror("calloc for pending");
+        push_wc(cq, wc);
+        return;
+    }
+
+    p->cq = cq;
+    p->wc = *wc;
+    clock_gettime(CLOCK_MONOTONIC, &p->due);
+    p->due.tv_nsec += delay_us * 1000;
+    p->due.tv_sec += p->due.tv_nsec / 1000000000;
+    p->due.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&pending_mutex);
+    if (pending_tail)
+    {
+        pending_tail->next = p;
+    }
+    else
+    {
+        pending_head = p;
+    }
+    pending_tail = p;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&pending_mutex);
+}
+
+static void wire_init(void)
+{
+    char *delay = getenv("EMU_DELAY_US");
+    delay_us = delay ? atol(delay) : 0;
+
+    if (delay_us > 0)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, wire_routine, NULL) != 0)
+        {
+            perror("pthread_create");
+            delay_us = 0;
+            return;
+        }
+        pthread_detach(tid);
+    }
+}
+
+// Completions all take the same delay, so they are delivered in order
+static void *wire_routine(void *args)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&pending_mutex);
+        while (!pending_head)
+        {
+            pthread_cond_wait(&pending_cond, &pending_mutex);
+        }
+        struct pending *p = pending_head;
+        pthread_mutex_unlock(&pending_mutex);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long wait = (p->due.tv_sec - now.tv_sec) * 1000000000 + p->due.tv_nsec - now.tv_nsec;
+        if (wait > 0)
+        {
+            struct timespec ts = {wait / 1000000000, wait % 1000000000};
+            nanosleep(&ts, NULL);
+        }
+
+        pthread_mutex_lock(&pending_mutex);
+        pending_head = p->next;
+        if (!pending_head)
+        {
+            pending_tail = NULL;
+        }
+        pthread_mutex_unlock(&pending_mutex);
+
+        push_wc(p->cq, &p->wc);
+        free(p);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,153 @@
+// PUT throughput with the write-ahead log off and on, for several group commit windows
+// Usage: wal_bench [log_path]
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "ht.h"
+#include "lock.h"
+#include "wal.h"
+
+#define DURATION_MS 500
+#define MAX_THREAD 32
+
+struct bench_info
+{
+    struct ht *ht;
+    struct lock_table *locks;
+    struct wal *wal;
+    atomic_int *stop;
+    unsigned short state[3];
+    long ops;
+};
+
+void *bench_routine(void *args)
+{
+    struct bench_info *info = args;
+    long ops = 0;
+
+    // The same steps as a PUT in handle_client, without the network and replication
+    while (!atomic_load_explicit(info->stop, memory_order_relaxed))
+    {
+        ht_key_t key = nrand48(info->state) % (HT_KEY_MAX - HT_KEY_MIN + 1) + HT_KEY_MIN;
+        ht_value_t value = nrand48(info->state);
+
+        lock_wrlock(info->locks, key);
+        if (ht_put(info->ht, key, value, NULL, NULL, NULL) != HT_CODE_SUCCESS ||
+            (info->wal && wal_append(info->wal, WAL_CODE_PUT, key, value, 0) == -1))
+        {
+            fprintf(stderr, "put failed\n");
+            exit(EXIT_FAILURE);
+        }
+        lock_unlock(info->locks, key);
+
+        ops++;
+    }
+
+    info->ops = ops;
+    return NULL;
+}
+
+double run(const char *path, int batch_us, int thread_num, double *batch)
+{
+    struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, HT_HASH, NULL, NULL);
+    struct lock_table *locks = lock_create(LOCK_STRIPE_NUM, LOCK_KIND);
+    struct wal *wal = NULL;
+
+    if (!ht || !locks)
+    {
+        fprintf(stderr, "setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A negative window means no log at all
+    if (batch_us >= 0)
+    {
+        unlink(path);
+        wal = wal_open(path, batch_us);
+        if (!wal)
+        {
+            fprintf(stderr, "wal_open failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_t tids[MAX_THREAD];
+    struct bench_info info[MAX_THREAD];
+    atomic_int stop = 0;
+
+    for (int i = 0; i < thread_num; i++)
+    {
+        info[i].ht = ht;
+        info[i].locks = locks;
+        info[i].wal = wal;
+        info[i].stop = &stop;
+        info[i].state[0] = i;
+        info[i].state[1] = i * 7 + 1;
+        info[i].state[2] = i * 13 + 2;
+        pthread_create(&tids[i], NULL, bench_routine, &info[i]);
+    }
+
+    usleep(DURATION_MS * 1000);
+    atomic_store(&stop, 1);
+
+    long ops = 0;
+    for (int i = 0; i < thread_num; i++)
+    {
+        pthread_join(tids[i], NULL);
+        ops += info[i].ops;
+    }
+
+    *batch = 0;
+    if (wal)
+    {
+        unsigned long records, syncs;
+        wal_stats(wal, &records, &syncs);
+        *batch = syncs ? (double)records / syncs : 0;
+        wal_close(wal);
+        unlink(path);
+    }
+
+    lock_destroy(locks);
+    ht_destroy(ht);
+
+    return ops / (DURATION_MS / 1000.0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "wal_bench.log";
+
+    int batch_uss[] = {-1, 0, 50, 200, 1000};
+    int thread_nums[] = {1, 4, 16, 32};
+
+    printf("log %s stripes %d\n", path, LOCK_STRIPE_NUM);
+    printf("%-8s %8s %12s %14s\n", "window", "threads", "puts/s", "records/sync");
+
+    for (int i = 0; i < sizeof(batch_uss) / sizeof(*batch_uss); i++)
+    {
+        for (int j = 0; j < sizeof(thread_nums) / sizeof(*thread_nums); j++)
+        {
+            double batch;
+            double puts = run(path, batch_uss[i], thread_nums[j], &batch);
+
+            char window[16];
+            if (batch_uss[i] < 0)
+            {
+                snprintf(window, sizeof(window), "off");
+            }
+            else
+            {
+                snprintf(window, sizeof(window), "%dus", batch_uss[i]);
+            }
+
+            printf("%-8s %8d %12.0f %14.1f\n", window, thread_nums[j], puts, batch);
+        }
+    }
+
+    return 0;
+}
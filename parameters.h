@@ -7,14 +7,36 @@
 // Turn on logging
 // #define LOG
 
+// Time the phases of requests on servers
+// #define TRACE
+
+// One request in TRACE_SAMPLE is kept for dumping, in a ring of TRACE_RING_SIZE per server thread
+#define TRACE_SAMPLE 64
+#define TRACE_RING_SIZE 4096
+
+// One access in HEAT_SAMPLE is counted per bucket and in a space-saving summary of HEAT_CAPACITY keys per server
+// thread, of which the HEAT_TOP_K hottest are shown
+#define HEAT_SAMPLE 16
+#define HEAT_CAPACITY 64
+#define HEAT_TOP_K 10
+
+// Captured requests are written out by CAPTURE_BATCH, or with the first one coming CAPTURE_FLUSH_MS after a write
+#define CAPTURE_BATCH 256
+#define CAPTURE_FLUSH_MS 100
+
 // Number of hashtable buckets
 #define BUCKET_NUM 32
 
 // Number of total elemnts in the hashtable
 #define ELEMENT_NUM 1000
 
+// Hash of keys to buckets (HT_HASH_MODULO, HT_HASH_MULTIPLY_SHIFT or HT_HASH_MIX), the same on all servers
+#define HT_HASH HT_HASH_MODULO
+
 // Size of hashtable element unused space (to test how the size affect the RDMA throughput and latency)
+#ifndef CHUNK
 #define CHUNK 1
+#endif
 
 // Number of thread for clients
 #define CLIENT_THREAD 1
@@ -22,12 +44,96 @@
 // Number of thread for servers
 #define SERVER_THREAD 1
 
+// Number of lock stripes protecting keys on servers (power of two, independent of the key space)
+#define LOCK_STRIPE_NUM 64
+
+// Lock used for each stripe (LOCK_KIND_RWLOCK or LOCK_KIND_TICKET)
+#define LOCK_KIND LOCK_KIND_RWLOCK
+
+// Replicate PUTs through one dedicated thread instead of from every server thread
+// #define REPL_THREAD
+
+// Number of empty CQ polls before sleeping on the completion channel (-1 to always busy poll)
+#ifndef CQ_POLL_BUDGET
+#define CQ_POLL_BUDGET 4096
+#endif
+
+// Maximum number of dirty copy passes while PUTs keep flowing, before pausing them for a backup joining late
+#define CATCH_UP_PASS_MAX 8
+
+// Dirty bytes left by a pass that are small enough to be copied with PUTs paused
+#define CATCH_UP_PAUSE_BYTES (64 * 1024)
+
+// Microseconds a WAL flush waits for concurrent PUTs to join its fdatasync (0 to flush right away)
+#define WAL_BATCH_US 100
+
+// Number of threads bulk loading the hashtable at startup
+#define PRELOAD_THREAD 4
+
+// Evict keys with the CLOCK policy instead of failing PUTs when the hashtable is full
+// #define EVICTION
+
+// Maximum number of eviction attempts for one PUT
+#define EVICT_TRY_MAX 8
+
+// Maximum number of keys in a transaction, at most RDMA_BATCH_MAX / 4 so that it fits in one batch of writes
+#define TXN_KEY_MAX 16
+
+// Maximum number of times a GET on a backup retries a bucket while a transaction is being replicated to it
+#define TXN_READ_RETRY_MAX 1024
+
+// Interval of the primary sweeping expired keys, in ms
+#define SWEEP_INTERVAL_MS 10
+
+// Number of buckets swept per interval, which bounds how long one sweep holds up PUTs
+#define SWEEP_BUCKET_NUM 4
+
+// Longest chain counted on its own in statistics, longer chains being counted with it
+#define STATS_CHAIN_MAX 64
+
 // Total number of tests from client
 #define TEST_NUM 50000
 
 // Percentage of put operation from client
 #define PUT_PERCENT 5
 
+// Time-to-live of keys put by client in ms, 0 for never expiring
+#define PUT_TTL_MS 0
+
+// Percentage of delete operation from client
+#define DEL_PERCENT 0
+
+// Percentage of increment operation from client
+#define INCR_PERCENT 0
+
+// Percentage of transaction operation from client, each putting TXN_CLIENT_KEY_NUM consecutive keys
+#define TXN_PERCENT 0
+
+// Number of keys in a transaction from client, at most TXN_KEY_MAX
+#define TXN_CLIENT_KEY_NUM 4
+
+// Number of keys loaded by client before running a YCSB workload, later inserts go on from there
+#define YCSB_RECORD_NUM 128
+
+// Maximum number of keys read by a YCSB scan
+#define YCSB_SCAN_MAX 10
+
+// Skewness of the zipfian and latest key distributions
+#define ZIPF_THETA 0.99
+
+// Percentage of keys getting HOTSPOT_OP_PERCENT of the operations with the hotspot key distribution
+#define HOTSPOT_KEY_PERCENT 20
+#define HOTSPOT_OP_PERCENT 80
+
+// Number of client threads offering load in open loop, each with its own share of the rate
+#define OPEN_LOOP_THREAD 32
+
+// Duration of an open loop run or of each step of a sweep
+#define OPEN_LOOP_MS 2000
+
+// A sweep step is saturated when less than this percentage of the offered load gets served
+#define SATURATION_PERCENT 95
+
 // Number of operations to calculate average statistics
 #define STATISTICS_CYCLE 1000
 
@@ -18,6 +18,7 @@ struct pool
     unsigned size;
     pthread_t *ids;
     struct pool_task *head;
+    unsigned queued; // Tasks waiting for a thread
     pthread_mutex_t lock;
     pthread_cond_t cond;
 };
@@ -52,6 +53,7 @@ static void *handler(void *args)
 
         task = pool->head;
         pool->head = pool->head->next;
+        pool->queued--;
 
         pthread_mutex_unlock(&pool->lock);
 
@@ -79,6 +81,7 @@ pool_t pool_init(unsigned size)
     if (pool->ids == NULL)
         goto error;
     pool->head = NULL;
+    pool->queued = 0;
     if (pthread_mutex_init(&(pool->lock), NULL) != 0)
         goto error;
     if (pthread_cond_init(&(pool->cond), NULL) != 0)
@@ -173,6 +176,7 @@ int pool_add(pool_t pool, void *(*routine)(void *), void *args)
         tmp->next = cur;
     }
     tmp = NULL;
+    pool->queued++;
 
     pthread_cond_signal(&pool->cond);
     pthread_mutex_unlock(&pool->lock);
@@ -185,4 +189,13 @@ error:
     else
         perror("pool_add");
     return -1;
-}
\ No newline at end of file
+}
+
+unsigned pool_queued(pool_t pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    unsigned queued = pool->queued;
+    pthread_mutex_unlock(&pool->lock);
+
+    return queued;
+}
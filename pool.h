@@ -37,4 +37,12 @@ void pool_free(pool_t pool);
  */
 int pool_add(pool_t pool, void *(*routine)(void *), void *args);
 
+/**
+ * @brief Get the number of tasks waiting for a free thread.
+ *
+ * @param pool thread pool
+ * @return number of tasks
+ */
+unsigned pool_queued(pool_t pool);
+
 #endif
\ No newline at end of file
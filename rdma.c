@@ -1,5 +1,9 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <infiniband/verbs.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,7 +16,12 @@
 #include "sokt.h"
 
 #define COUNT 1
-#define IB_PORT 1
+#define IB_PORT 1 // Default port when none is given
+#define MAX_SEND_WR (RDMA_BATCH_MAX * 4) // Room for a few chains in flight when QPs are shared
+#define SLEEP_TIMEOUT_MS 1                 // Bound on a sleep, in case another thread took the event of a shared CQ
+#define CONNECT_RETRY_NUM 100              // Backups keep trying to reach a primary that is not up yet
+#define CONNECT_RETRY_INTERVAL_MS 100
+#define DIRTY_BITS (8 * sizeof(unsigned long)) // Grains per word of the dirty bitmap
 
 struct QP_info
 {
@@ -24,32 +33,114 @@ struct QP_info
     uint32_t rkey;
 };
 
-int connect_with_backup(struct rdma_context *ctx, int sockfd, int index);
+// State of the connection to each server
+enum slot_state
+{
+    SLOT_EMPTY,       // Not connected, or dropped after a failure
+    SLOT_CATCHING_UP, // Connected and getting the hashtable region, but not written by PUTs yet
+    SLOT_LIVE         // Connected and up to date
+};
+
+#define CACHE_LINE 64
+
+// Threads posting writes count in slots of their own, so that workers, the sweeper and the replication thread do not
+// share cache lines, and the slots are summed when read
+#define STATS_SLOT_NUM (SERVER_THREAD + 2)
+
+// Counters of the connection to each server, one copy per slot
+struct conn_stats
+{
+    atomic_ulong writes;
+    atomic_ulong bytes;
+    atomic_ulong polls; // Empty CQ polls while waiting for completions
+    atomic_ulong sleeps;
+} __attribute__((aligned(CACHE_LINE)));
+
+static atomic_uint slot_count;
+static _Thread_local int slot = -1;
+
+struct handshake_info
+{
+    struct rdma_context *ctx;
+    int connfd;
+    int index;
+    int rv;
+    pthread_t tid;
+};
+
+int connect_with_backups(struct rdma_context *ctx, int sockfd, int others_num);
+void *handshake_with_backup(void *info);
+int connect_with_backup(struct rdma_context *ctx, int connfd, int index);
 int connect_with_primary(struct rdma_context *ctx, struct sokt_name_info **others);
 int connect_between_qps(struct rdma_context *ctx, int index);
-
-struct rdma_context
+int sleep_on_cq(const struct rdma_context *ctx, int index, struct ibv_wc *wc);
+int post_chain(const struct rdma_context *ctx, int index, const long *offsets, const size_t *sizes, int n);
+int wait_completion(const struct rdma_context *ctx, int index);
+void mark_dirty(const struct rdma_context *ctx, const long *offsets, const size_t *sizes, int n);
+int reset_qp(struct rdma_context *ctx, int index);
+double lap_ms(struct timespec *last);
+struct conn_stats *stats_slot(const struct rdma_context *ctx, int index);
+
+// An opened device port, with the hashtable registered on it
+struct rdma_device
 {
     struct ibv_context *ctx;
     struct ibv_pd *pd;
     struct ibv_mr *mr;
+    int port;
+    char name[IBV_SYSFS_NAME_MAX];
+
+    atomic_ulong writes; // WRs posted through the port
+    atomic_ulong bytes;  // Bytes written through the port
+};
+
+struct rdma_context
+{
+    int device_num;
+    struct rdma_device *devices;
+    int *device_of; // Device used for the QP of each connected server, striped round-robin
+
+    struct ibv_comp_channel **channel; // One per CQ, for sleeping until a completion arrives
     struct ibv_cq **cq;
     struct ibv_qp **qp;
 
     struct QP_info *local_qp_info;
     struct QP_info *remote_qp_info;
+
+    size_t ht_size;
+    atomic_int *state;      // enum slot_state of each connection
+    struct conn_stats *stats;
+    atomic_int is_tracking; // Set while a backup catches up
+    atomic_ulong *dirty;    // Bitmap of RDMA_DIRTY_GRAIN sized pieces written while tracking
+    size_t dirty_len;       // Number of words in the bitmap
 };
 
-struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, struct sokt_name_info **others, int others_num, void *ht_addr, size_t ht_size)
+struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, struct sokt_name_info **others, int others_num,
+                                          int wait_num, const struct rdma_port *ports, int port_num, void *ht_addr, size_t ht_size)
 {
     assert(self_sockfd != -1);
     assert(others_num >= 0);
+    assert(0 <= wait_num && wait_num <= others_num);
+    assert(port_num >= 0);
+    assert(ports || port_num == 0);
     assert(ht_addr);
     assert(ht_size);
 
     srand48(getpid() * time(NULL));
-    struct rdma_context *ctx;
-    struct ibv_device **dev_list, *ib_dev;
+    struct rdma_context *ctx = NULL;
+    struct ibv_device **dev_list;
+    struct rdma_port default_port = {.dev_name = NULL, .port = IB_PORT};
+
+    if (port_num == 0)
+    {
+        ports = &default_port;
+        port_num = 1;
+    }
+
+    // Startup timing breakdown
+    struct timespec last;
+    double device_ms, mr_ms, qp_ms, handshake_ms;
+    clock_gettime(CLOCK_MONOTONIC, &last);
 
     dev_list = ibv_get_device_list(NULL);
     if (!dev_list)
@@ -57,12 +148,6 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         perror("ibv_get_device_list");
         goto out1;
     }
-    ib_dev = *dev_list;
-    if (!ib_dev)
-    {
-        fprintf(stderr, "failed to find IB device\n");
-        goto out2;
-    }
 
     ctx = calloc(1, sizeof(struct rdma_context));
     if (!ctx)
@@ -71,27 +156,104 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         goto out2;
     }
 
-    ctx->ctx = ibv_open_device(ib_dev);
-    if (!ctx->ctx)
+    ctx->devices = calloc(port_num, sizeof(struct rdma_device));
+    if (!ctx->devices)
     {
-        perror("ibv_open_device");
+        perror("calloc for ctx->devices");
         goto out3;
     }
+    ctx->device_num = port_num;
 
-    ctx->pd = ibv_alloc_pd(ctx->ctx);
-    if (!ctx->pd)
+    for (int d = 0; d < port_num; d++)
     {
-        perror("ibv_alloc_pd");
+        struct ibv_device *ib_dev = NULL;
+        for (struct ibv_device **dev = dev_list; *dev; dev++)
+        {
+            if (!ports[d].dev_name || strcmp(ibv_get_device_name(*dev), ports[d].dev_name) == 0)
+            {
+                ib_dev = *dev;
+                break;
+            }
+        }
+        if (!ib_dev)
+        {
+            fprintf(stderr, "failed to find IB device %s\n", ports[d].dev_name ? ports[d].dev_name : "");
+            goto out3;
+        }
+
+        struct rdma_device *device = ctx->devices + d;
+        snprintf(device->name, sizeof(device->name), "%s", ibv_get_device_name(ib_dev));
+        device->port = ports[d].port;
+        atomic_init(&device->writes, 0);
+        atomic_init(&device->bytes, 0);
+
+        device->ctx = ibv_open_device(ib_dev);
+        if (!device->ctx)
+        {
+            perror("ibv_open_device");
+            goto out3;
+        }
+
+        device->pd = ibv_alloc_pd(device->ctx);
+        if (!device->pd)
+        {
+            perror("ibv_alloc_pd");
+            goto out3;
+        }
+    }
+
+    device_ms = lap_ms(&last);
+
+    for (int d = 0; d < port_num; d++)
+    {
+        struct rdma_device *device = ctx->devices + d;
+
+        device->mr = ibv_reg_mr(device->pd, ht_addr, ht_size,
+                                IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE);
+        if (!device->mr)
+        {
+            perror("ibv_reg_mr");
+            goto out3;
+        }
+    }
+
+    mr_ms = lap_ms(&last);
+
+    ctx->device_of = calloc(others_num, sizeof(int));
+    if (!ctx->device_of)
+    {
+        perror("calloc for ctx->device_of");
         goto out3;
     }
+    for (int i = 0; i < others_num; i++)
+    {
+        ctx->device_of[i] = i % port_num;
+        printf("connection %d\t%s port %d\n", i, ctx->devices[ctx->device_of[i]].name, ctx->devices[ctx->device_of[i]].port);
+    }
 
-    ctx->mr = ibv_reg_mr(ctx->pd, ht_addr, ht_size,
-                         IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE);
-    if (!ctx->mr)
+    ctx->channel = calloc(others_num, sizeof(struct ibv_comp_channel *));
+    if (!ctx->channel)
     {
-        perror("ibv_reg_mr");
+        perror("calloc for ctx->channel");
         goto out3;
     }
+    for (int i = 0; i < others_num; i++)
+    {
+        ctx->channel[i] = ibv_create_comp_channel(ctx->devices[ctx->device_of[i]].ctx);
+        if (!ctx->channel[i])
+        {
+            perror("ibv_create_comp_channel");
+            goto out3;
+        }
+
+        // Sleeps are bounded by poll() rather than by a blocking read
+        int flags = fcntl(ctx->channel[i]->fd, F_GETFL);
+        if (flags == -1 || fcntl(ctx->channel[i]->fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        {
+            perror("fcntl");
+            goto out3;
+        }
+    }
 
     ctx->cq = calloc(others_num, sizeof(struct ibv_cq *));
     if (!ctx->cq)
@@ -101,7 +263,7 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
     }
     for (int i = 0; i < others_num; i++)
     {
-        ctx->cq[i] = ibv_create_cq(ctx->ctx, COUNT * others_num * 2, NULL, NULL, 0);
+        ctx->cq[i] = ibv_create_cq(ctx->devices[ctx->device_of[i]].ctx, MAX_SEND_WR + COUNT, NULL, ctx->channel[i], 0);
         if (!ctx->cq[i])
         {
             perror("ibv_create_cq");
@@ -121,7 +283,7 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
             .send_cq = ctx->cq[i],
             .recv_cq = ctx->cq[i],
             .cap = {
-                .max_send_wr = COUNT * others_num,
+                .max_send_wr = MAX_SEND_WR,
                 .max_recv_wr = COUNT,
                 .max_send_sge = 1,
                 .max_recv_sge = 1,
@@ -129,7 +291,7 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
             .qp_type = IBV_QPT_RC,
         };
 
-        ctx->qp[i] = ibv_create_qp(ctx->pd, &qp_init_attr);
+        ctx->qp[i] = ibv_create_qp(ctx->devices[ctx->device_of[i]].pd, &qp_init_attr);
         if (!ctx->qp[i])
         {
             perror("ibv_create_qp");
@@ -139,7 +301,7 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         struct ibv_qp_attr qp_attr = {
             .qp_state = IBV_QPS_INIT,
             .pkey_index = 0,
-            .port_num = IB_PORT,
+            .port_num = ctx->devices[ctx->device_of[i]].port,
             .qp_access_flags = IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE,
         };
         int init_flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
@@ -159,15 +321,17 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         goto out3;
     }
 
-    struct ibv_port_attr port_attr;
-    if (ibv_query_port(ctx->ctx, IB_PORT, &port_attr))
-    {
-        perror("ibv_query_port");
-        goto out3;
-    }
-
     for (int i = 0; i < others_num; i++)
     {
+        struct rdma_device *device = ctx->devices + ctx->device_of[i];
+
+        struct ibv_port_attr port_attr;
+        if (ibv_query_port(device->ctx, device->port, &port_attr))
+        {
+            perror("ibv_query_port");
+            goto out3;
+        }
+
         ctx->local_qp_info[i].lid = port_attr.lid;
         if (port_attr.link_layer == IBV_LINK_LAYER_INFINIBAND && !ctx->local_qp_info[i].lid)
         {
@@ -177,7 +341,7 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         ctx->local_qp_info[i].qpn = ctx->qp[i]->qp_num;
         ctx->local_qp_info[i].psn = lrand48() & 0xffffff;
         ctx->local_qp_info[i].addr = (uint64_t)ht_addr;
-        ctx->local_qp_info[i].rkey = ctx->mr->rkey;
+        ctx->local_qp_info[i].rkey = device->mr->rkey;
     }
 
     ctx->remote_qp_info = calloc(others_num, sizeof(struct QP_info));
@@ -187,15 +351,39 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         goto out3;
     }
 
+    // Connections start empty and become live after the handshake
+    ctx->state = calloc(others_num, sizeof(atomic_int));
+    if (!ctx->state)
+    {
+        perror("calloc for ctx->state");
+        goto out3;
+    }
+
+    ctx->stats = aligned_alloc(CACHE_LINE, others_num * STATS_SLOT_NUM * sizeof(struct conn_stats));
+    if (!ctx->stats)
+    {
+        perror("aligned_alloc for ctx->stats");
+        goto out3;
+    }
+    memset(ctx->stats, 0, others_num * STATS_SLOT_NUM * sizeof(struct conn_stats));
+
+    ctx->ht_size = ht_size;
+    ctx->dirty_len = (ht_size / RDMA_DIRTY_GRAIN + DIRTY_BITS) / DIRTY_BITS;
+    ctx->dirty = calloc(ctx->dirty_len, sizeof(atomic_ulong));
+    if (!ctx->dirty)
+    {
+        perror("calloc for ctx->dirty");
+        goto out3;
+    }
+
+    qp_ms = lap_ms(&last);
+
     if (is_primary == 1)
     {
-        for (int i = 0; i < others_num; i++)
+        if (connect_with_backups(ctx, self_sockfd, wait_num))
         {
-            if (connect_with_backup(ctx, self_sockfd, i))
-            {
-                fprintf(stderr, "failed to connect with backups %d and modify QP to RTS\n", i);
-                goto out3;
-            }
+            fprintf(stderr, "failed to connect with backups and modify QPs to RTS\n");
+            goto out3;
         }
     }
     else
@@ -207,6 +395,10 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
         }
     }
 
+    handshake_ms = lap_ms(&last);
+    printf("rdma setup\tdevice %.3f ms, mr %.3f ms, qp %.3f ms, handshake %.3f ms\n",
+           device_ms, mr_ms, qp_ms, handshake_ms);
+
     goto out2;
 
 out3:
@@ -227,6 +419,21 @@ void rdma_close_connection(struct rdma_context *ctx, int others_num)
         return;
     }
 
+    if (ctx->dirty)
+    {
+        free(ctx->dirty);
+    }
+
+    if (ctx->stats)
+    {
+        free(ctx->stats);
+    }
+
+    if (ctx->state)
+    {
+        free(ctx->state);
+    }
+
     if (ctx->remote_qp_info)
     {
         free(ctx->remote_qp_info);
@@ -263,19 +470,47 @@ void rdma_close_connection(struct rdma_context *ctx, int others_num)
         free(ctx->cq);
     }
 
-    if (ctx->mr)
+    if (ctx->channel)
     {
-        ibv_dereg_mr(ctx->mr);
+        for (int i = 0; i < others_num; i++)
+        {
+            if (ctx->channel[i])
+            {
+                ibv_destroy_comp_channel(ctx->channel[i]);
+            }
+        }
+
+        free(ctx->channel);
     }
 
-    if (ctx->pd)
+    if (ctx->device_of)
     {
-        ibv_dealloc_pd(ctx->pd);
+        free(ctx->device_of);
     }
 
-    if (ctx->ctx)
+    if (ctx->devices)
     {
-        ibv_close_device(ctx->ctx);
+        for (int d = 0; d < ctx->device_num; d++)
+        {
+            struct rdma_device *device = ctx->devices + d;
+
+            if (device->mr)
+            {
+                ibv_dereg_mr(device->mr);
+            }
+
+            if (device->pd)
+            {
+                ibv_dealloc_pd(device->pd);
+            }
+
+            if (device->ctx)
+            {
+                ibv_close_device(device->ctx);
+            }
+        }
+
+        free(ctx->devices);
     }
 
     free(ctx);
@@ -283,106 +518,642 @@ void rdma_close_connection(struct rdma_context *ctx, int others_num)
 
 int rdma_wrtie_all(const struct rdma_context *ctx, long offset, size_t size, int others_num)
 {
-    struct ibv_sge list = {
-        .addr = ctx->local_qp_info[0].addr + offset, // ctx->local_qp_info[i].addr are the same
-        .length = size,
-        .lkey = ctx->mr->lkey};
+    return rdma_write_batch_all(ctx, &offset, &size, 1, others_num);
+}
 
-#ifdef LOG
-    printf("local_addr    :\t%ld offset: %-8ld local_real_addr : %ld\n", ctx->local_qp_info[0].addr, offset, list.addr);
-#endif
+int rdma_write_batch_all(const struct rdma_context *ctx, const long *offsets, const size_t *sizes, int n, int others_num)
+{
+    assert(0 < n && n <= RDMA_BATCH_MAX);
+
+    int rv = 0;
 
-    struct ibv_send_wr *wr = calloc(others_num, sizeof(struct ibv_send_wr));
-    if (!wr)
+    // A backup catching up gets these ranges from rdma_copy_dirty() instead
+    if (atomic_load_explicit(&ctx->is_tracking, memory_order_acquire))
     {
-        perror("calloc for wr");
-        return -1;
+        mark_dirty(ctx, offsets, sizes, n);
     }
 
     for (int i = 0; i < others_num; i++)
     {
-        struct ibv_send_wr *bad_wr;
-        wr[i].sg_list = &list;
-        wr[i].num_sge = 1;
-        wr[i].opcode = IBV_WR_RDMA_WRITE;
-        wr[i].send_flags = IBV_SEND_SIGNALED;
-        wr[i].wr.rdma.remote_addr = ctx->remote_qp_info[i].addr + offset;
-        wr[i].wr.rdma.rkey = ctx->remote_qp_info[i].rkey;
-        wr[i].next = NULL;
-
-        if (ibv_post_send(ctx->qp[i], &wr[i], &bad_wr) != 0)
+        if (atomic_load_explicit(&ctx->state[i], memory_order_acquire) != SLOT_LIVE)
         {
-            perror("ibv_post_send");
-            return -1;
+            continue;
         }
 
-#ifdef LOG
-        printf("remote_addr %2d:\t%ld offset: %-8ld remote_real_addr: %ld\n",
-               i, ctx->remote_qp_info[i].addr, offset, wr[i].wr.rdma.remote_addr);
-#endif
+        if (post_chain(ctx, i, offsets, sizes, n) == -1)
+        {
+            fprintf(stderr, "dropping connection %d\n", i);
+            atomic_store(&ctx->state[i], SLOT_EMPTY);
+            rv = -1;
+        }
     }
 
-    return 0;
+    return rv;
 }
 
 int rdma_wait_completion_all(const struct rdma_context *ctx, int others_num)
 {
+    int rv = 0;
+
     for (int i = 0; i < others_num; i++)
     {
-        struct ibv_wc wc[COUNT];
-        int n;
+        if (atomic_load_explicit(&ctx->state[i], memory_order_acquire) != SLOT_LIVE)
+        {
+            continue;
+        }
+
+        if (wait_completion(ctx, i) == -1)
+        {
+            fprintf(stderr, "dropping connection %d\n", i);
+            atomic_store(&ctx->state[i], SLOT_EMPTY);
+            rv = -1;
+        }
+    }
+
+    return rv;
+}
+
+int rdma_accept_backup(struct rdma_context *ctx, int connfd, int others_num)
+{
+    assert(ctx);
+    assert(connfd != -1);
+
+    // Dirty tracking serves one backup at a time
+    int is_tracking = 0;
+    if (!atomic_compare_exchange_strong(&ctx->is_tracking, &is_tracking, 1))
+    {
+        fprintf(stderr, "another backup is catching up\n");
+        return -1;
+    }
 
-        do
+    for (size_t w = 0; w < ctx->dirty_len; w++)
+    {
+        atomic_store_explicit(&ctx->dirty[w], 0, memory_order_relaxed);
+    }
+
+    int index = -1;
+    for (int i = 0; i < others_num; i++)
+    {
+        if (atomic_load(&ctx->state[i]) == SLOT_EMPTY)
         {
-            n = ibv_poll_cq(ctx->cq[i], others_num, wc);
+            index = i;
+            break;
+        }
+    }
+    if (index == -1)
+    {
+        fprintf(stderr, "no free connection for a new backup\n");
+        goto out;
+    }
+
+    if (reset_qp(ctx, index) == -1)
+    {
+        fprintf(stderr, "reset_qp failed for QP %d\n", index);
+        goto out;
+    }
+
+    if (connect_with_backup(ctx, connfd, index))
+    {
+        fprintf(stderr, "failed to connect with backup %d and modify QP to RTS\n", index);
+        goto out;
+    }
+
+    atomic_store(&ctx->state[index], SLOT_CATCHING_UP);
+
+    return index;
+
+out:
+    atomic_store(&ctx->is_tracking, 0);
+
+    return -1;
+}
+
+long rdma_copy_region(const struct rdma_context *ctx, int index)
+{
+    assert(ctx);
 
-            if (n < 0)
+    long offsets[RDMA_BATCH_MAX];
+    size_t sizes[RDMA_BATCH_MAX];
+    int n = 0;
+
+    for (size_t offset = 0; offset < ctx->ht_size; offset += RDMA_BULK_CHUNK)
+    {
+        offsets[n] = offset;
+        sizes[n] = ctx->ht_size - offset < RDMA_BULK_CHUNK ? ctx->ht_size - offset : RDMA_BULK_CHUNK;
+        n++;
+
+        if (n == RDMA_BATCH_MAX || offset + sizes[n - 1] == ctx->ht_size)
+        {
+            if (post_chain(ctx, index, offsets, sizes, n) == -1 || wait_completion(ctx, index) == -1)
             {
-                fprintf(stderr, "ibv_poll_cq\n");
                 return -1;
             }
-        } while (n < 1);
 
-        for (int i = 0; i < n; i++)
+            n = 0;
+        }
+    }
+
+    return ctx->ht_size;
+}
+
+long rdma_copy_dirty(const struct rdma_context *ctx, int index)
+{
+    assert(ctx);
+
+    long offsets[RDMA_BATCH_MAX];
+    size_t sizes[RDMA_BATCH_MAX];
+    int n = 0;
+    long copied = 0;
+
+    for (size_t w = 0; w < ctx->dirty_len; w++)
+    {
+        unsigned long bits = atomic_exchange_explicit(&ctx->dirty[w], 0, memory_order_acq_rel);
+
+        while (bits)
         {
-            if (wc[i].status != IBV_WC_SUCCESS)
+            long offset = (w * DIRTY_BITS + __builtin_ctzl(bits)) * RDMA_DIRTY_GRAIN;
+            size_t size = ctx->ht_size - offset < RDMA_DIRTY_GRAIN ? ctx->ht_size - offset : RDMA_DIRTY_GRAIN;
+            bits &= bits - 1;
+
+            // Coalesce neighbouring grains
+            if (n > 0 && offsets[n - 1] + sizes[n - 1] == offset && sizes[n - 1] + size <= RDMA_BULK_CHUNK)
             {
-                fprintf(stderr, "failed ibv_poll_cq status %s\n",
-                        ibv_wc_status_str(wc[i].status));
-                return -1;
+                sizes[n - 1] += size;
+            }
+            else
+            {
+                if (n == RDMA_BATCH_MAX)
+                {
+                    if (post_chain(ctx, index, offsets, sizes, n) == -1 || wait_completion(ctx, index) == -1)
+                    {
+                        return -1;
+                    }
+
+                    n = 0;
+                }
+
+                offsets[n] = offset;
+                sizes[n] = size;
+                n++;
             }
+
+            copied += size;
         }
     }
 
+    if (n > 0 && (post_chain(ctx, index, offsets, sizes, n) == -1 || wait_completion(ctx, index) == -1))
+    {
+        return -1;
+    }
+
+    return copied;
+}
+
+void rdma_set_live(struct rdma_context *ctx, int index)
+{
+    assert(ctx);
+
+    atomic_store(&ctx->state[index], SLOT_LIVE);
+    atomic_store(&ctx->is_tracking, 0);
+}
+
+void rdma_abort_backup(struct rdma_context *ctx, int index)
+{
+    assert(ctx);
+
+    atomic_store(&ctx->state[index], SLOT_EMPTY);
+    atomic_store(&ctx->is_tracking, 0);
+}
+
+int post_chain(const struct rdma_context *ctx, int index, const long *offsets, const size_t *sizes, int n)
+{
+    struct rdma_device *device = ctx->devices + ctx->device_of[index];
+    struct ibv_sge list[RDMA_BATCH_MAX];
+    struct ibv_send_wr wr[RDMA_BATCH_MAX];
+    size_t bytes = 0;
+
+    memset(wr, 0, n * sizeof(struct ibv_send_wr));
+
+    for (int j = 0; j < n; j++)
+    {
+        list[j].addr = ctx->local_qp_info[index].addr + offsets[j];
+        list[j].length = sizes[j];
+        list[j].lkey = device->mr->lkey;
+        bytes += sizes[j];
+
+        wr[j].sg_list = &list[j];
+        wr[j].num_sge = 1;
+        wr[j].opcode = IBV_WR_RDMA_WRITE;
+        wr[j].send_flags = j == n - 1 ? IBV_SEND_SIGNALED : 0;
+        wr[j].wr.rdma.remote_addr = ctx->remote_qp_info[index].addr + offsets[j];
+        wr[j].wr.rdma.rkey = ctx->remote_qp_info[index].rkey;
+        wr[j].next = j == n - 1 ? NULL : &wr[j + 1];
+
+#ifdef LOG
+        printf("remote_addr %2d:\t%ld offset: %-8ld remote_real_addr: %ld\n",
+               index, ctx->remote_qp_info[index].addr, offsets[j], wr[j].wr.rdma.remote_addr);
+#endif
+    }
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(ctx->qp[index], wr, &bad_wr) != 0)
+    {
+        perror("ibv_post_send");
+        return -1;
+    }
+
+    atomic_fetch_add_explicit(&device->writes, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&device->bytes, bytes, memory_order_relaxed);
+    struct conn_stats *stats = stats_slot(ctx, index);
+    atomic_fetch_add_explicit(&stats->writes, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->bytes, bytes, memory_order_relaxed);
+
     return 0;
 }
 
-int connect_with_backup(struct rdma_context *ctx, int sockfd, int index)
+int wait_completion(const struct rdma_context *ctx, int index)
+{
+    struct ibv_wc wc[COUNT];
+    int n;
+    int spin = 0;
+    unsigned long polls = 0, sleeps = 0;
+
+    while ((n = ibv_poll_cq(ctx->cq[index], COUNT, wc)) == 0)
+    {
+        polls++;
+        if (CQ_POLL_BUDGET < 0 || ++spin < CQ_POLL_BUDGET)
+        {
+            continue;
+        }
+
+        sleeps++;
+        if ((n = sleep_on_cq(ctx, index, wc)) == -1)
+        {
+            fprintf(stderr, "sleep_on_cq failed\n");
+            return -1;
+        }
+        if (n > 0)
+        {
+            break;
+        }
+    }
+
+    // Counted once per wait to keep the polling loop tight
+    if (polls > 0)
+    {
+        struct conn_stats *stats = stats_slot(ctx, index);
+        atomic_fetch_add_explicit(&stats->polls, polls, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stats->sleeps, sleeps, memory_order_relaxed);
+    }
+
+    if (n < 0)
+    {
+        fprintf(stderr, "ibv_poll_cq\n");
+        return -1;
+    }
+
+    for (int j = 0; j < n; j++)
+    {
+        if (wc[j].status != IBV_WC_SUCCESS)
+        {
+            fprintf(stderr, "failed ibv_poll_cq status %s\n",
+                    ibv_wc_status_str(wc[j].status));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void mark_dirty(const struct rdma_context *ctx, const long *offsets, const size_t *sizes, int n)
+{
+    for (int j = 0; j < n; j++)
+    {
+        size_t first = offsets[j] / RDMA_DIRTY_GRAIN;
+        size_t last = (offsets[j] + sizes[j] - 1) / RDMA_DIRTY_GRAIN;
+
+        for (size_t g = first; g <= last; g++)
+        {
+            atomic_fetch_or_explicit(&ctx->dirty[g / DIRTY_BITS], 1UL << (g % DIRTY_BITS), memory_order_release);
+        }
+    }
+}
+
+int reset_qp(struct rdma_context *ctx, int index)
+{
+    struct ibv_qp_attr qp_attr = {
+        .qp_state = IBV_QPS_RESET};
+
+    if (ibv_modify_qp(ctx->qp[index], &qp_attr, IBV_QP_STATE))
+    {
+        fprintf(stderr, "failed to modify QP %d to RESET\n", index);
+        return -1;
+    }
+
+    // Drop completions left by a previous connection
+    struct ibv_wc wc[COUNT];
+    while (ibv_poll_cq(ctx->cq[index], COUNT, wc) > 0)
+        ;
+
+    memset(&qp_attr, 0, sizeof(qp_attr));
+    qp_attr.qp_state = IBV_QPS_INIT;
+    qp_attr.pkey_index = 0;
+    qp_attr.port_num = ctx->devices[ctx->device_of[index]].port;
+    qp_attr.qp_access_flags = IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE;
+    int init_flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS;
+
+    if (ibv_modify_qp(ctx->qp[index], &qp_attr, init_flags))
+    {
+        fprintf(stderr, "failed to modify QP %d to INIT\n", index);
+        return -1;
+    }
+
+    ctx->local_qp_info[index].psn = lrand48() & 0xffffff;
+
+    return 0;
+}
+
+int rdma_port_num(const struct rdma_context *ctx)
+{
+    assert(ctx);
+
+    return ctx->device_num;
+}
+
+void rdma_port_stats(const struct rdma_context *ctx, int index, const char **name, int *port,
+                     unsigned long *writes, unsigned long *bytes)
+{
+    assert(ctx);
+    assert(0 <= index && index < ctx->device_num);
+
+    const struct rdma_device *device = ctx->devices + index;
+
+    if (name)
+    {
+        *name = device->name;
+    }
+    if (port)
+    {
+        *port = device->port;
+    }
+    if (writes)
+    {
+        *writes = atomic_load_explicit(&device->writes, memory_order_relaxed);
+    }
+    if (bytes)
+    {
+        *bytes = atomic_load_explicit(&device->bytes, memory_order_relaxed);
+    }
+}
+
+void rdma_conn_stats(const struct rdma_context *ctx, int index, char *is_live, unsigned long *writes,
+                     unsigned long *bytes, unsigned long *polls, unsigned long *sleeps)
+{
+    assert(ctx);
+    assert(index >= 0);
+
+    unsigned long sums[4] = {0};
+    for (int i = 0; i < STATS_SLOT_NUM; i++)
+    {
+        const struct conn_stats *stats = ctx->stats + index * STATS_SLOT_NUM + i;
+        sums[0] += atomic_load_explicit(&stats->writes, memory_order_relaxed);
+        sums[1] += atomic_load_explicit(&stats->bytes, memory_order_relaxed);
+        sums[2] += atomic_load_explicit(&stats->polls, memory_order_relaxed);
+        sums[3] += atomic_load_explicit(&stats->sleeps, memory_order_relaxed);
+    }
+
+    if (is_live)
+    {
+        *is_live = atomic_load_explicit(&ctx->state[index], memory_order_acquire) == SLOT_LIVE;
+    }
+    if (writes)
+    {
+        *writes = sums[0];
+    }
+    if (bytes)
+    {
+        *bytes = sums[1];
+    }
+    if (polls)
+    {
+        *polls = sums[2];
+    }
+    if (sleeps)
+    {
+        *sleeps = sums[3];
+    }
+}
+
+int rdma_completion_fd(const struct rdma_context *ctx, int index)
+{
+    assert(ctx);
+
+    return ctx->channel[index]->fd;
+}
+
+int rdma_arm_completion(const struct rdma_context *ctx, int index)
+{
+    assert(ctx);
+
+    if (ibv_req_notify_cq(ctx->cq[index], 0) != 0)
+    {
+        fprintf(stderr, "ibv_req_notify_cq failed for CQ %d\n", index);
+        return -1;
+    }
+
+    return 0;
+}
+
+int rdma_consume_completion_event(const struct rdma_context *ctx, int index)
+{
+    assert(ctx);
+
+    struct ibv_cq *ev_cq;
+    void *ev_ctx;
+
+    if (ibv_get_cq_event(ctx->channel[index], &ev_cq, &ev_ctx) != 0)
+    {
+        return 0; // Nothing pending on the non-blocking fd
+    }
+
+    ibv_ack_cq_events(ev_cq, 1);
+
+    return 1;
+}
+
+char rdma_is_fork_safe(void)
+{
+    // Kernels that copy pinned pages for the child at fork time need no madvise() tricks
+    return ibv_is_fork_initialized() == IBV_FORK_UNNEEDED ? 1 : 0;
+}
+
+// Threads get slots in the order they first post, threads beyond STATS_SLOT_NUM sharing them
+struct conn_stats *stats_slot(const struct rdma_context *ctx, int index)
+{
+    if (slot == -1)
+    {
+        slot = atomic_fetch_add_explicit(&slot_count, 1, memory_order_relaxed) % STATS_SLOT_NUM;
+    }
+
+    return ctx->stats + index * STATS_SLOT_NUM + slot;
+}
+
+// Return the number of completions polled into wc (of size COUNT) once the CQ is armed, 0 after sleeping, -1 for failure
+int sleep_on_cq(const struct rdma_context *ctx, int index, struct ibv_wc *wc)
+{
+    if (rdma_arm_completion(ctx, index) == -1)
+    {
+        return -1;
+    }
+
+    // A completion arriving between the last poll and arming does not wake the channel, so the CQ is polled once more
+    // (the event of the next one is then left pending, and only cuts the next sleep short)
+    int n = ibv_poll_cq(ctx->cq[index], COUNT, wc);
+    if (n != 0)
+    {
+        if (n < 0)
+        {
+            fprintf(stderr, "ibv_poll_cq failed for CQ %d\n", index);
+        }
+        return n < 0 ? -1 : n;
+    }
+
+    struct pollfd pfd = {
+        .fd = rdma_completion_fd(ctx, index),
+        .events = POLLIN};
+
+    if (poll(&pfd, 1, SLEEP_TIMEOUT_MS) == -1)
+    {
+        perror("poll");
+        return -1;
+    }
+
+    rdma_consume_completion_event(ctx, index);
+
+    return 0;
+}
+
+int connect_with_backups(struct rdma_context *ctx, int sockfd, int others_num)
 {
     assert(ctx);
     assert(sockfd != -1);
 
-    int rv = -1;
+    int rv = 0;
+    int started = 0;
 
-    int connfd = sokt_passive_accept_open(sockfd);
-    if (connfd == -1)
+    struct handshake_info *info = calloc(others_num, sizeof(struct handshake_info));
+    if (!info)
     {
-        fprintf(stderr, "sokt_passive_accept_open failed\n");
-        goto out1;
+        perror("calloc for info");
+        return -1;
+    }
+
+    // Accepting is serial, but exchanging QP information and the RTR/RTS transitions overlap across backups
+    for (int i = 0; i < others_num; i++)
+    {
+        info[i].ctx = ctx;
+        info[i].index = i;
+
+        info[i].connfd = sokt_passive_accept_open(sockfd);
+        if (info[i].connfd == -1)
+        {
+            fprintf(stderr, "sokt_passive_accept_open failed\n");
+            rv = -1;
+            break;
+        }
+
+        if (pthread_create(&info[i].tid, NULL, handshake_with_backup, &info[i]) != 0)
+        {
+            perror("pthread_create");
+            sokt_passive_accept_close(info[i].connfd);
+            rv = -1;
+            break;
+        }
+
+        started++;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        if (pthread_join(info[i].tid, NULL) != 0)
+        {
+            perror("pthread_join");
+            rv = -1;
+        }
+        else if (info[i].rv)
+        {
+            fprintf(stderr, "failed to connect with backup %d and modify QP to RTS\n", i);
+            rv = -1;
+        }
+    }
+
+    free(info);
+
+    return rv;
+}
+
+void *handshake_with_backup(void *info)
+{
+    struct handshake_info *hs = info;
+    struct sokt_message msg;
+
+    hs->rv = -1;
+
+    // Backups announce themselves before sending their IB information
+    if (sokt_recv(hs->connfd, (char *)&msg, sizeof(struct sokt_message)) != 0 || msg.code != SOKT_CODE_JOIN)
+    {
+        fprintf(stderr, "backup %d did not ask to join\n", hs->index);
+        goto out;
+    }
+
+    if (connect_with_backup(hs->ctx, hs->connfd, hs->index))
+    {
+        goto out;
+    }
+
+    // Nothing writes the hashtable before the server starts, so one copy brings the backup up to date
+    if (rdma_copy_region(hs->ctx, hs->index) == -1)
+    {
+        fprintf(stderr, "rdma_copy_region failed for backup %d\n", hs->index);
+        goto out;
     }
 
+    rdma_set_live(hs->ctx, hs->index);
+
+    msg.code = SOKT_CODE_SUCCESS;
+    if (sokt_send(hs->connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out;
+    }
+
+    hs->rv = 0;
+
+out:
+    sokt_passive_accept_close(hs->connfd);
+
+    return NULL;
+}
+
+int connect_with_backup(struct rdma_context *ctx, int connfd, int index)
+{
+    assert(ctx);
+    assert(connfd != -1);
+
+    int rv = -1;
+
     char *buf = (char *)calloc(1, sizeof(struct QP_info));
     if (!buf)
     {
         perror("calloc for buf");
-        goto out2;
+        goto out1;
     }
 
     // Get remote IB information
     if (sokt_recv(connfd, buf, sizeof(struct QP_info)) == -1)
     {
         fprintf(stderr, "sokt_recv failed\n");
-        goto out3;
+        goto out2;
     }
     memcpy(&(ctx->remote_qp_info[index]), buf, sizeof(struct QP_info));
     printf("remote %d\tlid: %d qpn: %-4d psn: %-9d addr: %ld rkey: %u\n",
@@ -393,7 +1164,7 @@ int connect_with_backup(struct rdma_context *ctx, int sockfd, int index)
     if (connect_between_qps(ctx, index))
     {
         fprintf(stderr, "connect_between_qps failed for QP %d\n", index);
-        goto out3;
+        goto out2;
     }
 
     // Send local IB information
@@ -401,19 +1172,24 @@ int connect_with_backup(struct rdma_context *ctx, int sockfd, int index)
     if (sokt_send(connfd, buf, sizeof(struct QP_info)) == -1)
     {
         fprintf(stderr, "sokt_send failed\n");
-        goto out3;
+        goto out2;
     }
     printf("local  %d\tlid: %d qpn: %-4d psn: %-9d addr: %ld rkey: %u\n",
            index, ctx->local_qp_info[index].lid, ctx->local_qp_info[index].qpn, ctx->local_qp_info[index].psn,
            ctx->local_qp_info[index].addr, ctx->local_qp_info[index].rkey);
 
-    rv = 0;
+    // Writes before the backup's QP is ready to receive would fail the connection, so wait for it to say so
+    struct sokt_message msg;
+    if (sokt_recv(connfd, (char *)&msg, sizeof(struct sokt_message)) == -1 || msg.code != SOKT_CODE_SUCCESS)
+    {
+        fprintf(stderr, "backup %d did not get its QP ready\n", index);
+        goto out2;
+    }
 
-out3:
-    free(buf);
+    rv = 0;
 
 out2:
-    sokt_passive_accept_close(connfd);
+    free(buf);
 
 out1:
     return rv;
@@ -426,11 +1202,17 @@ int connect_with_primary(struct rdma_context *ctx, struct sokt_name_info **other
 
     int rv = -1;
 
-    int sockfd = sokt_active_open(others[0]->addr, others[0]->port);
-    if (sockfd == -1)
+    // The primary may not be listening yet
+    int sockfd;
+    for (int i = 0; (sockfd = sokt_active_open(others[0]->addr, others[0]->port)) == -1; i++)
     {
-        fprintf(stderr, "sokt_active_open failed\n");
-        goto out1;
+        if (i == CONNECT_RETRY_NUM)
+        {
+            fprintf(stderr, "sokt_active_open failed\n");
+            goto out1;
+        }
+
+        usleep(CONNECT_RETRY_INTERVAL_MS * 1000);
     }
 
     char *buf = (char *)calloc(1, sizeof(struct QP_info));
@@ -440,6 +1222,14 @@ int connect_with_primary(struct rdma_context *ctx, struct sokt_name_info **other
         goto out2;
     }
 
+    // Ask to join, the primary answers once the hashtable has been copied over, after this side says its QP is ready
+    struct sokt_message msg = {.code = SOKT_CODE_JOIN};
+    if (sokt_send(sockfd, (char *)&msg, sizeof(struct sokt_message)) == -1)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out3;
+    }
+
     // Send local IB information
     memcpy(buf, &(ctx->local_qp_info[0]), sizeof(struct QP_info)); // Only 1 remote server
     if (sokt_send(sockfd, buf, sizeof(struct QP_info)) == -1)
@@ -469,6 +1259,22 @@ int connect_with_primary(struct rdma_context *ctx, struct sokt_name_info **other
         goto out3;
     }
 
+    // The primary holds the hashtable copy until then
+    msg.code = SOKT_CODE_SUCCESS;
+    if (sokt_send(sockfd, (char *)&msg, sizeof(struct sokt_message)) == -1)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out3;
+    }
+
+    printf("catching up with primary\n");
+    if (sokt_recv(sockfd, (char *)&msg, sizeof(struct sokt_message)) == -1 || msg.code != SOKT_CODE_SUCCESS)
+    {
+        fprintf(stderr, "failed to catch up with primary\n");
+        goto out3;
+    }
+    atomic_store(&ctx->state[0], SLOT_LIVE);
+
     rv = 0;
 
 out3:
@@ -495,7 +1301,7 @@ int connect_between_qps(struct rdma_context *ctx, int index)
             .dlid = ctx->remote_qp_info[index].lid,
             .sl = 0,
             .src_path_bits = 0,
-            .port_num = IB_PORT}};
+            .port_num = ctx->devices[ctx->device_of[index]].port}};
     int rtr_flags = IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER;
 
     if (ibv_modify_qp(ctx->qp[index], &qp_attr, rtr_flags))
@@ -521,4 +1327,15 @@ int connect_between_qps(struct rdma_context *ctx, int index)
     }
 
     return 0;
+}
+
+double lap_ms(struct timespec *last)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double ms = (now.tv_sec - last->tv_sec) * 1000.0 + (now.tv_nsec - last->tv_nsec) / 1000000.0;
+    *last = now;
+
+    return ms;
 }
\ No newline at end of file
@@ -15,17 +15,31 @@
 struct rdma_context;
 
 /**
- * @brief Open RDMA connection and modify the QPs to RTS
+ * @brief RDMA device port
+ *
+ */
+struct rdma_port
+{
+    char *dev_name; // NULL for the first device
+    int port;       // Starting from 1
+};
+
+/**
+ * @brief Open RDMA connection and modify the QPs to RTS (connections are striped round-robin over the ports)
  *
  * @param is_primary
  * @param self_sockfd
  * @param others can be NULL
- * @param others_num
+ * @param others_num the number of connections, for the primary some of them can be left for rdma_accept_backup()
+ * @param wait_num the number of backups the primary waits for, ignored by backups
+ * @param ports can be NULL for port 1 of the first device
+ * @param port_num
  * @param ht_addr
  * @param ht_size
  * @return struct rdma_context* NULL for failure
  */
-struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, struct sokt_name_info **others, int others_num, void *ht_addr, size_t ht_size);
+struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, struct sokt_name_info **others, int others_num,
+                                          int wait_num, const struct rdma_port *ports, int port_num, void *ht_addr, size_t ht_size);
 
 /**
  * @brief Close RDMA connection and release resources
@@ -36,7 +50,7 @@ struct rdma_context *rdma_open_connection(char is_primary, int self_sockfd, stru
 void rdma_close_connection(struct rdma_context *ctx, int others_num);
 
 /**
- * @brief Perform RDMA WRITE to all connected servers
+ * @brief Perform RDMA WRITE to all live connected servers
  *
  * @param ctx
  * @param offset offset in memory
@@ -47,7 +61,85 @@ void rdma_close_connection(struct rdma_context *ctx, int others_num);
 int rdma_wrtie_all(const struct rdma_context *ctx, long offset, size_t size, int others_num);
 
 /**
- * @brief Wait and poll for completion of RDMA WR from all connected servers
+ * @brief Maximum number of memory ranges in one rdma_write_batch_all()
+ *
+ */
+#define RDMA_BATCH_MAX 64
+
+/**
+ * @brief Perform RDMA WRITE of several memory ranges to all connected servers, posted as one chain per server
+ * (ranges are written in order and only the last one is signaled, so wait for one completion per server)
+ *
+ * @param ctx
+ * @param offsets offsets in memory, an array of size n
+ * @param sizes sizes to be written, an array of size n
+ * @param n number of ranges, at most RDMA_BATCH_MAX
+ * @param others_num
+ * @return int -1 for failure
+ */
+int rdma_write_batch_all(const struct rdma_context *ctx, const long *offsets, const size_t *sizes, int n, int others_num);
+
+/**
+ * @brief Size of the RDMA WRITEs copying the hashtable region to a backup catching up
+ *
+ */
+#define RDMA_BULK_CHUNK (1 << 20)
+
+/**
+ * @brief Granularity of the dirty tracking while a backup catches up, in byte
+ *
+ */
+#define RDMA_DIRTY_GRAIN 64
+
+/**
+ * @brief Connect with a backup joining a running primary, after its SOKT_CODE_JOIN message has been received. PUTs are
+ * not written to it but tracked as dirty until rdma_set_live(); only one backup can catch up at a time.
+ *
+ * @param ctx
+ * @param connfd
+ * @param others_num
+ * @return int index of the connection, -1 for failure
+ */
+int rdma_accept_backup(struct rdma_context *ctx, int connfd, int others_num);
+
+/**
+ * @brief Copy the whole hashtable region to a connected server with large RDMA WRITEs
+ *
+ * @param ctx
+ * @param index
+ * @return long bytes copied, -1 for failure
+ */
+long rdma_copy_region(const struct rdma_context *ctx, int index);
+
+/**
+ * @brief Copy what has been written since the last call (or rdma_accept_backup()) to a backup catching up
+ *
+ * @param ctx
+ * @param index
+ * @return long bytes copied, -1 for failure
+ */
+long rdma_copy_dirty(const struct rdma_context *ctx, int index);
+
+/**
+ * @brief Include a backup that has caught up in the following writes and stop dirty tracking (no PUT should be between
+ * writing and waiting for completion at this point)
+ *
+ * @param ctx
+ * @param index
+ */
+void rdma_set_live(struct rdma_context *ctx, int index);
+
+/**
+ * @brief Give up on a backup catching up
+ *
+ * @param ctx
+ * @param index
+ */
+void rdma_abort_backup(struct rdma_context *ctx, int index);
+
+/**
+ * @brief Wait and poll for completion of RDMA WR from all connected servers (busy polls for CQ_POLL_BUDGET empty
+ * polls, then sleeps on the completion channel)
  *
  * @param ctx
  * @param others_num
@@ -55,4 +147,75 @@ int rdma_wrtie_all(const struct rdma_context *ctx, long offset, size_t size, int
  */
 int rdma_wait_completion_all(const struct rdma_context *ctx, int others_num);
 
+/**
+ * @brief Get the number of device ports in use
+ *
+ * @param ctx
+ * @return int
+ */
+int rdma_port_num(const struct rdma_context *ctx);
+
+/**
+ * @brief Get the traffic counters of a device port
+ *
+ * @param ctx
+ * @param index index of the port, less than rdma_port_num()
+ * @param name device name, can be NULL
+ * @param port port number, can be NULL
+ * @param writes number of RDMA WRITEs posted through the port, can be NULL
+ * @param bytes number of bytes written through the port, can be NULL
+ */
+void rdma_port_stats(const struct rdma_context *ctx, int index, const char **name, int *port,
+                     unsigned long *writes, unsigned long *bytes);
+
+/**
+ * @brief Get the counters of the connection to a server
+ *
+ * @param ctx
+ * @param index
+ * @param is_live if the server gets PUTs, can be NULL
+ * @param writes number of RDMA WRITEs posted to the server, can be NULL
+ * @param bytes number of bytes written to the server, can be NULL
+ * @param polls number of empty polls of its CQ, can be NULL
+ * @param sleeps number of sleeps on its completion channel, can be NULL
+ */
+void rdma_conn_stats(const struct rdma_context *ctx, int index, char *is_live, unsigned long *writes,
+                     unsigned long *bytes, unsigned long *polls, unsigned long *sleeps);
+
+/**
+ * @brief Get the completion channel fd of the CQ for a connected server, which becomes readable once the CQ is armed
+ * and gets a completion (e.g. to be added to an epoll loop)
+ *
+ * @param ctx
+ * @param index
+ * @return int
+ */
+int rdma_completion_fd(const struct rdma_context *ctx, int index);
+
+/**
+ * @brief Arm the CQ for a connected server so that its next completion makes rdma_completion_fd() readable
+ * (poll the CQ again after arming, as a completion may have arrived in between)
+ *
+ * @param ctx
+ * @param index
+ * @return int -1 for failure
+ */
+int rdma_arm_completion(const struct rdma_context *ctx, int index);
+
+/**
+ * @brief Consume and acknowledge a pending event on rdma_completion_fd(), without blocking
+ *
+ * @param ctx
+ * @param index
+ * @return int 1 if an event was consumed, 0 otherwise
+ */
+int rdma_consume_completion_event(const struct rdma_context *ctx, int index);
+
+/**
+ * @brief Check if registered memory stays valid in the parent across fork(), which needs a recent kernel
+ *
+ * @return char 1 if fork() is safe
+ */
+char rdma_is_fork_safe(void);
+
 #endif
\ No newline at end of file
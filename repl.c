@@ -0,0 +1,213 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "repl.h"
+
+#define CACHE_LINE 64
+#define RING_SIZE 64     // Records per ring, power of two
+#define SPIN_LIMIT 1024  // Yield the CPU after spinning this many times
+
+// One memory range to be written to all backups
+struct record
+{
+    long offset;
+    size_t size;
+    atomic_int *done; // Completion handle, only set on the last record of a repl_write()
+};
+
+// Single producer (the worker) single consumer (the replication thread) ring
+struct ring
+{
+    _Alignas(CACHE_LINE) atomic_uint head; // Written by the consumer
+    _Alignas(CACHE_LINE) atomic_uint tail; // Written by the producer
+    _Alignas(CACHE_LINE) atomic_int done;  // 0 pending, 1 replicated, -1 failed
+    struct record records[RING_SIZE];
+};
+
+struct repl
+{
+    struct rdma_context *rdma_ctx;
+    int others_num;
+    unsigned worker_num;
+    struct ring *rings;
+    atomic_int is_over;
+    pthread_t tid;
+};
+
+static inline void cpu_relax(int *spin)
+{
+    if (++*spin < SPIN_LIMIT)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+    {
+        sched_yield();
+    }
+}
+
+static void *repl_routine(void *args)
+{
+    struct repl *repl = args;
+    long offsets[RDMA_BATCH_MAX];
+    size_t sizes[RDMA_BATCH_MAX];
+    atomic_int *done[RDMA_BATCH_MAX];
+    int spin = 0;
+
+    while (!atomic_load_explicit(&repl->is_over, memory_order_relaxed))
+    {
+        // Drain every ring into one batch
+        int n = 0;
+
+        for (unsigned w = 0; w < repl->worker_num && n < RDMA_BATCH_MAX; w++)
+        {
+            struct ring *ring = repl->rings + w;
+            unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+            while (head != tail && n < RDMA_BATCH_MAX)
+            {
+                struct record *r = ring->records + (head & (RING_SIZE - 1));
+                offsets[n] = r->offset;
+                sizes[n] = r->size;
+                done[n] = r->done;
+                n++;
+                head++;
+            }
+
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+        }
+
+        if (n == 0)
+        {
+            cpu_relax(&spin);
+            continue;
+        }
+        spin = 0;
+
+        // One chain per backup, one completion per backup
+        int status = 1;
+        if (rdma_write_batch_all(repl->rdma_ctx, offsets, sizes, n, repl->others_num) == -1)
+        {
+            fprintf(stderr, "rdma_write_batch_all failed\n");
+            status = -1;
+        }
+        else if (rdma_wait_completion_all(repl->rdma_ctx, repl->others_num) == -1)
+        {
+            fprintf(stderr, "rdma_wait_completion_all failed\n");
+            status = -1;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            if (done[i])
+            {
+                atomic_store_explicit(done[i], status, memory_order_release);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+struct repl *repl_create(struct rdma_context *rdma_ctx, int others_num, unsigned worker_num)
+{
+    assert(rdma_ctx);
+    assert(others_num >= 0);
+    assert(worker_num > 0);
+
+    struct repl *repl = calloc(1, sizeof(struct repl));
+    if (!repl)
+    {
+        perror("calloc for repl");
+        return NULL;
+    }
+
+    repl->rdma_ctx = rdma_ctx;
+    repl->others_num = others_num;
+    repl->worker_num = worker_num;
+    atomic_init(&repl->is_over, 0);
+
+    repl->rings = aligned_alloc(CACHE_LINE, worker_num * sizeof(struct ring));
+    if (!repl->rings)
+    {
+        perror("aligned_alloc for repl->rings");
+        free(repl);
+        return NULL;
+    }
+
+    for (unsigned w = 0; w < worker_num; w++)
+    {
+        atomic_init(&repl->rings[w].head, 0);
+        atomic_init(&repl->rings[w].tail, 0);
+        atomic_init(&repl->rings[w].done, 0);
+    }
+
+    if (pthread_create(&repl->tid, NULL, repl_routine, repl) != 0)
+    {
+        perror("pthread_create");
+        free(repl->rings);
+        free(repl);
+        return NULL;
+    }
+
+    return repl;
+}
+
+void repl_destroy(struct repl *repl)
+{
+    if (!repl)
+    {
+        return;
+    }
+
+    atomic_store(&repl->is_over, 1);
+    pthread_join(repl->tid, NULL);
+
+    free(repl->rings);
+    free(repl);
+}
+
+int repl_write(struct repl *repl, unsigned worker, const long *offsets, const size_t *sizes, int n)
+{
+    assert(repl);
+    assert(worker < repl->worker_num);
+    assert(0 < n && n <= RING_SIZE);
+
+    struct ring *ring = repl->rings + worker;
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spin = 0;
+
+    atomic_store_explicit(&ring->done, 0, memory_order_relaxed);
+
+    for (int i = 0; i < n; i++)
+    {
+        while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == RING_SIZE)
+        {
+            cpu_relax(&spin);
+        }
+
+        struct record *r = ring->records + (tail & (RING_SIZE - 1));
+        r->offset = offsets[i];
+        r->size = sizes[i];
+        r->done = i == n - 1 ? &ring->done : NULL;
+        tail++;
+
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+
+    int done;
+    spin = 0;
+    while ((done = atomic_load_explicit(&ring->done, memory_order_acquire)) == 0)
+    {
+        cpu_relax(&spin);
+    }
+
+    return done == 1 ? 0 : -1;
+}
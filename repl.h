@@ -0,0 +1,47 @@
+/*
+ * Single-writer replication thread fed by per-worker SPSC rings
+ */
+#ifndef REPL_H_
+#define REPL_H_
+
+#include <stddef.h>
+
+#include "rdma.h"
+
+/**
+ * @brief Replication thread and its rings
+ *
+ */
+struct repl;
+
+/**
+ * @brief Start a replication thread, which becomes the only user of the QPs to backups
+ *
+ * @param rdma_ctx
+ * @param others_num
+ * @param worker_num the number of workers, each of them owns a ring
+ * @return struct repl* NULL for failure
+ */
+struct repl *repl_create(struct rdma_context *rdma_ctx, int others_num, unsigned worker_num);
+
+/**
+ * @brief Stop the replication thread and release resources
+ *
+ * @param repl
+ */
+void repl_destroy(struct repl *repl);
+
+/**
+ * @brief Hand memory ranges over to the replication thread and wait until all backups have them
+ * (ranges are written in order; only the worker itself may use its ring)
+ *
+ * @param repl
+ * @param worker id of the calling worker
+ * @param offsets offsets in memory, an array of size n
+ * @param sizes sizes to be written, an array of size n
+ * @param n number of ranges
+ * @return int -1 for failure
+ */
+int repl_write(struct repl *repl, unsigned worker, const long *offsets, const size_t *sizes, int n);
+
+#endif
@@ -1,318 +1,1726 @@
-#include <pthread.h>
-#include <stdio.h>
-#include <stdlib.h>
-
-#include "parameters.h"
-#include "pool.h"
-#include "ht.h"
-#include "rdma.h"
-#include "sokt.h"
-
-struct handle_client_info
-{
-    int unused; // For padding pupose; without this connfd cannot be passed to the thread pool correctly
-    int connfd;
-    char is_primary;
-    pthread_rwlock_t *rwlock;
-    struct ht *ht;
-    struct rdma_context *rdma_ctx;
-    int others_num;
-};
-
-void *handle_client(void *info);
-
-int main(int argc, char *argv[])
-{
-    int rv = EXIT_FAILURE;
-
-    // Parse arguments
-    if (argc <= 4 || argc % 2 == 1)
-    {
-        fprintf(stderr, "Usage: server is_primary self_addr self_port "
-                        "others_addr_1 others_port_1 ...\n");
-        goto out1;
-    }
-
-    char is_primary = atoi(argv[1]) == 1 ? 1 : 0;
-    struct sokt_name_info name_self, *name_others;
-
-    name_self.addr = argv[2];
-    name_self.port = argv[3];
-
-    int others_num = (argc - 4) / 2;
-    name_others = calloc(others_num, sizeof(struct sokt_name_info));
-    if (!name_others)
-    {
-        perror("calloc for name_others");
-        goto out1;
-    }
-
-    for (int i = 0; i < others_num; i++)
-    {
-        name_others[i].addr = argv[4 + 2 * i];
-        name_others[i].port = argv[4 + 2 * i + 1];
-    }
-
-    if (is_primary)
-    {
-        printf("primary\t\t%s:%s\n", name_self.addr, name_self.port);
-        for (int i = 0; i < others_num; i++)
-        {
-            printf("backup%d\t\t%s:%s\n", i, name_others[i].addr, name_others[i].port);
-        }
-    }
-    else
-    {
-        printf("backup\t\t%s:%s\n", name_self.addr, name_self.port);
-        printf("primary\t\t%s:%s\n", name_others[0].addr, name_others[0].port);
-    }
-    printf("\n");
-
-    // For multithreading
-    pool_t pool = pool_init(SERVER_THREAD);
-    if (pool == NULL)
-    {
-        printf("pool_init failed\n");
-        goto out2;
-    }
-
-    pthread_rwlock_t rwlock[HT_KEY_MAX - HT_KEY_MIN + 1];
-    for (long i = 0; i < HT_KEY_MAX - HT_KEY_MIN + 1; i++)
-    {
-        if (pthread_rwlock_init(&rwlock[i], NULL) != 0)
-        {
-            perror("pthread_rwlock_init");
-            goto out3;
-        }
-    }
-
-    // Initiate hash table
-    void *ht_addr;
-    size_t ht_size;
-
-    struct ht *ht = ht_create(BUCKET_NUM, ELEMENT_NUM, &ht_addr, &ht_size);
-    if (!ht)
-    {
-        fprintf(stderr, "ht_create failed\n");
-        goto out4;
-    }
-
-    ht_preload(ht);
-
-    printf("hashtable initiated at %p with size %lu\n", (void *)ht_addr, ht_size);
-
-    // Setup socket connections for clients and backup RDMA connection
-    int sockfd = sokt_passive_open(NULL, name_self.port);
-    if (sockfd == -1)
-    {
-        fprintf(stderr, "sokt_passive_open failed\n");
-        goto out5;
-    }
-
-    // Setup RDMA connections with other servers
-    struct rdma_context *rdma_ctx = rdma_open_connection(is_primary, sockfd, &name_others, others_num, ht_addr, ht_size);
-    if (!rdma_ctx)
-    {
-        fprintf(stderr, "rdma_open_connection failed\n");
-        goto out6;
-    }
-
-    // Run the key-value store
-    printf("\nrunning experiments\n");
-
-    while (1)
-    {
-        struct handle_client_info *info = calloc(1, sizeof(struct handle_client_info));
-        if (!info)
-        {
-            perror("calloc for info");
-            continue;
-        }
-
-        info->connfd = sokt_passive_accept_open(sockfd);
-        if (info->connfd == -1)
-        {
-            fprintf(stderr, "sokt_passive_accept_open failed\n");
-            free(info);
-            continue;
-        }
-
-        info->is_primary = is_primary;
-        info->rwlock = rwlock;
-        info->ht = ht;
-        info->rdma_ctx = rdma_ctx;
-        info->others_num = others_num;
-
-        if (pool_add(pool, handle_client, info) == -1)
-        {
-            fprintf(stderr, "pool_add failed\n");
-        }
-    }
-
-    // Release resources
-    rv = EXIT_SUCCESS;
-
-    rdma_close_connection(rdma_ctx, others_num);
-
-out6:
-    sokt_passive_close(sockfd);
-
-out5:
-    ht_destroy(ht);
-
-out4:
-    for (long i = 0; i < HT_KEY_MAX - HT_KEY_MIN + 1; i++)
-    {
-        pthread_rwlock_destroy(&rwlock[i]);
-    }
-
-out3:
-    pool_free(pool);
-
-out2:
-    if (name_others)
-    {
-        free(name_others);
-    }
-
-out1:
-    return rv;
-}
-
-void *handle_client(void *info)
-{
-    int connfd = ((struct handle_client_info *)info)->connfd;
-    char is_primary = ((struct handle_client_info *)info)->is_primary;
-    pthread_rwlock_t *rwlock = ((struct handle_client_info *)info)->rwlock;
-    struct ht *ht = ((struct handle_client_info *)info)->ht;
-    struct rdma_context *rdma_ctx = ((struct handle_client_info *)info)->rdma_ctx;
-    int others_num = ((struct handle_client_info *)info)->others_num;
-
-    free(info);
-
-    struct sokt_message msg;
-    int ht_status;
-    char is_update;
-    long ht_element_offset[2];
-    size_t ht_element_size[2];
-    enum sokt_message_code code;
-
-    if (sokt_recv(connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
-    {
-        fprintf(stderr, "sokt_recv failed\n");
-        goto out1;
-    }
-
-#ifdef LOG
-    printf("from client:\t");
-    skot_message_show(&msg);
-#endif
-
-    code = msg.code;
-    if (code == SOKT_CODE_PUT && is_primary)
-    {
-        if (pthread_rwlock_wrlock(&rwlock[msg.key]) == 0)
-        {
-
-            ht_status = ht_put(ht, msg.key, msg.value, &is_update, ht_element_offset, ht_element_size);
-            switch (ht_status)
-            {
-            case HT_CODE_SUCCESS:
-                msg.code = SOKT_CODE_SUCCESS;
-                break;
-            case HT_CODE_FULL:
-                msg.code = SOKT_CODE_FULL;
-                break;
-            default:
-                msg.code = SOKT_CODE_ERROR;
-                break;
-            }
-        }
-        else
-        {
-            perror("pthread_rwlock_wrlock");
-            msg.code = SOKT_CODE_ERROR;
-        }
-    }
-    else if (code == SOKT_CODE_GET)
-    {
-        if (pthread_rwlock_rdlock(&rwlock[msg.key]) == 0)
-        {
-
-            ht_status = ht_get(ht, msg.key, &msg.value, is_primary);
-            switch (ht_status)
-            {
-            case HT_CODE_SUCCESS:
-                msg.code = SOKT_CODE_SUCCESS;
-                break;
-            case HT_CODE_NOT_FOUND:
-                msg.code = SOKT_CODE_NOT_FOUND;
-                break;
-            default:
-                msg.code = SOKT_CODE_ERROR;
-                break;
-            }
-        }
-        else
-        {
-            perror("pthread_rwlock_rdlock");
-            msg.code = SOKT_CODE_ERROR;
-        }
-    }
-    else
-    {
-        msg.code = SOKT_CODE_ERROR;
-    }
-
-    if (sokt_send(connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
-    {
-        fprintf(stderr, "sokt_send failed\n");
-        goto out2;
-    }
-
-#ifdef LOG
-    printf("to   client:\t");
-    skot_message_show(&msg);
-#endif
-
-    if (code == SOKT_CODE_PUT && msg.code == SOKT_CODE_SUCCESS && is_primary)
-    {
-        if (rdma_wrtie_all(rdma_ctx, ht_element_offset[0], ht_element_size[0], others_num) == -1)
-        {
-            fprintf(stderr, "rdma_wrtie_all failed\n");
-            goto out2;
-        }
-
-        if (rdma_wait_completion_all(rdma_ctx, others_num) == -1)
-        {
-            fprintf(stderr, "rdma_wait_completion_all failed\n");
-            goto out2;
-        }
-
-        if (is_update == 0)
-        {
-            if (rdma_wrtie_all(rdma_ctx, ht_element_offset[1], ht_element_size[1], others_num) == -1)
-            {
-                fprintf(stderr, "rdma_wrtie_all failed\n");
-                goto out2;
-            }
-
-            if (rdma_wait_completion_all(rdma_ctx, others_num) == -1)
-            {
-                fprintf(stderr, "rdma_wait_completion_all failed\n");
-                goto out2;
-            }
-        }
-    }
-
-out2:
-    if (pthread_rwlock_unlock(&rwlock[msg.key]) != 0)
-    {
-        perror("pthread_rwlock_unlock"); // Should rarely happen
-    }
-
-out1:
-    sokt_passive_accept_close(connfd);
-
-    return NULL;
-}
\ No newline at end of file
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+#include "pool.h"
+#include "capture.h"
+#include "heat.h"
+#include "ht.h"
+#include "lock.h"
+#include "rdma.h"
+#include "repl.h"
+#include "sokt.h"
+#include "trace.h"
+#include "wal.h"
+
+// Phases cost nothing unless traced
+#ifdef TRACE
+#define TRACE_MARK(span, phase)          \
+    do                                   \
+    {                                    \
+        if (span)                        \
+        {                                \
+            trace_mark((span), (phase)); \
+        }                                \
+    } while (0)
+#else
+#define TRACE_MARK(span, phase)
+#endif
+
+struct handle_client_info
+{
+    unsigned id; // Filled in by the thread pool with the id of the worker thread
+    int connfd;
+    char is_primary;
+    struct lock_table *locks;
+    struct ht *ht;
+    struct rdma_context *rdma_ctx;
+    struct repl *repl;
+    struct wal *wal;
+    int others_num;
+    const char *snapshot_path;
+    struct trace *trace; // NULL unless traced
+    const char *trace_path;
+    uint64_t accepted; // Ticks
+    pool_t pool;
+    struct heat *heat;
+    struct capture *capture; // NULL unless captured
+};
+
+struct checkpoint_info
+{
+    int connfd;
+    pid_t pid;
+    const char *snapshot_path;
+    struct wal *wal; // NULL unless logged
+    off_t wal_position; // End of the log covered by the snapshot
+    struct timespec start;
+    double pause_ms;
+};
+
+struct sweep_info
+{
+    struct lock_table *locks;
+    struct ht *ht;
+    struct rdma_context *rdma_ctx;
+    struct repl *repl;
+    struct wal *wal;
+    int others_num;
+};
+
+// Ranges of a transaction, between the begin and end versions of its buckets
+_Static_assert(TXN_KEY_MAX * 4 <= RDMA_BATCH_MAX, "a transaction must fit in one batch of writes");
+
+// Data requests and their results, counted by their index here as codes are not contiguous on the wire
+static const enum sokt_message_code ops[] = {SOKT_CODE_PUT, SOKT_CODE_GET,  SOKT_CODE_DEL, SOKT_CODE_INCR,
+                                             SOKT_CODE_CAS, SOKT_CODE_FADD, SOKT_CODE_TXN};
+static const char *op_names[] = {"put", "get", "del", "incr", "cas", "fadd", "txn"};
+#define OP_NUM (int)(sizeof(ops) / sizeof(*ops))
+_Static_assert(sizeof(op_names) / sizeof(*op_names) == OP_NUM, "every data request needs a name");
+
+static const enum sokt_message_code results[] = {SOKT_CODE_SUCCESS, SOKT_CODE_ERROR, SOKT_CODE_FULL,
+                                                 SOKT_CODE_NOT_FOUND, SOKT_CODE_MISMATCH};
+static const char *result_names[] = {"success", "error", "full", "not_found", "mismatch"};
+#define RESULT_NUM (int)(sizeof(results) / sizeof(*results))
+_Static_assert(sizeof(result_names) / sizeof(*result_names) == RESULT_NUM, "every result needs a name");
+
+// Counters of a server thread, only written by it so that counting costs no contention
+struct worker_stats
+{
+    atomic_ulong ops[OP_NUM][RESULT_NUM];
+    atomic_ulong lock_waits;
+    atomic_ulong lock_wait_ns;
+    atomic_ulong closed; // Connections
+} __attribute__((aligned(64)));
+
+static struct worker_stats worker_stats[SERVER_THREAD];
+static atomic_ulong accepted;       // Connections, counted by the main thread
+static atomic_ulong closed_elsewhere; // Connections handed over to join and checkpoint threads
+
+// Only one snapshot may be written at a time
+static atomic_int is_checkpointing;
+
+// Set once any key may expire, the sweeper idles until then
+static atomic_int has_ttl;
+
+// Told once that a capture leaves transactions out
+static atomic_int is_txn_skipped;
+
+void *handle_client(void *info);
+void *handle_join(void *info);
+void *handle_checkpoint(void *info);
+void *handle_sweep(void *info);
+int replicate(struct rdma_context *rdma_ctx, struct repl *repl, unsigned worker, const long *offsets,
+              const size_t *sizes, int n, int others_num, struct trace_span *span);
+enum sokt_message_code modify(const struct ht *ht, enum sokt_message_code code, struct sokt_message *msg,
+                              ht_value_t *value, int64_t *expire);
+enum sokt_message_code txn(struct ht *ht, struct lock_table *locks, struct wal *wal, struct rdma_context *rdma_ctx,
+                           struct repl *repl, unsigned worker, int others_num, const struct sokt_message *puts, int n,
+                           struct trace_span *span);
+int evict(struct ht *ht, struct lock_table *locks, uint64_t held_id, struct wal *wal, struct rdma_context *rdma_ctx,
+          struct repl *repl, unsigned worker, int others_num);
+int parse_ports(char *arg, struct rdma_port **ports);
+int lock_timed(struct lock_table *locks, uint64_t id, char is_write, unsigned worker);
+void count(atomic_ulong *counter, unsigned long n);
+int code_index(const enum sokt_message_code *codes, int n, enum sokt_message_code code);
+int write_stats(FILE *fp, pool_t pool, struct ht *ht, struct heat *heat, struct rdma_context *rdma_ctx,
+                struct wal *wal, int others_num, char is_primary);
+
+int main(int argc, char *argv[])
+{
+    int rv = EXIT_FAILURE;
+    struct rdma_port *ports = NULL;
+    int port_num = 0;
+    int wait_num = -1;
+    char *snapshot_path = NULL;
+    char *wal_path = NULL;
+    char *preload_path = NULL;
+    char *capture_path = NULL;
+
+    // Parse options
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:d:p:s:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            wait_num = atoi(optarg);
+            break;
+        case 'c':
+            capture_path = optarg;
+            break;
+        case 'd':
+            free(ports);
+            port_num = parse_ports(optarg, &ports);
+            if (port_num == -1)
+            {
+                goto out1;
+            }
+            break;
+        case 'p':
+            preload_path = optarg;
+            break;
+        case 's':
+            snapshot_path = optarg;
+            break;
+        case 'w':
+            wal_path = optarg;
+            break;
+        default:
+            argc = 0; // Show the usage
+            break;
+        }
+    }
+
+    // Leave the positional arguments where they would be without options
+    argc -= optind - 1;
+    argv += optind - 1;
+
+    // Parse arguments
+    if (argc <= 4 || argc % 2 == 1)
+    {
+        fprintf(stderr, "Usage: server [-b backups_at_boot] [-c capture] [-d dev[:port],...] [-p preload] [-s snapshot] [-w wal] is_primary self_addr self_port "
+                        "others_addr_1 others_port_1 ...\n");
+        goto out1;
+    }
+
+    char is_primary = atoi(argv[1]) == 1 ? 1 : 0;
+    struct sokt_name_info name_self, *name_others;
+
+    name_self.addr = argv[2];
+    name_self.port = argv[3];
+
+    int others_num = (argc - 4) / 2;
+    name_others = calloc(others_num, sizeof(struct sokt_name_info));
+    if (!name_others)
+    {
+        perror("calloc for name_others");
+        goto out1;
+    }
+
+    for (int i = 0; i < others_num; i++)
+    {
+        name_others[i].addr = argv[4 + 2 * i];
+        name_others[i].port = argv[4 + 2 * i + 1];
+    }
+
+    // The primary waits for every backup at boot unless told otherwise, the others can join later
+    if (!is_primary || wait_num < 0 || wait_num > others_num)
+    {
+        wait_num = others_num;
+    }
+
+    if (is_primary)
+    {
+        printf("primary\t\t%s:%s\n", name_self.addr, name_self.port);
+        for (int i = 0; i < others_num; i++)
+        {
+            printf("backup%d\t\t%s:%s\n", i, name_others[i].addr, name_others[i].port);
+        }
+    }
+    else
+    {
+        printf("backup\t\t%s:%s\n", name_self.addr, name_self.port);
+        printf("primary\t\t%s:%s\n", name_others[0].addr, name_others[0].port);
+    }
+    printf("\n");
+
+    // For multithreading
+    pool_t pool = pool_init(SERVER_THREAD);
+    if (pool == NULL)
+    {
+        printf("pool_init failed\n");
+        goto out2;
+    }
+
+    struct heat *heat = NULL;
+    struct capture *capture = NULL;
+
+    // Server threads are the ones traced
+    struct trace *trace = NULL;
+    char trace_path[64];
+    sprintf(trace_path, "%s_%s_trace.json", "server", name_self.port);
+#ifdef TRACE
+    trace = trace_create(SERVER_THREAD, TRACE_RING_SIZE, TRACE_SAMPLE);
+    if (!trace)
+    {
+        fprintf(stderr, "trace_create failed\n");
+        goto out3;
+    }
+#endif
+
+    // Accesses are counted to find hot buckets and keys
+    heat = heat_create(SERVER_THREAD, BUCKET_NUM, HEAT_CAPACITY, HEAT_SAMPLE);
+    if (!heat)
+    {
+        fprintf(stderr, "heat_create failed\n");
+        goto out3;
+    }
+
+    // Requests are captured to be replayed by clients
+    if (capture_path)
+    {
+        capture = capture_open(capture_path);
+        if (!capture)
+        {
+            fprintf(stderr, "capture_open failed\n");
+            goto out3;
+        }
+
+        printf("capturing requests to %s\n", capture_path);
+    }
+
+    struct lock_table *locks = lock_create(LOCK_STRIPE_NUM, LOCK_KIND);
+    if (!locks)
+    {
+        fprintf(stderr, "lock_create failed\n");
+        goto out3;
+    }
+
+    // Initiate hash table, from the snapshot if there is one
+    void *ht_addr;
+    size_t ht_size;
+    struct ht *ht;
+    char is_loaded = snapshot_path && access(snapshot_path, F_OK) == 0;
+
+    if (is_loaded)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        ht = ht_load(snapshot_path, BUCKET_NUM, ELEMENT_NUM, HT_HASH, &ht_addr, &ht_size);
+        if (!ht)
+        {
+            fprintf(stderr, "ht_load failed\n");
+            goto out4;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        // Covers copying the region in and rebuilding the free list, registering it later only pins the pages
+        printf("hashtable loaded from %s in %.3f ms\n", snapshot_path,
+               (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+    }
+    else
+    {
+        ht = ht_create(BUCKET_NUM, ELEMENT_NUM, HT_HASH, &ht_addr, &ht_size);
+        if (!ht)
+        {
+            fprintf(stderr, "ht_create failed\n");
+            goto out4;
+        }
+    }
+
+    // Backups get the whole region from the primary when joining, in large RDMA writes; a snapshot already has what
+    // was preloaded before it was taken, and preloading over it would bring back old values
+    if (preload_path && is_primary && is_loaded)
+    {
+        printf("preload of %s skipped over the snapshot\n", preload_path);
+    }
+    else if (preload_path && is_primary)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        long n = ht_preload(ht, preload_path, PRELOAD_THREAD);
+        if (n == -1)
+        {
+            fprintf(stderr, "ht_preload failed\n");
+            goto out5;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%ld records preloaded from %s in %.3f ms\n", n, preload_path,
+               (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+    }
+
+    // Only the primary logs PUTs, backups get them from it; the log continues the snapshot
+    struct wal *wal = NULL;
+    if (wal_path && is_primary)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        long n = wal_replay(wal_path, ht);
+        if (n == -1)
+        {
+            fprintf(stderr, "wal_replay failed\n");
+            goto out5;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%ld records replayed from %s in %.3f ms\n", n, wal_path,
+               (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+        wal = wal_open(wal_path, WAL_BATCH_US);
+        if (!wal)
+        {
+            fprintf(stderr, "wal_open failed\n");
+            goto out5;
+        }
+    }
+
+    printf("hashtable initiated at %p with size %lu\n", (void *)ht_addr, ht_size);
+
+    // Setup socket connections for clients and backup RDMA connection
+    int sockfd = sokt_passive_open(NULL, name_self.port);
+    if (sockfd == -1)
+    {
+        fprintf(stderr, "sokt_passive_open failed\n");
+        goto out6;
+    }
+
+    // Setup RDMA connections with other servers
+    struct rdma_context *rdma_ctx = rdma_open_connection(is_primary, sockfd, &name_others, others_num, wait_num, ports, port_num, ht_addr, ht_size);
+    if (!rdma_ctx)
+    {
+        fprintf(stderr, "rdma_open_connection failed\n");
+        goto out7;
+    }
+
+    // Hand replication over to a single thread
+    struct repl *repl = NULL;
+#ifdef REPL_THREAD
+    if (is_primary)
+    {
+        repl = repl_create(rdma_ctx, others_num, SERVER_THREAD + 1); // The sweeper has a ring of its own
+        if (!repl)
+        {
+            fprintf(stderr, "repl_create failed\n");
+            goto out8;
+        }
+    }
+#endif
+
+    // Reclaim expired keys in the background, GETs already miss them
+    struct sweep_info sweep_info = {locks, ht, rdma_ctx, repl, wal, others_num};
+    if (is_primary)
+    {
+        // A snapshot or the log may have brought keys that expire, nothing runs on the table yet
+        ht_key_t key;
+        for (unsigned b = 0; b < ht_bucket_num(ht) && !atomic_load(&has_ttl); b++)
+        {
+            if (ht_expired(ht, b, INT64_MAX, &key) == 0)
+            {
+                atomic_store(&has_ttl, 1);
+            }
+        }
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, handle_sweep, &sweep_info) != 0)
+        {
+            perror("pthread_create");
+            goto out9;
+        }
+        pthread_detach(tid);
+    }
+
+    // Run the key-value store
+    printf("\nrunning experiments\n");
+
+    while (1)
+    {
+        struct handle_client_info *info = calloc(1, sizeof(struct handle_client_info));
+        if (!info)
+        {
+            perror("calloc for info");
+            continue;
+        }
+
+        info->connfd = sokt_passive_accept_open(sockfd);
+        if (info->connfd == -1)
+        {
+            fprintf(stderr, "sokt_passive_accept_open failed\n");
+            free(info);
+            continue;
+        }
+
+#ifdef TRACE
+        info->accepted = trace_ticks();
+#endif
+        count(&accepted, 1);
+
+        info->is_primary = is_primary;
+        info->locks = locks;
+        info->ht = ht;
+        info->rdma_ctx = rdma_ctx;
+        info->repl = repl;
+        info->wal = wal;
+        info->others_num = others_num;
+        info->snapshot_path = snapshot_path;
+        info->trace = trace;
+        info->trace_path = trace_path;
+        info->pool = pool;
+        info->heat = heat;
+        info->capture = capture;
+
+        if (pool_add(pool, handle_client, info) == -1)
+        {
+            fprintf(stderr, "pool_add failed\n");
+        }
+    }
+
+    // Release resources
+    rv = EXIT_SUCCESS;
+
+out9:
+    repl_destroy(repl);
+
+#ifdef REPL_THREAD
+out8:
+#endif
+    rdma_close_connection(rdma_ctx, others_num);
+
+out7:
+    sokt_passive_close(sockfd);
+
+out6:
+    wal_close(wal);
+
+out5:
+    ht_destroy(ht);
+
+out4:
+    lock_destroy(locks);
+
+out3:
+    capture_close(capture);
+    heat_destroy(heat);
+    trace_destroy(trace);
+    pool_free(pool);
+
+out2:
+    if (name_others)
+    {
+        free(name_others);
+    }
+
+out1:
+    free(ports);
+
+    return rv;
+}
+
+void *handle_client(void *info)
+{
+    unsigned id = ((struct handle_client_info *)info)->id;
+    int connfd = ((struct handle_client_info *)info)->connfd;
+    char is_primary = ((struct handle_client_info *)info)->is_primary;
+    struct lock_table *locks = ((struct handle_client_info *)info)->locks;
+    struct ht *ht = ((struct handle_client_info *)info)->ht;
+    struct rdma_context *rdma_ctx = ((struct handle_client_info *)info)->rdma_ctx;
+    struct repl *repl = ((struct handle_client_info *)info)->repl;
+    struct wal *wal = ((struct handle_client_info *)info)->wal;
+    int others_num = ((struct handle_client_info *)info)->others_num;
+    const char *snapshot_path = ((struct handle_client_info *)info)->snapshot_path;
+    struct trace *trace = ((struct handle_client_info *)info)->trace;
+    const char *trace_path = ((struct handle_client_info *)info)->trace_path;
+    pool_t pool = ((struct handle_client_info *)info)->pool;
+    struct heat *heat = ((struct handle_client_info *)info)->heat;
+    struct capture *capture = ((struct handle_client_info *)info)->capture;
+    struct trace_span *traced = NULL;
+
+#ifdef TRACE
+    struct trace_span span;
+    trace_begin(&span, ((struct handle_client_info *)info)->accepted);
+    traced = &span;
+    TRACE_MARK(traced, TRACE_PHASE_QUEUE);
+#endif
+
+    free(info);
+
+    struct sokt_message msg;
+    int ht_status;
+    char is_update;
+    char is_locked = 0;
+    uint64_t lock_id;
+    long ht_element_offset[2];
+    size_t ht_element_size[2];
+    enum sokt_message_code code;
+    int op = -1; // Index in ops, -1 for other requests
+    char *stats_text = NULL;
+    size_t stats_len = 0;
+
+    if (sokt_recv(connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_recv failed\n");
+        goto out1;
+    }
+    TRACE_MARK(traced, TRACE_PHASE_RECV);
+
+#ifdef LOG
+    printf("from client:\t");
+    skot_message_show(&msg);
+#endif
+
+    code = msg.code;
+    op = code_index(ops, OP_NUM, code);
+
+    // Transactions carry their keys after the message, and are left out of captures, which hold one key a request
+    if (op != -1 && code != SOKT_CODE_TXN)
+    {
+        heat_record(heat, id, ht_bucket(ht, msg.key), msg.key);
+
+        char has_value = code == SOKT_CODE_PUT || code == SOKT_CODE_CAS || code == SOKT_CODE_FADD;
+        if (capture && capture_append(capture, code, msg.key, msg.value, has_value ? sizeof(ht_value_t) : 0,
+                                      msg.expected, msg.ttl) == -1)
+        {
+            fprintf(stderr, "capture_append failed\n");
+        }
+    }
+    else if (code == SOKT_CODE_TXN && capture && !atomic_exchange(&is_txn_skipped, 1))
+    {
+        fprintf(stderr, "transactions are not captured, replays will go without them\n");
+    }
+
+    if (code == SOKT_CODE_JOIN && is_primary)
+    {
+        // Catching up takes a while, so it gets its own thread rather than a worker
+        struct handle_client_info *join_info = calloc(1, sizeof(struct handle_client_info));
+        if (!join_info)
+        {
+            perror("calloc for join_info");
+            goto out1;
+        }
+
+        join_info->connfd = connfd;
+        join_info->locks = locks;
+        join_info->rdma_ctx = rdma_ctx;
+        join_info->others_num = others_num;
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, handle_join, join_info) != 0)
+        {
+            perror("pthread_create");
+            free(join_info);
+            goto out1;
+        }
+        pthread_detach(tid);
+
+        return NULL;
+    }
+    else if ((code == SOKT_CODE_PUT || code == SOKT_CODE_INCR || code == SOKT_CODE_CAS || code == SOKT_CODE_FADD) &&
+             is_primary)
+    {
+        // Keys sharing a bucket share its chain, so the bucket is what gets locked
+        lock_id = ht_bucket(ht, msg.key);
+        if (lock_timed(locks, lock_id, 1, id) == 0)
+        {
+            is_locked = 1;
+            TRACE_MARK(traced, TRACE_PHASE_LOCK);
+
+            // The expiry time is absolute so that every replica agrees on it
+            int64_t expire = msg.ttl > 0 ? ht_time_ms() + msg.ttl : 0;
+            ht_value_t value = msg.value;
+            if (expire)
+            {
+                atomic_store(&has_ttl, 1);
+            }
+
+            // Read-modify-write operations end up as a PUT of the new value, logged and replicated as such
+            msg.code = code == SOKT_CODE_PUT ? SOKT_CODE_SUCCESS : modify(ht, code, &msg, &value, &expire);
+            if (msg.code != SOKT_CODE_SUCCESS)
+            {
+                TRACE_MARK(traced, TRACE_PHASE_HT);
+                goto reply;
+            }
+
+            // What the PUT replaces, to undo it if it cannot be logged
+            ht_value_t old_value;
+            int64_t old_expire;
+            if (wal)
+            {
+                ht_find(ht, msg.key, &old_value, &old_expire);
+            }
+
+            ht_status = ht_put_expire(ht, msg.key, value, expire, &is_update, ht_element_offset, ht_element_size);
+#ifdef EVICTION
+            // Make room by evicting a key not used recently
+            for (int i = 0; ht_status == HT_CODE_FULL && i < EVICT_TRY_MAX; i++)
+            {
+                if (evict(ht, locks, lock_id, wal, rdma_ctx, repl, id, others_num) == 0)
+                {
+                    ht_status =
+                        ht_put_expire(ht, msg.key, value, expire, &is_update, ht_element_offset, ht_element_size);
+                }
+            }
+#endif
+            TRACE_MARK(traced, TRACE_PHASE_HT);
+            switch (ht_status)
+            {
+            case HT_CODE_SUCCESS:
+                msg.code = SOKT_CODE_SUCCESS;
+                if (wal && wal_append(wal, WAL_CODE_PUT, msg.key, value, expire) == -1)
+                {
+                    // Nothing has been replicated yet, so the table goes back to what the log has
+                    fprintf(stderr, "wal_append failed\n");
+                    msg.code = SOKT_CODE_ERROR;
+                    if (is_update)
+                    {
+                        ht_put_expire(ht, msg.key, old_value, old_expire, NULL, NULL, NULL);
+                    }
+                    else
+                    {
+                        ht_del(ht, msg.key, NULL, NULL);
+                    }
+                }
+                TRACE_MARK(traced, TRACE_PHASE_WAL);
+                break;
+            case HT_CODE_FULL:
+                msg.code = SOKT_CODE_FULL;
+                break;
+            default:
+                msg.code = SOKT_CODE_ERROR;
+                break;
+            }
+        }
+        else
+        {
+            perror("lock_wrlock");
+            msg.code = SOKT_CODE_ERROR;
+        }
+    }
+    else if (code == SOKT_CODE_DEL && is_primary)
+    {
+        lock_id = ht_bucket(ht, msg.key);
+        if (lock_timed(locks, lock_id, 1, id) == 0)
+        {
+            is_locked = 1;
+            TRACE_MARK(traced, TRACE_PHASE_LOCK);
+
+            // Logged before deleting, as putting the element back would not restore the order of its chain
+            ht_value_t old_value;
+            int64_t old_expire;
+            ht_status = HT_CODE_SUCCESS;
+            if (wal && (ht_status = ht_find(ht, msg.key, &old_value, &old_expire)) == HT_CODE_SUCCESS &&
+                wal_append(wal, WAL_CODE_DEL, msg.key, 0, 0) == -1)
+            {
+                fprintf(stderr, "wal_append failed\n");
+                ht_status = HT_CODE_ERROR;
+            }
+            TRACE_MARK(traced, TRACE_PHASE_WAL);
+
+            if (ht_status == HT_CODE_SUCCESS)
+            {
+                ht_status = ht_del(ht, msg.key, ht_element_offset, ht_element_size);
+            }
+            TRACE_MARK(traced, TRACE_PHASE_HT);
+            switch (ht_status)
+            {
+            case HT_CODE_SUCCESS:
+                msg.code = SOKT_CODE_SUCCESS;
+                break;
+            case HT_CODE_NOT_FOUND:
+                msg.code = SOKT_CODE_NOT_FOUND;
+                break;
+            default:
+                msg.code = SOKT_CODE_ERROR;
+                break;
+            }
+        }
+        else
+        {
+            perror("lock_wrlock");
+            msg.code = SOKT_CODE_ERROR;
+        }
+    }
+    else if (code == SOKT_CODE_TXN && is_primary)
+    {
+        struct sokt_message puts[TXN_KEY_MAX];
+        int n = msg.value;
+
+        if (n <= 0 || n > TXN_KEY_MAX)
+        {
+            fprintf(stderr, "transaction of %d keys\n", n);
+            msg.code = SOKT_CODE_ERROR;
+        }
+        else if (sokt_recv(connfd, (char *)puts, n * sizeof(struct sokt_message)) != 0)
+        {
+            fprintf(stderr, "sokt_recv failed\n");
+            goto out1;
+        }
+        else
+        {
+            // Locked, logged and replicated as a whole before replying
+            msg.code = txn(ht, locks, wal, rdma_ctx, repl, id, others_num, puts, n, traced);
+        }
+    }
+    else if (code == SOKT_CODE_GET)
+    {
+        lock_id = ht_bucket(ht, msg.key);
+        if (lock_timed(locks, lock_id, 0, id) == 0)
+        {
+            is_locked = 1;
+            TRACE_MARK(traced, TRACE_PHASE_LOCK);
+
+            ht_status = ht_get(ht, msg.key, &msg.value, is_primary);
+            TRACE_MARK(traced, TRACE_PHASE_HT);
+            switch (ht_status)
+            {
+            case HT_CODE_SUCCESS:
+                msg.code = SOKT_CODE_SUCCESS;
+                break;
+            case HT_CODE_NOT_FOUND:
+                msg.code = SOKT_CODE_NOT_FOUND;
+                break;
+            default:
+                msg.code = SOKT_CODE_ERROR;
+                break;
+            }
+        }
+        else
+        {
+            perror("lock_rdlock");
+            msg.code = SOKT_CODE_ERROR;
+        }
+    }
+    else if (code == SOKT_CODE_CHECKPOINT && snapshot_path && rdma_is_fork_safe())
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&is_checkpointing, &expected, 1))
+        {
+            struct checkpoint_info *ckpt_info = calloc(1, sizeof(struct checkpoint_info));
+            if (!ckpt_info)
+            {
+                perror("calloc for ckpt_info");
+                atomic_store(&is_checkpointing, 0);
+                goto out1;
+            }
+
+            ckpt_info->connfd = connfd;
+            ckpt_info->snapshot_path = snapshot_path;
+            ckpt_info->wal = wal;
+
+            // PUTs are only paused for the fork, the child writes its copy of the table meanwhile
+            if (lock_wrlock_all(locks) == 0)
+            {
+                struct timespec forked;
+                clock_gettime(CLOCK_MONOTONIC, &ckpt_info->start);
+
+                // Appends are durable before the bucket lock is released, so the log ends at the forked image
+                if (wal)
+                {
+                    ckpt_info->wal_position = wal_position(wal);
+                }
+
+                ckpt_info->pid = ht_fork_save(ht, snapshot_path, is_primary);
+
+                clock_gettime(CLOCK_MONOTONIC, &forked);
+                if (lock_unlock_all(locks) != 0)
+                {
+                    perror("lock_unlock_all"); // Should rarely happen
+                }
+
+                ckpt_info->pause_ms = (forked.tv_sec - ckpt_info->start.tv_sec) * 1000.0 +
+                                      (forked.tv_nsec - ckpt_info->start.tv_nsec) / 1000000.0;
+            }
+            else
+            {
+                perror("lock_wrlock_all");
+                ckpt_info->pid = -1;
+            }
+
+            pthread_t tid;
+            if (ckpt_info->pid != -1 && pthread_create(&tid, NULL, handle_checkpoint, ckpt_info) == 0)
+            {
+                pthread_detach(tid);
+                return NULL;
+            }
+
+            if (ckpt_info->pid != -1)
+            {
+                perror("pthread_create");
+                waitpid(ckpt_info->pid, NULL, 0);
+            }
+            else
+            {
+                fprintf(stderr, "ht_fork_save failed\n");
+            }
+
+            free(ckpt_info);
+            atomic_store(&is_checkpointing, 0);
+        }
+        else
+        {
+            fprintf(stderr, "a checkpoint is already running\n");
+        }
+
+        msg.code = SOKT_CODE_ERROR;
+    }
+    else if ((code == SOKT_CODE_SAVE || code == SOKT_CODE_CHECKPOINT) && snapshot_path)
+    {
+        if (code == SOKT_CODE_CHECKPOINT)
+        {
+            printf("fork is not safe with registered memory here, checkpointing with PUTs paused\n");
+        }
+
+        // Stop the world, so that the snapshot is a consistent image
+        if (atomic_load(&is_checkpointing))
+        {
+            fprintf(stderr, "a checkpoint is already running\n");
+            msg.code = SOKT_CODE_ERROR;
+        }
+        else if (lock_wrlock_all(locks) == 0)
+        {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            msg.code = ht_save(ht, snapshot_path, is_primary) == 0 ? SOKT_CODE_SUCCESS : SOKT_CODE_ERROR;
+
+            // Everything logged so far is in the snapshot now
+            if (msg.code == SOKT_CODE_SUCCESS && wal && wal_truncate(wal) == -1)
+            {
+                fprintf(stderr, "wal_truncate failed\n");
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (lock_unlock_all(locks) != 0)
+            {
+                perror("lock_unlock_all"); // Should rarely happen
+            }
+
+            if (msg.code == SOKT_CODE_SUCCESS)
+            {
+                printf("snapshot saved to %s in %.3f ms\n", snapshot_path,
+                       (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+            }
+            else
+            {
+                fprintf(stderr, "ht_save failed\n");
+            }
+        }
+        else
+        {
+            perror("lock_wrlock_all");
+            msg.code = SOKT_CODE_ERROR;
+        }
+    }
+    else if (code == SOKT_CODE_STATS)
+    {
+        FILE *fp = open_memstream(&stats_text, &stats_len);
+        if (!fp)
+        {
+            perror("open_memstream");
+            msg.code = SOKT_CODE_ERROR;
+        }
+        else
+        {
+            int rv = write_stats(fp, pool, ht, heat, rdma_ctx, wal, others_num, is_primary);
+            if (fclose(fp) != 0 || rv == -1)
+            {
+                fprintf(stderr, "write_stats failed\n");
+                msg.code = SOKT_CODE_ERROR;
+            }
+            else
+            {
+                msg.code = SOKT_CODE_SUCCESS;
+                msg.value = stats_len;
+            }
+        }
+    }
+    else if (code == SOKT_CODE_TRACE && trace)
+    {
+        trace_show(trace);
+
+        FILE *fp = fopen(trace_path, "w");
+        if (!fp)
+        {
+            perror("fopen");
+            msg.code = SOKT_CODE_ERROR;
+        }
+        else
+        {
+            msg.code = trace_dump(trace, fp) == 0 ? SOKT_CODE_SUCCESS : SOKT_CODE_ERROR;
+            if (fclose(fp) != 0)
+            {
+                perror("fclose");
+                msg.code = SOKT_CODE_ERROR;
+            }
+
+            if (msg.code == SOKT_CODE_SUCCESS)
+            {
+                printf("trace dumped to %s\n", trace_path);
+            }
+        }
+    }
+    else
+    {
+        msg.code = SOKT_CODE_ERROR;
+    }
+
+reply:
+    if (sokt_send(connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out2;
+    }
+
+    if (code == SOKT_CODE_STATS && msg.code == SOKT_CODE_SUCCESS && sokt_send(connfd, stats_text, stats_len) != 0)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+        goto out2;
+    }
+    TRACE_MARK(traced, TRACE_PHASE_REPLY);
+
+#ifdef LOG
+    printf("to   client:\t");
+    skot_message_show(&msg);
+#endif
+
+    if ((code == SOKT_CODE_PUT || code == SOKT_CODE_DEL || code == SOKT_CODE_INCR || code == SOKT_CODE_CAS ||
+         code == SOKT_CODE_FADD) &&
+        msg.code == SOKT_CODE_SUCCESS && is_primary)
+    {
+        // The new element is written before the predecessor linking it, a deletion only rewrites the predecessor
+        int n = code != SOKT_CODE_DEL && !is_update ? 2 : 1;
+
+        if (replicate(rdma_ctx, repl, id, ht_element_offset, ht_element_size, n, others_num, traced) == -1)
+        {
+            fprintf(stderr, "replicate failed\n");
+            goto out2;
+        }
+    }
+
+out2:
+    if (is_locked && lock_unlock(locks, lock_id) != 0)
+    {
+        perror("lock_unlock"); // Should rarely happen
+    }
+
+    int result = code_index(results, RESULT_NUM, msg.code);
+    if (op != -1 && result != -1)
+    {
+        count(&worker_stats[id].ops[op][result], 1);
+    }
+
+#ifdef TRACE
+    if (op != -1)
+    {
+        trace_end(trace, id, &span, op_names[op]);
+    }
+#endif
+
+    free(stats_text);
+
+out1:
+    sokt_passive_accept_close(connfd);
+    count(&worker_stats[id].closed, 1);
+
+    return NULL;
+}
+
+int replicate(struct rdma_context *rdma_ctx, struct repl *repl, unsigned worker, const long *offsets,
+              const size_t *sizes, int n, int others_num, struct trace_span *span)
+{
+    if (repl)
+    {
+        if (repl_write(repl, worker, offsets, sizes, n) == -1)
+        {
+            fprintf(stderr, "repl_write failed\n");
+            return -1;
+        }
+        TRACE_MARK(span, TRACE_PHASE_POST);
+
+        return 0;
+    }
+
+    if (rdma_write_batch_all(rdma_ctx, offsets, sizes, n, others_num) == -1)
+    {
+        fprintf(stderr, "rdma_write_batch_all failed\n");
+        return -1;
+    }
+    TRACE_MARK(span, TRACE_PHASE_POST);
+
+    if (rdma_wait_completion_all(rdma_ctx, others_num) == -1)
+    {
+        fprintf(stderr, "rdma_wait_completion_all failed\n");
+        return -1;
+    }
+    TRACE_MARK(span, TRACE_PHASE_WAIT);
+
+    return 0;
+}
+
+// Work out the value to put for a read-modify-write operation and the value to reply with, a key keeps its expiry
+enum sokt_message_code modify(const struct ht *ht, enum sokt_message_code code, struct sokt_message *msg,
+                              ht_value_t *value, int64_t *expire)
+{
+    ht_value_t old;
+    int64_t old_expire;
+
+    switch (ht_get_expire(ht, msg->key, &old, &old_expire, 1))
+    {
+    case HT_CODE_SUCCESS:
+        *expire = old_expire;
+        break;
+    case HT_CODE_NOT_FOUND:
+        if (code == SOKT_CODE_CAS)
+        {
+            return SOKT_CODE_NOT_FOUND;
+        }
+        old = 0; // Counters start from zero
+        break;
+    default:
+        return SOKT_CODE_ERROR;
+    }
+
+    // Counters wrap around like unsigned integers instead of overflowing
+    switch (code)
+    {
+    case SOKT_CODE_INCR:
+        *value = (ht_value_t)((uint32_t)old + 1);
+        msg->value = *value;
+        break;
+    case SOKT_CODE_FADD:
+        *value = (ht_value_t)((uint32_t)old + (uint32_t)msg->value);
+        msg->value = old;
+        break;
+    case SOKT_CODE_CAS:
+        if (old != msg->expected)
+        {
+            msg->value = old;
+            return SOKT_CODE_MISMATCH;
+        }
+        *value = msg->value;
+        break;
+    default:
+        return SOKT_CODE_ERROR;
+    }
+
+    return SOKT_CODE_SUCCESS;
+}
+
+// Apply several PUTs so that neither the primary nor backups show some of them without the others; the buckets are
+// locked in stripe order to avoid deadlocks, and replicated between their begin and end versions
+enum sokt_message_code txn(struct ht *ht, struct lock_table *locks, struct wal *wal, struct rdma_context *rdma_ctx,
+                           struct repl *repl, unsigned worker, int others_num, const struct sokt_message *puts, int n,
+                           struct trace_span *span)
+{
+    // Declared before the first goto and cleared, as the compiler cannot tell that n keys fill what is read
+    unsigned buckets[TXN_KEY_MAX];
+    int bucket_num = 0;
+
+    // Begin versions first, end versions last, changes in between
+    long offsets[RDMA_BATCH_MAX] = {0};
+    size_t sizes[RDMA_BATCH_MAX] = {0};
+    int range_num = 0;
+
+    ht_key_t keys[TXN_KEY_MAX] = {0};
+    ht_value_t values[TXN_KEY_MAX] = {0}, olds[TXN_KEY_MAX];
+    int64_t expires[TXN_KEY_MAX] = {0}, old_expires[TXN_KEY_MAX];
+    char is_found[TXN_KEY_MAX];
+
+    for (int i = 0; i < n; i++)
+    {
+        unsigned b = ht_bucket(ht, puts[i].key);
+        unsigned s = lock_stripe(locks, b);
+
+        int j = bucket_num;
+        while (j > 0 && (lock_stripe(locks, buckets[j - 1]) > s ||
+                         (lock_stripe(locks, buckets[j - 1]) == s && buckets[j - 1] > b)))
+        {
+            j--;
+        }
+
+        if (j > 0 && buckets[j - 1] == b)
+        {
+            continue;
+        }
+
+        for (int k = bucket_num; k > j; k--)
+        {
+            buckets[k] = buckets[k - 1];
+        }
+        buckets[j] = b;
+        bucket_num++;
+    }
+
+    // Buckets sharing a stripe are next to each other, the stripe is locked once
+    int locked;
+    for (locked = 0; locked < bucket_num; locked++)
+    {
+        if (locked > 0 && lock_stripe(locks, buckets[locked]) == lock_stripe(locks, buckets[locked - 1]))
+        {
+            continue;
+        }
+
+        if (lock_timed(locks, buckets[locked], 1, worker) != 0)
+        {
+            perror("lock_wrlock");
+            break;
+        }
+    }
+
+    enum sokt_message_code code = SOKT_CODE_ERROR;
+    if (locked < bucket_num)
+    {
+        goto out;
+    }
+    TRACE_MARK(span, TRACE_PHASE_LOCK);
+
+    range_num = bucket_num;
+
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        keys[i] = puts[i].key;
+        values[i] = puts[i].value;
+        expires[i] = puts[i].ttl > 0 ? ht_time_ms() + puts[i].ttl : 0;
+        if (expires[i])
+        {
+            atomic_store(&has_ttl, 1);
+        }
+        is_found[i] = ht_find(ht, keys[i], &olds[i], &old_expires[i]) == HT_CODE_SUCCESS;
+
+        char is_update;
+        enum ht_code ht_status =
+            ht_put_expire(ht, keys[i], values[i], expires[i], &is_update, offsets + range_num, sizes + range_num);
+        if (ht_status != HT_CODE_SUCCESS)
+        {
+            code = ht_status == HT_CODE_FULL ? SOKT_CODE_FULL : SOKT_CODE_ERROR;
+            break;
+        }
+
+        range_num += is_update ? 1 : 2;
+    }
+
+    TRACE_MARK(span, TRACE_PHASE_HT);
+
+    char is_logged = i == n;
+    if (is_logged && wal && wal_append_txn(wal, keys, values, expires, n) == -1)
+    {
+        fprintf(stderr, "wal_append_txn failed\n");
+        code = SOKT_CODE_ERROR;
+        is_logged = 0;
+    }
+    TRACE_MARK(span, TRACE_PHASE_WAL);
+
+    // Nothing has left the primary yet, so undoing the PUTs locally in reverse is enough
+    if (!is_logged)
+    {
+        while (i-- > 0)
+        {
+            if (is_found[i])
+            {
+                ht_put_expire(ht, keys[i], olds[i], old_expires[i], NULL, NULL, NULL);
+            }
+            else
+            {
+                ht_del(ht, keys[i], NULL, NULL);
+            }
+        }
+
+        goto out;
+    }
+
+    code = SOKT_CODE_SUCCESS;
+
+    for (int j = 0; j < bucket_num; j++)
+    {
+        long version_offsets[2];
+        size_t version_sizes[2];
+
+        ht_version(ht, buckets[j], version_offsets, version_sizes);
+        offsets[j] = version_offsets[0];
+        sizes[j] = version_sizes[0];
+        offsets[range_num] = version_offsets[1];
+        sizes[range_num] = version_sizes[1];
+        range_num++;
+    }
+
+    if (replicate(rdma_ctx, repl, worker, offsets, sizes, range_num, others_num, span) == -1)
+    {
+        fprintf(stderr, "replicate failed\n");
+        code = SOKT_CODE_ERROR;
+    }
+
+out:
+    while (locked-- > 0)
+    {
+        if ((locked == 0 || lock_stripe(locks, buckets[locked]) != lock_stripe(locks, buckets[locked - 1])) &&
+            lock_unlock(locks, buckets[locked]) != 0)
+        {
+            perror("lock_unlock"); // Should rarely happen
+        }
+    }
+
+    return code;
+}
+
+// Delete the key picked by CLOCK like a DEL would, without waiting for the lock of its bucket
+int evict(struct ht *ht, struct lock_table *locks, uint64_t held_id, struct wal *wal, struct rdma_context *rdma_ctx,
+          struct repl *repl, unsigned worker, int others_num)
+{
+    ht_key_t victim;
+    if (ht_evict_candidate(ht, &victim) == -1)
+    {
+        return -1;
+    }
+
+    // Waiting could deadlock with a PUT evicting from the bucket held here
+    uint64_t victim_id = ht_bucket(ht, victim);
+    char is_held = lock_stripe(locks, victim_id) == lock_stripe(locks, held_id);
+    if (!is_held && lock_trywrlock(locks, victim_id) == -1)
+    {
+        return -1;
+    }
+
+    int rv = -1;
+    long offset;
+    size_t size;
+
+    ht_value_t value;
+    int64_t expire;
+    enum ht_code ht_status = HT_CODE_SUCCESS;
+
+    // Logged before deleting, so that a victim that cannot be logged stays
+    if (wal && (ht_status = ht_find(ht, victim, &value, &expire)) == HT_CODE_SUCCESS &&
+        wal_append(wal, WAL_CODE_DEL, victim, 0, 0) == -1)
+    {
+        fprintf(stderr, "wal_append failed\n");
+        ht_status = HT_CODE_ERROR;
+    }
+
+    if (ht_status == HT_CODE_SUCCESS && ht_del(ht, victim, &offset, &size) == HT_CODE_SUCCESS)
+    {
+        rv = 0;
+
+        if (replicate(rdma_ctx, repl, worker, &offset, &size, 1, others_num, NULL) == -1)
+        {
+            fprintf(stderr, "replicate failed\n");
+            rv = -1;
+        }
+    }
+
+    if (!is_held && lock_unlock(locks, victim_id) != 0)
+    {
+        perror("lock_unlock"); // Should rarely happen
+    }
+
+    return rv;
+}
+
+// Delete expired keys a few buckets at a time like DELs would, so that PUTs only ever wait for one bucket. With
+// REPL_THREAD the deletions go through a ring of their own, otherwise the sweeper posts to the shared QPs and polls
+// their CQs like one more server thread, which MAX_SEND_WR leaves room for
+void *handle_sweep(void *info)
+{
+    struct lock_table *locks = ((struct sweep_info *)info)->locks;
+    struct ht *ht = ((struct sweep_info *)info)->ht;
+    struct rdma_context *rdma_ctx = ((struct sweep_info *)info)->rdma_ctx;
+    struct repl *repl = ((struct sweep_info *)info)->repl;
+    struct wal *wal = ((struct sweep_info *)info)->wal;
+    int others_num = ((struct sweep_info *)info)->others_num;
+
+    struct timespec interval = {SWEEP_INTERVAL_MS / 1000, SWEEP_INTERVAL_MS % 1000 * 1000000};
+    unsigned bucket_num = ht_bucket_num(ht);
+    unsigned bucket = 0;
+
+    while (1)
+    {
+        nanosleep(&interval, NULL);
+
+        // Without TTLs there is nothing to reclaim, and no reason to take bucket locks or touch the CQs
+        if (!atomic_load(&has_ttl))
+        {
+            continue;
+        }
+
+        int64_t now = ht_time_ms();
+        for (int i = 0; i < SWEEP_BUCKET_NUM; i++, bucket = (bucket + 1) % bucket_num)
+        {
+            if (lock_wrlock(locks, bucket) != 0)
+            {
+                perror("lock_wrlock");
+                continue;
+            }
+
+            ht_key_t key;
+            long offset;
+            size_t size;
+
+            // Expired keys are logged before they are deleted, a bucket that cannot be logged is left for later
+            while (ht_expired(ht, bucket, now, &key) == 0)
+            {
+                if (wal && wal_append(wal, WAL_CODE_DEL, key, 0, 0) == -1)
+                {
+                    fprintf(stderr, "wal_append failed\n");
+                    break;
+                }
+
+                if (ht_del(ht, key, &offset, &size) != HT_CODE_SUCCESS)
+                {
+                    break;
+                }
+
+                // Workers use rings 0 to SERVER_THREAD - 1
+                if (replicate(rdma_ctx, repl, SERVER_THREAD, &offset, &size, 1, others_num, NULL) == -1)
+                {
+                    fprintf(stderr, "replicate failed\n");
+                }
+            }
+
+            if (lock_unlock(locks, bucket) != 0)
+            {
+                perror("lock_unlock"); // Should rarely happen
+            }
+        }
+    }
+
+    return NULL;
+}
+
+void *handle_join(void *info)
+{
+    int connfd = ((struct handle_client_info *)info)->connfd;
+    struct lock_table *locks = ((struct handle_client_info *)info)->locks;
+    struct rdma_context *rdma_ctx = ((struct handle_client_info *)info)->rdma_ctx;
+    int others_num = ((struct handle_client_info *)info)->others_num;
+
+    free(info);
+
+    struct sokt_message msg = {.code = SOKT_CODE_ERROR};
+    struct timespec start, copied, paused, end;
+    long region, dirty = 0, dirty_paused;
+    int passes = 0; // That copied something
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int index = rdma_accept_backup(rdma_ctx, connfd, others_num);
+    if (index == -1)
+    {
+        fprintf(stderr, "rdma_accept_backup failed\n");
+        goto out1;
+    }
+
+    // Copy the region while PUTs keep flowing, then close the gap left by them
+    region = rdma_copy_region(rdma_ctx, index);
+    if (region == -1)
+    {
+        fprintf(stderr, "rdma_copy_region failed\n");
+        goto out2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &copied);
+
+    for (int pass = 0; pass < CATCH_UP_PASS_MAX; pass++)
+    {
+        long n = rdma_copy_dirty(rdma_ctx, index);
+        if (n == -1)
+        {
+            fprintf(stderr, "rdma_copy_dirty failed\n");
+            goto out2;
+        }
+
+        dirty += n;
+        passes += n > 0;
+        if (n <= CATCH_UP_PAUSE_BYTES)
+        {
+            break;
+        }
+    }
+
+    // Pause PUTs for the last pass, so that none of them misses the backup
+    clock_gettime(CLOCK_MONOTONIC, &paused);
+
+    if (lock_wrlock_all(locks) == -1)
+    {
+        perror("lock_wrlock_all");
+        goto out2;
+    }
+
+    dirty_paused = rdma_copy_dirty(rdma_ctx, index);
+    if (dirty_paused != -1)
+    {
+        rdma_set_live(rdma_ctx, index);
+    }
+
+    if (lock_unlock_all(locks) == -1)
+    {
+        perror("lock_unlock_all"); // Should rarely happen
+    }
+
+    if (dirty_paused == -1)
+    {
+        fprintf(stderr, "rdma_copy_dirty failed\n");
+        goto out2;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double copy_ms = (copied.tv_sec - start.tv_sec) * 1000.0 + (copied.tv_nsec - start.tv_nsec) / 1000000.0;
+    double pause_ms = (end.tv_sec - paused.tv_sec) * 1000.0 + (end.tv_nsec - paused.tv_nsec) / 1000000.0;
+    double total_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    printf("backup %d joined in %.3f ms: region %ld bytes in %.3f ms (%.1f MB/s), "
+           "%ld dirty bytes in %d passes, %ld bytes in a %.3f ms pause\n",
+           index, total_ms, region, copy_ms, region / copy_ms / 1000, dirty, passes, dirty_paused, pause_ms);
+
+    msg.code = SOKT_CODE_SUCCESS;
+    goto out1;
+
+out2:
+    rdma_abort_backup(rdma_ctx, index);
+
+out1:
+    if (sokt_send(connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+    }
+
+    sokt_passive_accept_close(connfd);
+    atomic_fetch_add(&closed_elsewhere, 1);
+
+    return NULL;
+}
+
+void *handle_checkpoint(void *info)
+{
+    struct checkpoint_info ckpt_info = *(struct checkpoint_info *)info;
+
+    free(info);
+
+    struct sokt_message msg = {.code = SOKT_CODE_ERROR};
+    struct timespec end;
+    int status;
+
+    if (waitpid(ckpt_info.pid, &status, 0) == -1)
+    {
+        perror("waitpid");
+    }
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("checkpoint saved to %s in %.3f ms, PUTs paused for %.3f ms\n", ckpt_info.snapshot_path,
+               (end.tv_sec - ckpt_info.start.tv_sec) * 1000.0 + (end.tv_nsec - ckpt_info.start.tv_nsec) / 1000000.0,
+               ckpt_info.pause_ms);
+        msg.code = SOKT_CODE_SUCCESS;
+
+        // Records logged since the fork are not in the snapshot, so only those before it go
+        if (ckpt_info.wal && wal_truncate_before(ckpt_info.wal, ckpt_info.wal_position) == -1)
+        {
+            fprintf(stderr, "wal_truncate_before failed\n");
+        }
+    }
+    else
+    {
+        fprintf(stderr, "checkpoint child failed\n");
+    }
+
+    atomic_store(&is_checkpointing, 0);
+
+    if (sokt_send(ckpt_info.connfd, (char *)&msg, sizeof(struct sokt_message)) != 0)
+    {
+        fprintf(stderr, "sokt_send failed\n");
+    }
+
+    sokt_passive_accept_close(ckpt_info.connfd);
+    atomic_fetch_add(&closed_elsewhere, 1);
+
+    return NULL;
+}
+
+// Parse "dev[:port],dev[:port]..." in place
+int parse_ports(char *arg, struct rdma_port **ports)
+{
+    int n = 1;
+    for (char *c = arg; *c; c++)
+    {
+        if (*c == ',')
+        {
+            n++;
+        }
+    }
+
+    *ports = calloc(n, sizeof(struct rdma_port));
+    if (!*ports)
+    {
+        perror("calloc for ports");
+        return -1;
+    }
+
+    n = 0;
+    for (char *dev = strtok(arg, ","); dev; dev = strtok(NULL, ","))
+    {
+        char *port = strchr(dev, ':');
+        if (port)
+        {
+            *port++ = '\0';
+        }
+
+        (*ports)[n].dev_name = dev;
+        (*ports)[n].port = port ? atoi(port) : 1;
+        n++;
+    }
+
+    return n;
+}
+// Take a lock, adding how long it took to wait for it to the counters of the worker
+int lock_timed(struct lock_table *locks, uint64_t id, char is_write, unsigned worker)
+{
+    struct timespec start, end;
+    int rv;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rv = is_write ? lock_wrlock(locks, id) : lock_rdlock(locks, id);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    count(&worker_stats[worker].lock_waits, 1);
+    count(&worker_stats[worker].lock_wait_ns, (end.tv_sec - start.tv_sec) * 1000000000L + end.tv_nsec - start.tv_nsec);
+
+    return rv;
+}
+
+// Counters have a single writer, so they need no atomic read-modify-write
+void count(atomic_ulong *counter, unsigned long n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+int code_index(const enum sokt_message_code *codes, int n, enum sokt_message_code code)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (codes[i] == code)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Write the counters in the Prometheus text format, summing those of the workers
+int write_stats(FILE *fp, pool_t pool, struct ht *ht, struct heat *heat, struct rdma_context *rdma_ctx,
+                struct wal *wal, int others_num, char is_primary)
+{
+    unsigned long sum, waits = 0, wait_ns = 0, closed = atomic_load(&closed_elsewhere);
+
+    fprintf(fp, "# TYPE kv_ops_total counter\n");
+    for (int op = 0; op < OP_NUM; op++)
+    {
+        for (int result = 0; result < RESULT_NUM; result++)
+        {
+            sum = 0;
+            for (int i = 0; i < SERVER_THREAD; i++)
+            {
+                sum += atomic_load_explicit(&worker_stats[i].ops[op][result], memory_order_relaxed);
+            }
+
+            if (sum > 0)
+            {
+                fprintf(fp, "kv_ops_total{op=\"%s\",result=\"%s\"} %lu\n", op_names[op], result_names[result], sum);
+            }
+        }
+    }
+
+    for (int i = 0; i < SERVER_THREAD; i++)
+    {
+        waits += atomic_load_explicit(&worker_stats[i].lock_waits, memory_order_relaxed);
+        wait_ns += atomic_load_explicit(&worker_stats[i].lock_wait_ns, memory_order_relaxed);
+        closed += atomic_load_explicit(&worker_stats[i].closed, memory_order_relaxed);
+    }
+
+    // The connection asking for statistics is still open
+    unsigned long total = atomic_load(&accepted);
+    fprintf(fp, "# TYPE kv_lock_waits_total counter\nkv_lock_waits_total %lu\n", waits);
+    fprintf(fp, "# TYPE kv_lock_wait_seconds_total counter\nkv_lock_wait_seconds_total %.9f\n", wait_ns / 1e9);
+    fprintf(fp, "# TYPE kv_pool_queued gauge\nkv_pool_queued %u\n", pool_queued(pool));
+    fprintf(fp, "# TYPE kv_connections_total counter\nkv_connections_total %lu\n", total);
+    fprintf(fp, "# TYPE kv_connections_active gauge\nkv_connections_active %lu\n", total > closed ? total - closed : 0);
+
+    if (is_primary)
+    {
+        char is_live;
+        unsigned long writes, bytes, polls, sleeps;
+
+        fprintf(fp, "# TYPE kv_backup_live gauge\n# TYPE kv_backup_writes_total counter\n"
+                    "# TYPE kv_backup_bytes_total counter\n# TYPE kv_backup_cq_polls_total counter\n"
+                    "# TYPE kv_backup_cq_sleeps_total counter\n");
+        for (int i = 0; i < others_num; i++)
+        {
+            rdma_conn_stats(rdma_ctx, i, &is_live, &writes, &bytes, &polls, &sleeps);
+            fprintf(fp, "kv_backup_live{backup=\"%d\"} %d\n", i, is_live);
+            fprintf(fp, "kv_backup_writes_total{backup=\"%d\"} %lu\n", i, writes);
+            fprintf(fp, "kv_backup_bytes_total{backup=\"%d\"} %lu\n", i, bytes);
+            fprintf(fp, "kv_backup_cq_polls_total{backup=\"%d\"} %lu\n", i, polls);
+            fprintf(fp, "kv_backup_cq_sleeps_total{backup=\"%d\"} %lu\n", i, sleeps);
+        }
+
+        int port_num = rdma_port_num(rdma_ctx);
+        if (port_num > 0)
+        {
+            fprintf(fp, "# TYPE kv_port_writes_total counter\n# TYPE kv_port_bytes_total counter\n");
+        }
+        for (int i = 0; i < port_num; i++)
+        {
+            const char *name;
+            int port;
+
+            rdma_port_stats(rdma_ctx, i, &name, &port, &writes, &bytes);
+            fprintf(fp, "kv_port_writes_total{dev=\"%s\",port=\"%d\"} %lu\n", name, port, writes);
+            fprintf(fp, "kv_port_bytes_total{dev=\"%s\",port=\"%d\"} %lu\n", name, port, bytes);
+        }
+    }
+
+    if (wal)
+    {
+        unsigned long records, syncs;
+
+        wal_stats(wal, &records, &syncs);
+        fprintf(fp, "# TYPE kv_wal_records_total counter\nkv_wal_records_total %lu\n", records);
+        fprintf(fp, "# TYPE kv_wal_syncs_total counter\nkv_wal_syncs_total %lu\n", syncs);
+    }
+
+    // Chains are walked without locks so that requests are not held up, the counts being approximate under writes
+    unsigned used, free_num, max_chain, chains[STATS_CHAIN_MAX + 1], lengths[BUCKET_NUM];
+    ht_stats(ht, &used, is_primary ? &free_num : NULL, &max_chain);
+    ht_chain_lengths(ht, chains, STATS_CHAIN_MAX + 1);
+    ht_bucket_lengths(ht, lengths);
+
+    fprintf(fp, "# TYPE kv_table_used gauge\nkv_table_used %u\n", used);
+    if (is_primary)
+    {
+        fprintf(fp, "# TYPE kv_table_free gauge\nkv_table_free %u\n", free_num);
+    }
+    fprintf(fp, "# TYPE kv_table_fill_ratio gauge\nkv_table_fill_ratio %.4f\n", (double)used / ELEMENT_NUM);
+    fprintf(fp, "# TYPE kv_table_chain_max gauge\nkv_table_chain_max %u\n", max_chain);
+
+    // The last length counts longer chains too
+    fprintf(fp, "# TYPE kv_table_chains gauge\n");
+    for (int i = 0; i <= STATS_CHAIN_MAX; i++)
+    {
+        if (chains[i] > 0)
+        {
+            fprintf(fp, "kv_table_chains{length=\"%d%s\"} %u\n", i, i == STATS_CHAIN_MAX ? "+" : "", chains[i]);
+        }
+    }
+
+    // Buckets taking more accesses or keys than others show the hash clustering keys
+    unsigned long accesses[BUCKET_NUM];
+    heat_buckets(heat, accesses);
+
+    fprintf(fp, "# TYPE kv_bucket_length gauge\n# TYPE kv_bucket_accesses_total counter\n");
+    for (int i = 0; i < BUCKET_NUM; i++)
+    {
+        fprintf(fp, "kv_bucket_length{bucket=\"%d\"} %u\n", i, lengths[i]);
+        fprintf(fp, "kv_bucket_accesses_total{bucket=\"%d\"} %lu\n", i, accesses[i]);
+    }
+
+    // Counts are upper bounds, over by at most the error
+    struct heat_key keys[HEAT_TOP_K];
+    int n = heat_top(heat, keys, HEAT_TOP_K);
+
+    fprintf(fp, "# TYPE kv_hot_key_accesses_total counter\n# TYPE kv_hot_key_error gauge\n");
+    for (int i = 0; i < n; i++)
+    {
+        fprintf(fp, "kv_hot_key_accesses_total{rank=\"%d\",key=\"%u\"} %lu\n", i, keys[i].key, keys[i].count);
+        fprintf(fp, "kv_hot_key_error{rank=\"%d\",key=\"%u\"} %lu\n", i, keys[i].key, keys[i].error);
+    }
+
+    return ferror(fp) ? -1 : 0;
+}
@@ -8,7 +8,7 @@
 
 #include "sokt.h"
 
-#define BACKLOG 5
+#define BACKLOG SOMAXCONN
 
 struct addrinfo *getaddrinfo_wrapper(char *addr, char *port);
 void close_wrapper(int sockfd);
@@ -25,6 +25,36 @@ void skot_message_show(const struct sokt_message *msg)
     case SOKT_CODE_GET:
         printf("GET       ");
         break;
+    case SOKT_CODE_DEL:
+        printf("DEL       ");
+        break;
+    case SOKT_CODE_INCR:
+        printf("INCR      ");
+        break;
+    case SOKT_CODE_CAS:
+        printf("CAS       ");
+        break;
+    case SOKT_CODE_FADD:
+        printf("FADD      ");
+        break;
+    case SOKT_CODE_TXN:
+        printf("TXN       ");
+        break;
+    case SOKT_CODE_JOIN:
+        printf("JOIN      ");
+        break;
+    case SOKT_CODE_SAVE:
+        printf("SAVE      ");
+        break;
+    case SOKT_CODE_CHECKPOINT:
+        printf("CHECKPOINT");
+        break;
+    case SOKT_CODE_TRACE:
+        printf("TRACE     ");
+        break;
+    case SOKT_CODE_STATS:
+        printf("STATS     ");
+        break;
     case SOKT_CODE_SUCCESS:
         printf("SUCCESS   ");
         break;
@@ -37,6 +67,9 @@ void skot_message_show(const struct sokt_message *msg)
     case SOKT_CODE_NOT_FOUND:
         printf("NOT_FOUND ");
         break;
+    case SOKT_CODE_MISMATCH:
+        printf("MISMATCH  ");
+        break;
     default:
         printf("unknown  ");
         break;
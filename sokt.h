@@ -27,7 +27,19 @@ enum sokt_message_code
     SOKT_CODE_SUCCESS,
     SOKT_CODE_ERROR,
     SOKT_CODE_FULL,
-    SOKT_CODE_NOT_FOUND
+    SOKT_CODE_NOT_FOUND,
+    // Codes added later come after the original ones, which keep their values on the wire
+    SOKT_CODE_JOIN,       // From a backup joining the primary
+    SOKT_CODE_SAVE,       // Save a snapshot of the hashtable
+    SOKT_CODE_CHECKPOINT, // Save a snapshot of the hashtable without pausing PUTs
+    SOKT_CODE_DEL,
+    SOKT_CODE_INCR,     // Add one and return the new value
+    SOKT_CODE_CAS,      // Put the value if the current one is the expected one
+    SOKT_CODE_FADD,     // Add the value and return the old one
+    SOKT_CODE_MISMATCH, // From SOKT_CODE_CAS, with the current value
+    SOKT_CODE_TXN,      // PUT the keys of the value messages following this one atomically
+    SOKT_CODE_TRACE,    // Show and dump the phase traces of requests
+    SOKT_CODE_STATS     // Get live counters, as text of the length given by the value of the reply following it
 };
 
 /**
@@ -39,6 +51,8 @@ struct sokt_message
     int key;
     int value;
     enum sokt_message_code code;
+    int ttl;      // In ms for SOKT_CODE_PUT, or for SOKT_CODE_INCR and SOKT_CODE_FADD creating the key, 0 for never expiring
+    int expected; // For SOKT_CODE_CAS
 };
 
 /**
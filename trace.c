@@ -0,0 +1,295 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+#include "trace.h"
+
+#define CALIBRATE_MS 20
+
+static const char *phase_names[] = {"queue", "recv", "lock", "ht", "wal", "reply", "post", "wait"};
+_Static_assert(sizeof(phase_names) / sizeof(*phase_names) == TRACE_PHASE_NUM, "every phase needs a name");
+
+struct sample
+{
+    struct trace_span span;
+    const char *name;
+};
+
+// Workers only take their own mutex, so tracing does not serialize them
+struct worker
+{
+    pthread_mutex_t mutex;
+    struct hist *hists[TRACE_PHASE_NUM + 1]; // In ns, the last one for whole requests
+    struct sample *ring;
+    unsigned long ended;
+    unsigned long sampled;
+};
+
+struct trace
+{
+    unsigned worker_num;
+    unsigned ring_size;
+    unsigned sample;
+    uint64_t base; // Ticks at creation, the origin of the timestamps dumped
+    double ticks_per_ns;
+    struct worker *workers;
+};
+
+static double calibrate(void);
+static void merge(struct trace *trace, struct hist **hists);
+
+struct trace *trace_create(unsigned worker_num, unsigned ring_size, unsigned sample)
+{
+    assert(worker_num > 0);
+    assert(ring_size > 0);
+    assert(sample > 0);
+
+    struct trace *trace = calloc(1, sizeof(struct trace));
+    if (!trace)
+    {
+        perror("calloc for trace");
+        goto out1;
+    }
+
+    trace->worker_num = worker_num;
+    trace->ring_size = ring_size;
+    trace->sample = sample;
+
+    trace->workers = calloc(worker_num, sizeof(struct worker));
+    if (!trace->workers)
+    {
+        perror("calloc for workers");
+        goto out2;
+    }
+
+    for (unsigned i = 0; i < worker_num; i++)
+    {
+        struct worker *w = &trace->workers[i];
+
+        pthread_mutex_init(&w->mutex, NULL);
+
+        w->ring = calloc(ring_size, sizeof(struct sample));
+        if (!w->ring)
+        {
+            perror("calloc for ring");
+            goto out3;
+        }
+
+        for (int j = 0; j < TRACE_PHASE_NUM + 1; j++)
+        {
+            w->hists[j] = hist_create();
+            if (!w->hists[j])
+            {
+                fprintf(stderr, "hist_create failed\n");
+                goto out3;
+            }
+        }
+    }
+
+    trace->ticks_per_ns = calibrate();
+    trace->base = trace_ticks();
+
+    return trace;
+
+out3:
+    trace_destroy(trace);
+    return NULL;
+out2:
+    free(trace);
+out1:
+    return NULL;
+}
+
+void trace_destroy(struct trace *trace)
+{
+    if (!trace)
+    {
+        return;
+    }
+
+    for (unsigned i = 0; i < trace->worker_num; i++)
+    {
+        struct worker *w = &trace->workers[i];
+
+        for (int j = 0; j < TRACE_PHASE_NUM + 1; j++)
+        {
+            hist_destroy(w->hists[j]);
+        }
+        free(w->ring);
+        pthread_mutex_destroy(&w->mutex);
+    }
+
+    free(trace->workers);
+    free(trace);
+}
+
+void trace_end(struct trace *trace, unsigned worker, const struct trace_span *span, const char *name)
+{
+    assert(trace);
+    assert(worker < trace->worker_num);
+    assert(span);
+
+    struct worker *w = &trace->workers[worker];
+
+    pthread_mutex_lock(&w->mutex);
+
+    for (int i = 0; i < TRACE_PHASE_NUM; i++)
+    {
+        if (span->durations[i] != 0)
+        {
+            hist_record(w->hists[i], span->durations[i] / trace->ticks_per_ns);
+        }
+    }
+    hist_record(w->hists[TRACE_PHASE_NUM], (span->last - span->start) / trace->ticks_per_ns);
+
+    if (w->ended++ % trace->sample == 0)
+    {
+        struct sample *s = &w->ring[w->sampled++ % trace->ring_size];
+        s->span = *span;
+        s->name = name;
+    }
+
+    pthread_mutex_unlock(&w->mutex);
+}
+
+void trace_show(struct trace *trace)
+{
+    assert(trace);
+
+    struct hist *hists[TRACE_PHASE_NUM + 1] = {0};
+    for (int i = 0; i < TRACE_PHASE_NUM + 1; i++)
+    {
+        hists[i] = hist_create();
+        if (!hists[i])
+        {
+            fprintf(stderr, "hist_create failed\n");
+            goto out;
+        }
+    }
+
+    merge(trace, hists);
+
+    printf("%-8s %10s %10s %10s %10s %10s %10s\n", "phase", "count", "mean_us", "p50_us", "p99_us", "p99.9_us",
+           "max_us");
+    for (int i = 0; i < TRACE_PHASE_NUM + 1; i++)
+    {
+        printf("%-8s %10lu %10.2f %10.2f %10.2f %10.2f %10.2f\n", i < TRACE_PHASE_NUM ? phase_names[i] : "total",
+               hist_count(hists[i]), hist_mean(hists[i]) / 1000, hist_percentile(hists[i], 50) / 1000.0,
+               hist_percentile(hists[i], 99) / 1000.0, hist_percentile(hists[i], 99.9) / 1000.0,
+               hist_max(hists[i]) / 1000.0);
+    }
+
+out:
+    for (int i = 0; i < TRACE_PHASE_NUM + 1; i++)
+    {
+        hist_destroy(hists[i]);
+    }
+}
+
+int trace_dump(struct trace *trace, FILE *fp)
+{
+    assert(trace);
+    assert(fp);
+
+    int rv = -1;
+    struct hist *hists[TRACE_PHASE_NUM + 1] = {0};
+    for (int i = 0; i < TRACE_PHASE_NUM + 1; i++)
+    {
+        hists[i] = hist_create();
+        if (!hists[i])
+        {
+            fprintf(stderr, "hist_create failed\n");
+            goto out;
+        }
+    }
+
+    merge(trace, hists);
+
+    // A complete event for each request, and one for each of its phases on top of it
+    double us = trace->ticks_per_ns * 1000;
+    const char *sep = "";
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ns\",\n\"traceEvents\": [");
+    for (unsigned i = 0; i < trace->worker_num; i++)
+    {
+        struct worker *w = &trace->workers[i];
+
+        pthread_mutex_lock(&w->mutex);
+
+        unsigned long n = w->sampled < trace->ring_size ? w->sampled : trace->ring_size;
+        for (unsigned long j = w->sampled - n; j < w->sampled; j++)
+        {
+            const struct sample *s = &w->ring[j % trace->ring_size];
+
+            fprintf(fp, "%s\n{\"name\": \"%s\", \"cat\": \"request\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                        "\"ts\": %.3f, \"dur\": %.3f}",
+                    sep, s->name, i, (int64_t)(s->span.start - trace->base) / us,
+                    (s->span.last - s->span.start) / us);
+            sep = ",";
+
+            for (int k = 0; k < TRACE_PHASE_NUM; k++)
+            {
+                if (s->span.durations[k] != 0)
+                {
+                    fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 0, \"tid\": %u, "
+                                "\"ts\": %.3f, \"dur\": %.3f}",
+                            phase_names[k], i, (int64_t)(s->span.begins[k] - trace->base) / us,
+                            s->span.durations[k] / us);
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&w->mutex);
+    }
+
+    fprintf(fp, "\n],\n\"phases\": {");
+    for (int i = 0; i < TRACE_PHASE_NUM + 1; i++)
+    {
+        fprintf(fp, "%s\n\"%s\": ", i > 0 ? "," : "", i < TRACE_PHASE_NUM ? phase_names[i] : "total");
+        hist_write_json(hists[i], fp);
+    }
+    fprintf(fp, "\n}}\n");
+
+    rv = ferror(fp) ? -1 : 0;
+
+out:
+    for (int i = 0; i < TRACE_PHASE_NUM + 1; i++)
+    {
+        hist_destroy(hists[i]);
+    }
+
+    return rv;
+}
+
+// Ticks per ns
+static double calibrate(void)
+{
+    struct timespec a, b, interval = {0, CALIBRATE_MS * 1000000};
+
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uint64_t start = trace_ticks();
+    nanosleep(&interval, NULL);
+    uint64_t end = trace_ticks();
+    clock_gettime(CLOCK_MONOTONIC, &b);
+
+    return (end - start) / ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec));
+}
+
+static void merge(struct trace *trace, struct hist **hists)
+{
+    for (unsigned i = 0; i < trace->worker_num; i++)
+    {
+        struct worker *w = &trace->workers[i];
+
+        pthread_mutex_lock(&w->mutex);
+        for (int j = 0; j < TRACE_PHASE_NUM + 1; j++)
+        {
+            hist_merge(hists[j], w->hists[j]);
+        }
+        pthread_mutex_unlock(&w->mutex);
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * Per-request phase timing on servers
+ */
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief Phases a request goes through, in order
+ *
+ */
+enum trace_phase
+{
+    TRACE_PHASE_QUEUE, // Accepted until a worker picks it up
+    TRACE_PHASE_RECV,
+    TRACE_PHASE_LOCK,
+    TRACE_PHASE_HT,
+    TRACE_PHASE_WAL,
+    TRACE_PHASE_REPLY,
+    TRACE_PHASE_POST, // Posting the RDMA writes, or handing them to the replication thread
+    TRACE_PHASE_WAIT, // Waiting for their completion
+    TRACE_PHASE_NUM
+};
+
+/**
+ * @brief Traces of all workers, aggregated into per-phase histograms with some requests sampled into rings
+ *
+ */
+struct trace;
+
+/**
+ * @brief Timestamps of one request, kept by the worker handling it
+ *
+ */
+struct trace_span
+{
+    uint64_t start; // Ticks
+    uint64_t last;
+    uint64_t begins[TRACE_PHASE_NUM];
+    uint64_t durations[TRACE_PHASE_NUM];
+};
+
+/**
+ * @brief Read the tick counter, the TSC where there is one
+ *
+ * @return uint64_t
+ */
+static inline uint64_t trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Start a span
+ *
+ * @param span
+ * @param start ticks when the request arrived
+ */
+static inline void trace_begin(struct trace_span *span, uint64_t start)
+{
+    memset(span, 0, sizeof(struct trace_span));
+    span->start = span->last = start;
+}
+
+/**
+ * @brief End a phase, which lasted since the previous mark (a phase can be marked several times)
+ *
+ * @param span
+ * @param phase
+ */
+static inline void trace_mark(struct trace_span *span, enum trace_phase phase)
+{
+    uint64_t now = trace_ticks();
+
+    if (span->durations[phase] == 0)
+    {
+        span->begins[phase] = span->last;
+    }
+    span->durations[phase] += now - span->last;
+    span->last = now;
+}
+
+/**
+ * @brief Create traces, calibrating the tick counter against the monotonic clock
+ *
+ * @param worker_num
+ * @param ring_size number of spans kept per worker
+ * @param sample one span in sample is kept
+ * @return struct trace* NULL for failure
+ */
+struct trace *trace_create(unsigned worker_num, unsigned ring_size, unsigned sample);
+
+/**
+ * @brief Destroy traces
+ *
+ * @param trace
+ */
+void trace_destroy(struct trace *trace);
+
+/**
+ * @brief Account for a finished span
+ *
+ * @param trace
+ * @param worker
+ * @param span
+ * @param name of the request, should outlive the trace
+ */
+void trace_end(struct trace *trace, unsigned worker, const struct trace_span *span, const char *name);
+
+/**
+ * @brief Print the latency percentiles of each phase
+ *
+ * @param trace
+ */
+void trace_show(struct trace *trace);
+
+/**
+ * @brief Write the sampled spans in the Chrome trace event format, with the per-phase histograms under "phases"
+ *
+ * @param trace
+ * @param fp
+ * @return int -1 for failure
+ */
+int trace_dump(struct trace *trace, FILE *fp);
+
+#endif
@@ -0,0 +1,564 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+#define BUFFER_RECORD_NUM 4096
+
+struct record
+{
+    int32_t key;
+    int32_t value;
+    uint32_t code;
+    uint32_t check; // Tells a complete record from a torn one at the end of the log
+    int64_t expire;
+};
+
+struct buffer
+{
+    struct record records[BUFFER_RECORD_NUM];
+    int n;
+};
+
+// Whoever finds no flush running becomes the leader and flushes the current buffer for everybody,
+// while appends keep going to the other buffer
+struct wal
+{
+    int fd;
+    char *path;
+    off_t size;
+    off_t base; // Bytes dropped from the front of the log so far, positions count from its first creation
+    unsigned batch_us;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct buffer buffers[2];
+    int cur;           // Buffer appends go to
+    uint64_t appended; // Sequence number of the last record appended
+    uint64_t durable;  // Sequence number of the last record on disk
+    char is_flushing;
+    char is_failed; // The log cannot be trusted after a failed write
+    unsigned long syncs;
+};
+
+static uint32_t record_check(int32_t key, int32_t value, uint32_t code, int64_t expire);
+static void record_fill(struct record *r, enum wal_code code, ht_key_t key, ht_value_t value, int64_t expire);
+static int append(struct wal *wal, const struct record *records, int n);
+static int apply(struct ht *ht, const struct record *r);
+static void flush(struct wal *wal);
+static int write_all(int fd, const void *buf, size_t size, off_t offset);
+
+struct wal *wal_open(const char *path, unsigned batch_us)
+{
+    assert(path);
+
+    struct wal *wal = calloc(1, sizeof(struct wal));
+    if (!wal)
+    {
+        perror("calloc for wal");
+        goto out1;
+    }
+
+    wal->batch_us = batch_us;
+
+    wal->path = strdup(path);
+    if (!wal->path)
+    {
+        perror("strdup for wal->path");
+        goto out2;
+    }
+
+    wal->fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (wal->fd == -1)
+    {
+        perror("open");
+        goto out2;
+    }
+
+    wal->size = lseek(wal->fd, 0, SEEK_END);
+    if (wal->size == -1)
+    {
+        perror("lseek");
+        goto out3;
+    }
+
+    if (pthread_mutex_init(&wal->mutex, NULL) != 0)
+    {
+        perror("pthread_mutex_init");
+        goto out3;
+    }
+
+    if (pthread_cond_init(&wal->cond, NULL) != 0)
+    {
+        perror("pthread_cond_init");
+        goto out4;
+    }
+
+    return wal;
+
+out4:
+    pthread_mutex_destroy(&wal->mutex);
+out3:
+    close(wal->fd);
+out2:
+    free(wal->path);
+    free(wal);
+out1:
+    return NULL;
+}
+
+void wal_close(struct wal *wal)
+{
+    if (!wal)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&wal->mutex);
+    while (wal->is_flushing)
+    {
+        pthread_cond_wait(&wal->cond, &wal->mutex);
+    }
+    if (wal->buffers[wal->cur].n > 0 && !wal->is_failed)
+    {
+        flush(wal);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+
+    pthread_cond_destroy(&wal->cond);
+    pthread_mutex_destroy(&wal->mutex);
+    close(wal->fd);
+    free(wal->path);
+    free(wal);
+}
+
+int wal_append(struct wal *wal, enum wal_code code, ht_key_t key, ht_value_t value, int64_t expire)
+{
+    assert(wal);
+    assert(code == WAL_CODE_PUT || code == WAL_CODE_DEL);
+
+    struct record r;
+    record_fill(&r, code, key, value, expire);
+
+    return append(wal, &r, 1);
+}
+
+int wal_append_txn(struct wal *wal, const ht_key_t *keys, const ht_value_t *values, const int64_t *expires, int n)
+{
+    assert(wal);
+    assert(0 < n && n < BUFFER_RECORD_NUM);
+
+    struct record records[n + 1];
+
+    // The header counts the records of the transaction, so that replay can tell whether all of them made it
+    record_fill(&records[0], WAL_CODE_TXN, 0, n, 0);
+    for (int i = 0; i < n; i++)
+    {
+        record_fill(&records[i + 1], WAL_CODE_PUT, keys[i], values[i], expires[i]);
+    }
+
+    return append(wal, records, n + 1);
+}
+
+// Records appended together end up in the same buffer, and so in the same write
+static int append(struct wal *wal, const struct record *records, int n)
+{
+    pthread_mutex_lock(&wal->mutex);
+
+    while (wal->buffers[wal->cur].n + n > BUFFER_RECORD_NUM && !wal->is_failed)
+    {
+        pthread_cond_wait(&wal->cond, &wal->mutex);
+    }
+
+    if (wal->is_failed)
+    {
+        pthread_mutex_unlock(&wal->mutex);
+        return -1;
+    }
+
+    struct buffer *buf = &wal->buffers[wal->cur];
+    memcpy(buf->records + buf->n, records, n * sizeof(struct record));
+    buf->n += n;
+
+    uint64_t seq = wal->appended += n;
+
+    while (wal->durable < seq && !wal->is_failed)
+    {
+        if (!wal->is_flushing)
+        {
+            flush(wal);
+        }
+        else
+        {
+            pthread_cond_wait(&wal->cond, &wal->mutex);
+        }
+    }
+
+    int rv = wal->durable >= seq ? 0 : -1;
+
+    pthread_mutex_unlock(&wal->mutex);
+
+    return rv;
+}
+
+int wal_truncate(struct wal *wal)
+{
+    assert(wal);
+
+    int rv = -1;
+
+    pthread_mutex_lock(&wal->mutex);
+
+    if (ftruncate(wal->fd, 0) == -1)
+    {
+        perror("ftruncate");
+        goto out;
+    }
+
+    if (fdatasync(wal->fd) == -1)
+    {
+        perror("fdatasync");
+        goto out;
+    }
+
+    wal->base += wal->size;
+    wal->size = 0;
+    rv = 0;
+
+out:
+    pthread_mutex_unlock(&wal->mutex);
+
+    return rv;
+}
+
+off_t wal_position(struct wal *wal)
+{
+    assert(wal);
+
+    pthread_mutex_lock(&wal->mutex);
+    off_t position = wal->base + wal->size;
+    pthread_mutex_unlock(&wal->mutex);
+
+    return position;
+}
+
+// The records kept go to a new file renamed over the log, so that a crash leaves either the old log or the new one
+int wal_truncate_before(struct wal *wal, off_t position)
+{
+    assert(wal);
+
+    int rv = -1;
+    char *buf = NULL;
+    char tmp_path[strlen(wal->path) + sizeof(".tmp")];
+    sprintf(tmp_path, "%s.tmp", wal->path);
+
+    pthread_mutex_lock(&wal->mutex);
+
+    // Flushes write at the end of the log without the mutex
+    while (wal->is_flushing)
+    {
+        pthread_cond_wait(&wal->cond, &wal->mutex);
+    }
+
+    if (position <= wal->base)
+    {
+        rv = 0;
+        goto out1;
+    }
+
+    off_t drop = position - wal->base < wal->size ? position - wal->base : wal->size;
+    size_t keep = wal->size - drop;
+
+    buf = malloc(keep > 0 ? keep : 1);
+    if (!buf)
+    {
+        perror("malloc for buf");
+        goto out1;
+    }
+
+    int fd = open(wal->path, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open");
+        goto out1;
+    }
+
+    ssize_t n = 0;
+    for (size_t done = 0; done < keep; done += n)
+    {
+        n = pread(fd, buf + done, keep - done, drop + done);
+        if (n <= 0)
+        {
+            perror("pread");
+            close(fd);
+            goto out1;
+        }
+    }
+    close(fd);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror("open");
+        goto out1;
+    }
+
+    if (write_all(fd, buf, keep, 0) == -1 || fdatasync(fd) == -1 || rename(tmp_path, wal->path) == -1)
+    {
+        perror("write, fdatasync or rename");
+        close(fd);
+        unlink(tmp_path);
+        goto out1;
+    }
+
+    close(wal->fd);
+    wal->fd = fd;
+    wal->base += drop;
+    wal->size = keep;
+    rv = 0;
+
+out1:
+    pthread_mutex_unlock(&wal->mutex);
+    free(buf);
+
+    return rv;
+}
+
+long wal_replay(const char *path, struct ht *ht)
+{
+    assert(path);
+    assert(ht);
+
+    long n = 0;
+    struct record records[BUFFER_RECORD_NUM];
+    ssize_t len;
+    off_t offset = 0;
+
+    int fd = open(path, O_RDWR);
+    if (fd == -1)
+    {
+        if (errno == ENOENT)
+        {
+            return 0;
+        }
+
+        perror("open");
+        return -1;
+    }
+
+    while ((len = pread(fd, records, sizeof(records), offset)) > 0)
+    {
+        int i, num = len / sizeof(struct record);
+        char is_split = 0; // A transaction continues in the next read
+
+        for (i = 0; i < num; i++)
+        {
+            struct record *r = &records[i];
+            if (r->check != record_check(r->key, r->value, r->code, r->expire) || r->key < HT_KEY_MIN || r->key > HT_KEY_MAX)
+            {
+                break;
+            }
+
+            if (r->code != WAL_CODE_TXN)
+            {
+                if (apply(ht, r) == -1)
+                {
+                    fprintf(stderr, "apply failed for record %ld\n", n);
+                    n = -1;
+                    goto out;
+                }
+                n++;
+                continue;
+            }
+
+            // A transaction is applied once all of its records are known to be complete
+            int txn_num = r->value;
+            if (txn_num <= 0 || txn_num >= BUFFER_RECORD_NUM)
+            {
+                break;
+            }
+
+            if (i + txn_num >= num)
+            {
+                is_split = len == sizeof(records) && i > 0;
+                break;
+            }
+
+            int j;
+            for (j = i + 1; j <= i + txn_num; j++)
+            {
+                if (records[j].check != record_check(records[j].key, records[j].value, records[j].code, records[j].expire) ||
+                    records[j].code != WAL_CODE_PUT || records[j].key < HT_KEY_MIN || records[j].key > HT_KEY_MAX)
+                {
+                    break;
+                }
+            }
+            if (j <= i + txn_num)
+            {
+                break;
+            }
+
+            for (j = i + 1; j <= i + txn_num; j++)
+            {
+                if (apply(ht, &records[j]) == -1)
+                {
+                    fprintf(stderr, "apply failed for record %ld\n", n);
+                    n = -1;
+                    goto out;
+                }
+            }
+
+            n += txn_num + 1;
+            i += txn_num;
+        }
+
+        offset += i * sizeof(struct record);
+        if (!is_split && (i < num || len % sizeof(struct record) != 0))
+        {
+            break;
+        }
+    }
+
+    if (len == -1)
+    {
+        perror("pread");
+        n = -1;
+        goto out;
+    }
+
+    // Appends go after the last complete record
+    if (ftruncate(fd, offset) == -1)
+    {
+        perror("ftruncate");
+        n = -1;
+    }
+
+out:
+    close(fd);
+
+    return n;
+}
+
+void wal_stats(struct wal *wal, unsigned long *records, unsigned long *syncs)
+{
+    assert(wal);
+
+    pthread_mutex_lock(&wal->mutex);
+    if (records)
+    {
+        *records = wal->appended;
+    }
+    if (syncs)
+    {
+        *syncs = wal->syncs;
+    }
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+static void record_fill(struct record *r, enum wal_code code, ht_key_t key, ht_value_t value, int64_t expire)
+{
+    r->key = key;
+    r->value = code == WAL_CODE_DEL ? 0 : value;
+    r->code = code;
+    r->expire = code == WAL_CODE_PUT ? expire : 0;
+    r->check = record_check(r->key, r->value, r->code, r->expire);
+}
+
+static int apply(struct ht *ht, const struct record *r)
+{
+    if (r->code == WAL_CODE_DEL)
+    {
+        return ht_del(ht, r->key, NULL, NULL) == HT_CODE_ERROR ? -1 : 0;
+    }
+
+    return ht_put_expire(ht, r->key, r->value, r->expire, NULL, NULL, NULL) == HT_CODE_SUCCESS ? 0 : -1;
+}
+
+// FNV-1a over the record fields
+static uint32_t record_check(int32_t key, int32_t value, uint32_t code, int64_t expire)
+{
+    uint32_t h = 2166136261u;
+    uint32_t fields[5] = {key, value, code, (uint64_t)expire, (uint64_t)expire >> 32};
+
+    for (int i = 0; i < 5; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            h ^= (fields[i] >> (8 * j)) & 0xff;
+            h *= 16777619u;
+        }
+    }
+
+    return h;
+}
+
+// Called and returns with the mutex held, which is dropped during the write
+static void flush(struct wal *wal)
+{
+    wal->is_flushing = 1;
+
+    // Give concurrent appends a chance to join this batch
+    if (wal->batch_us > 0)
+    {
+        pthread_mutex_unlock(&wal->mutex);
+        usleep(wal->batch_us);
+        pthread_mutex_lock(&wal->mutex);
+    }
+
+    struct buffer *buf = &wal->buffers[wal->cur];
+    wal->cur ^= 1;
+    uint64_t seq = wal->appended;
+    off_t offset = wal->size;
+    size_t size = buf->n * sizeof(struct record);
+
+    pthread_mutex_unlock(&wal->mutex);
+
+    int rv = write_all(wal->fd, buf->records, size, offset);
+    if (rv == 0 && fdatasync(wal->fd) == -1)
+    {
+        perror("fdatasync");
+        rv = -1;
+    }
+
+    pthread_mutex_lock(&wal->mutex);
+
+    if (rv == 0)
+    {
+        wal->size += size;
+        wal->durable = seq;
+        wal->syncs++;
+    }
+    else
+    {
+        wal->is_failed = 1;
+    }
+
+    buf->n = 0;
+    wal->is_flushing = 0;
+    pthread_cond_broadcast(&wal->cond);
+}
+
+static int write_all(int fd, const void *buf, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, buf, size, offset);
+        if (n == -1)
+        {
+            perror("pwrite");
+            return -1;
+        }
+
+        buf = (const char *)buf + n;
+        size -= n;
+        offset += n;
+    }
+
+    return 0;
+}
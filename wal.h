@@ -0,0 +1,113 @@
+/*
+ * Write-ahead log of PUTs and DELs with group commit
+ */
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <sys/types.h>
+
+#include "ht.h"
+
+/**
+ * @brief Write-ahead log
+ *
+ */
+struct wal;
+
+/**
+ * @brief Operation of a log record
+ *
+ */
+enum wal_code
+{
+    WAL_CODE_PUT,
+    WAL_CODE_DEL,
+    WAL_CODE_TXN // Header of the WAL_CODE_PUT records of a transaction
+};
+
+/**
+ * @brief Open a log for appending, creating it if needed (replay it first to recover its content)
+ *
+ * @param path
+ * @param batch_us how long a flushing thread waits for others to join its batch, 0 for no wait
+ * @return struct wal* NULL for failure
+ */
+struct wal *wal_open(const char *path, unsigned batch_us);
+
+/**
+ * @brief Flush what is pending and close a log
+ *
+ * @param wal
+ */
+void wal_close(struct wal *wal);
+
+/**
+ * @brief Append an operation and wait until it is on disk, concurrent appends share one fdatasync
+ * (appends for the same key should be serialized by the caller to keep them in order)
+ *
+ * @param wal
+ * @param code
+ * @param key
+ * @param value ignored for WAL_CODE_DEL
+ * @param expire as given to ht_put_expire(), ignored for WAL_CODE_DEL
+ * @return int -1 for failure
+ */
+int wal_append(struct wal *wal, enum wal_code code, ht_key_t key, ht_value_t value, int64_t expire);
+
+/**
+ * @brief Append the PUTs of a transaction as one unit, replay applies all of them or none
+ *
+ * @param wal
+ * @param keys
+ * @param values
+ * @param expires as given to ht_put_expire()
+ * @param n number of PUTs
+ * @return int -1 for failure
+ */
+int wal_append_txn(struct wal *wal, const ht_key_t *keys, const ht_value_t *values, const int64_t *expires, int n);
+
+/**
+ * @brief Drop every record, once they are all covered by a snapshot (no append may run meanwhile)
+ *
+ * @param wal
+ * @return int -1 for failure
+ */
+int wal_truncate(struct wal *wal);
+
+/**
+ * @brief Get the position of the end of the log, to give wal_truncate_before() once a snapshot covers every record
+ * up to it (no append should be running, so that all of them are on disk)
+ *
+ * @param wal
+ * @return off_t
+ */
+off_t wal_position(struct wal *wal);
+
+/**
+ * @brief Drop the records before a position, keeping those appended since it was taken (appends wait meanwhile)
+ *
+ * @param wal
+ * @param position as given by wal_position()
+ * @return int -1 for failure
+ */
+int wal_truncate_before(struct wal *wal, off_t position);
+
+/**
+ * @brief Apply the records of a log to a hashtable, a torn record at the end is cut off
+ *
+ * @param path a missing log counts as an empty one
+ * @param ht
+ * @return long number of records applied, -1 for failure
+ */
+long wal_replay(const char *path, struct ht *ht);
+
+/**
+ * @brief Get the number of records appended and of fdatasync calls issued so far
+ *
+ * @param wal
+ * @param records can be NULL
+ * @param syncs can be NULL
+ */
+void wal_stats(struct wal *wal, unsigned long *records, unsigned long *syncs);
+
+#endif
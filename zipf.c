@@ -0,0 +1,78 @@
+// Reference: J. Gray et al., Quickly Generating Billion-Record Synthetic Databases, SIGMOD 1994
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "zipf.h"
+
+struct zipf
+{
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double threshold; // 1 + 0.5^theta, the cdf bound of the second item
+};
+
+static double zeta(uint64_t n, double theta)
+{
+    double sum = 0;
+
+    for (uint64_t i = 1; i <= n; i++)
+    {
+        sum += 1 / pow((double)i, theta);
+    }
+
+    return sum;
+}
+
+struct zipf *zipf_create(uint64_t n, double theta)
+{
+    assert(n > 0);
+    assert(0 <= theta && theta < 1);
+
+    struct zipf *zipf = calloc(1, sizeof(struct zipf));
+    if (!zipf)
+    {
+        perror("calloc for zipf");
+        return NULL;
+    }
+
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->alpha = 1 / (1 - theta);
+    zipf->zetan = zeta(n, theta);
+    zipf->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / zipf->zetan);
+    zipf->threshold = 1 + pow(0.5, theta);
+
+    return zipf;
+}
+
+void zipf_destroy(struct zipf *zipf)
+{
+    free(zipf);
+}
+
+uint64_t zipf_next(const struct zipf *zipf, unsigned short state[3])
+{
+    assert(zipf);
+    assert(state);
+
+    double u = erand48(state);
+    double uz = u * zipf->zetan;
+
+    if (uz < 1)
+    {
+        return 0;
+    }
+    if (uz < zipf->threshold)
+    {
+        return zipf->n > 1 ? 1 : 0;
+    }
+
+    uint64_t rank = zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha);
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
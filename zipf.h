@@ -0,0 +1,40 @@
+/*
+ * Zipfian random number generator for skewed workloads
+ */
+#ifndef ZIPF_H_
+#define ZIPF_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Zipfian distribution over [0, n)
+ *
+ */
+struct zipf;
+
+/**
+ * @brief Create a zipfian distribution, rank 0 being the most popular item
+ *
+ * @param n the number of items
+ * @param theta skewness in [0, 1), 0 for uniform
+ * @return struct zipf* NULL for failure
+ */
+struct zipf *zipf_create(uint64_t n, double theta);
+
+/**
+ * @brief Destroy a zipfian distribution
+ *
+ * @param zipf
+ */
+void zipf_destroy(struct zipf *zipf);
+
+/**
+ * @brief Draw the next item, thread safe as long as each thread has its own state
+ *
+ * @param zipf
+ * @param state erand48() state owned by the caller
+ * @return uint64_t
+ */
+uint64_t zipf_next(const struct zipf *zipf, unsigned short state[3]);
+
+#endif